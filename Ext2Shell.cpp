@@ -7,37 +7,212 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <cstring>
+#include <cstdlib>
 #include <iomanip>
-#include <fstream>
 #include <algorithm>
+#include <type_traits>
+#include <map>
+#include <chrono>
+#include <cstddef>
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fstream>
+#include <atomic>
+#include <limits>
+#include <exception>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 // Construtor: Abre a imagem e inicializa o estado
-Ext2Shell::Ext2Shell(const std::string& imagePath) : fd(open(imagePath.c_str(), O_RDWR)), imagePath(imagePath) {
+Ext2Shell::Ext2Shell(const std::string& imagePath, bool journal, const std::string& overlayPath, bool readOnly)
+    : fd(open(imagePath.c_str(), overlayPath.empty() && !readOnly ? O_RDWR : O_RDONLY)), imagePath(imagePath),
+    readOnly(readOnly), reaperStop(false),
+    journalEnabled(journal), journalFd(-1), journalPath((overlayPath.empty() ? imagePath : overlayPath) + ".journal"),
+    journalPending(0), journalSequence(0), journalBytes(0), overlayFd(-1), overlayPath(overlayPath), overlayEnd(0),
+    deferAllocation(false), deferredSuperDirty(false), compactThreshold(0), serving(false) {
     if (fd < 0) {
         // Usamos this->imagePath para ser explícito que estamos usando o membro da classe.
         throw std::runtime_error("Error: Could not open image file '" + this->imagePath + "'.");
     }
+#ifdef HAVE_LIBURING
+    ringReady = io_uring_queue_init(IO_QUEUE_DEPTH, &ring, 0) == 0;
+#endif
     initialize();
+
+    // A thread de fundo retoma imediatamente qualquer órfão deixado por uma
+    // execução anterior (a lista fica persistida em s_last_orphan).
+    if (!readOnly) {
+        reaperThread = std::thread(&Ext2Shell::reaperLoop, this);
+    }
 }
 
-// Destrutor: Fecha o arquivo
+// Destrutor: Termina de liberar os órfãos pendentes e fecha o arquivo
 Ext2Shell::~Ext2Shell() {
+    {
+        std::lock_guard<std::mutex> lock(fsMutex);
+        reaperStop = true;
+    }
+    reaperCv.notify_one();
+    if (reaperThread.joinable()) {
+        reaperThread.join();
+    }
+    // Grava o que falta do diário, aplica tudo na imagem e descarta o arquivo
+    if (journalFd >= 0) {
+        try {
+            journalCheckpoint();
+            close(journalFd);
+            unlink(journalPath.c_str());
+        } catch (const std::exception& e) {
+            std::cerr << "Caught exception while closing the journal: " << e.what() << std::endl;
+        }
+    }
+    if (overlayFd >= 0) {
+        close(overlayFd);
+    }
+#ifdef HAVE_LIBURING
+    if (ringReady) {
+        io_uring_queue_exit(&ring);
+    }
+#endif
     if (fd >= 0) {
         close(fd);
     }
 }
 
+// --- Buffers de bloco ---
+
+BlockBuffer::BlockBuffer(BlockBuffer&& other) noexcept : pool(other.pool), memory(other.memory), batch(other.batch) {
+    other.memory = nullptr;
+}
+
+BlockBuffer& BlockBuffer::operator=(BlockBuffer&& other) noexcept {
+    if (this != &other) {
+        if (memory) pool->release(memory, batch);
+        pool = other.pool;
+        memory = other.memory;
+        batch = other.batch;
+        other.memory = nullptr;
+    }
+    return *this;
+}
+
+BlockBuffer::~BlockBuffer() {
+    if (memory) pool->release(memory, batch);
+}
+
+BlockPool::~BlockPool() {
+    for (char* memory : freeList) {
+        free(memory);
+    }
+    for (char* memory : batchFreeList) {
+        free(memory);
+    }
+}
+
+void BlockPool::setBufferSize(size_t bufferSize) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (bufferSize == size) return;
+    for (char* memory : freeList) {
+        free(memory);
+    }
+    for (char* memory : batchFreeList) {
+        free(memory);
+    }
+    freeList.clear();
+    batchFreeList.clear();
+    size = bufferSize;
+}
+
+BlockBuffer BlockPool::acquireBatch() {
+    char* memory = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!batchFreeList.empty()) {
+            memory = batchFreeList.back();
+            batchFreeList.pop_back();
+        }
+    }
+    if (!memory) {
+        void* allocated;
+        if (posix_memalign(&allocated, sysconf(_SC_PAGESIZE), size * IO_BATCH_BLOCKS) != 0) {
+            throw std::bad_alloc();
+        }
+        memory = static_cast<char*>(allocated);
+    }
+    return BlockBuffer(this, memory, true);
+}
+
+BlockBuffer BlockPool::acquire(bool zeroed) {
+    char* memory = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!freeList.empty()) {
+            memory = freeList.back();
+            freeList.pop_back();
+        }
+    }
+    if (!memory) {
+        void* allocated;
+        if (posix_memalign(&allocated, sysconf(_SC_PAGESIZE), size) != 0) {
+            throw std::bad_alloc();
+        }
+        memory = static_cast<char*>(allocated);
+    }
+    if (zeroed) {
+        memset(memory, 0, size);
+    }
+    return BlockBuffer(this, memory);
+}
+
+void BlockPool::release(char* memory, bool batch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<char*>& list = batch ? batchFreeList : freeList;
+    if (list.size() < (batch ? BLOCK_POOL_MAX_FREE_BATCHES : BLOCK_POOL_MAX_FREE)) {
+        list.push_back(memory);
+    } else {
+        free(memory);
+    }
+}
+
 // Inicialização: Lê o superbloco e o inode raiz
 void Ext2Shell::initialize() {
-    lseek(fd, BASE_OFFSET, SEEK_SET);
-    read(fd, &super, sizeof(ext2_super_block));
+    // O tamanho de bloco vem da imagem base; ele nunca muda
+    if (pread(fd, &super, sizeof(ext2_super_block), BASE_OFFSET) != (ssize_t)sizeof(ext2_super_block)) {
+        throw std::runtime_error("Error: Could not read the superblock.");
+    }
 
     if (super.s_magic != EXT2_SUPER_MAGIC) {
         throw std::runtime_error("Error: Not a valid EXT2 filesystem.");
     }
     
     blockSize = 1024 << super.s_log_block_size;
+    blockPool.setBufferSize(blockSize);
+    // Na revisão 0 os inodes têm sempre 128 bytes; depois, s_inode_size
+    inodeSize = super.s_rev_level == 0 ? sizeof(ext2_inode) : super.s_inode_size;
     currentGroupNum = 0;
+
+    if (!overlayPath.empty()) {
+        overlayOpen();
+    }
+
+    // Transações de uma execução interrompida são reaplicadas antes de tudo;
+    // o superbloco pode ter mudado com elas (ou estar na camada de cópia)
+    if (!readOnly) {
+        journalReplay();
+    }
+    if (!diskRead(BASE_OFFSET, &super, sizeof(ext2_super_block))) {
+        throw std::runtime_error("Error: Could not read the superblock.");
+    }
+    if (journalEnabled) {
+        journalFd = open(journalPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (journalFd < 0) {
+            throw std::runtime_error("Error: Could not create journal file '" + journalPath + "'.");
+        }
+    }
     
     updateCurrentDirectory(EXT2_ROOT_INO); // O inode raiz é o 2
 }
@@ -52,57 +227,452 @@ void Ext2Shell::updateCurrentDirectory(unsigned int inodeNum) {
 
 // --- Métodos de Baixo Nível ---
 
-// Calcula o deslocamento do bloco no disco
-inline unsigned int block_offset(unsigned int block, unsigned int blockSize) {
-    return BASE_OFFSET + (block - 1) * blockSize;
+// Calcula o deslocamento do bloco no disco. Em 64 bits: imagens maiores que
+// 4 GiB têm blocos além do alcance de um unsigned int em bytes.
+inline off_t block_offset(unsigned int block, unsigned int blockSize) {
+    return (off_t)block * blockSize;
+}
+
+// Cabeçalho do arquivo de overlay; confere que ele pertence à imagem base
+struct OverlayHeader {
+    uint32_t magic;
+    uint32_t blockSize;
+    uint32_t blocksCount;
+    uint32_t reserved;
+};
+
+// Cabeçalho de cada bloco guardado no overlay; os dados vêm logo depois
+struct OverlayRecord {
+    uint32_t magic;
+    uint32_t block;
+};
+
+// Leitura física: com overlay, cada bloco vem da camada se ela tiver uma
+// versão dele, senão da imagem base
+bool Ext2Shell::diskRead(off_t offset, void* buffer, size_t length) {
+    if (overlayFd < 0) {
+        return pread(fd, buffer, length, offset) == (ssize_t)length;
+    }
+
+    char* out = static_cast<char*>(buffer);
+    while (length > 0) {
+        unsigned int block = offset / blockSize;
+        unsigned int inBlock = offset % blockSize;
+        size_t chunk = std::min<size_t>(length, blockSize - inBlock);
+
+        auto found = overlayIndex.find(block);
+        ssize_t got = (found != overlayIndex.end())
+            ? pread(overlayFd, out, chunk, found->second + inBlock)
+            : pread(fd, out, chunk, offset);
+        if (got != (ssize_t)chunk) return false;
+
+        out += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+// Escrita física: com overlay, a imagem base nunca é tocada. Blocos que já
+// estão na camada são regravados no lugar; os novos são copiados da base,
+// recebem a alteração e são acrescentados ao fim do arquivo de uma só vez.
+bool Ext2Shell::diskWrite(off_t offset, const void* buffer, size_t length) {
+    if (overlayFd < 0) {
+        return pwrite(fd, buffer, length, offset) == (ssize_t)length;
+    }
+
+    const char* in = static_cast<const char*>(buffer);
+    std::vector<char> appended;
+    std::vector<unsigned int> added;
+    const size_t recordSize = sizeof(OverlayRecord) + blockSize;
+    bool ok = true;
+    while (length > 0 && ok) {
+        unsigned int block = offset / blockSize;
+        unsigned int inBlock = offset % blockSize;
+        size_t chunk = std::min<size_t>(length, blockSize - inBlock);
+
+        auto found = overlayIndex.find(block);
+        if (found != overlayIndex.end()) {
+            ok = pwrite(overlayFd, in, chunk, found->second + inBlock) == (ssize_t)chunk;
+        } else {
+            size_t pos = appended.size();
+            appended.resize(pos + recordSize);
+            OverlayRecord record = { OVERLAY_RECORD_MAGIC, block };
+            memcpy(&appended[pos], &record, sizeof(record));
+            char* data = &appended[pos + sizeof(record)];
+            if (chunk < blockSize) {
+                ok = pread(fd, data, blockSize, block_offset(block, blockSize)) == (ssize_t)blockSize;
+            }
+            memcpy(data + inBlock, in, chunk);
+            overlayIndex[block] = overlayEnd + pos + sizeof(record);
+            added.push_back(block);
+        }
+
+        in += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+
+    if (ok && !appended.empty()) {
+        ok = pwrite(overlayFd, appended.data(), appended.size(), overlayEnd) == (ssize_t)appended.size();
+    }
+    if (!ok) {
+        for (unsigned int block : added) overlayIndex.erase(block);
+        return false;
+    }
+    overlayEnd += appended.size();
+    return true;
+}
+
+// Garante que as escritas físicas feitas até aqui são duráveis
+bool Ext2Shell::diskSync() {
+    return fdatasync(overlayFd >= 0 ? overlayFd : fd) == 0;
+}
+
+// Lê um trecho qualquer da imagem. Com o diário ativo, blocos alterados que
+// ainda não chegaram ao lugar definitivo são lidos da memória.
+bool Ext2Shell::readImage(off_t offset, void* buffer, size_t length) {
+    if (journalFd < 0) {
+        return diskRead(offset, buffer, length);
+    }
+
+    char* out = static_cast<char*>(buffer);
+    while (length > 0) {
+        unsigned int block = offset / blockSize;
+        unsigned int inBlock = offset % blockSize;
+        size_t chunk = std::min<size_t>(length, blockSize - inBlock);
+
+        auto inTxn = txnBlocks.find(block);
+        auto inCommitted = committedBlocks.find(block);
+        if (inTxn != txnBlocks.end()) {
+            memcpy(out, inTxn->second.data() + inBlock, chunk);
+        } else if (inCommitted != committedBlocks.end()) {
+            memcpy(out, inCommitted->second.data() + inBlock, chunk);
+        } else if (!diskRead(offset, out, chunk)) {
+            return false;
+        }
+
+        out += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+// Escreve um trecho qualquer da imagem. Com o diário ativo, a escrita vai
+// para a imagem completa do bloco na transação aberta.
+bool Ext2Shell::writeImage(off_t offset, const void* buffer, size_t length) {
+    if (journalFd < 0) {
+        return diskWrite(offset, buffer, length);
+    }
+
+    const char* in = static_cast<const char*>(buffer);
+    while (length > 0) {
+        unsigned int block = offset / blockSize;
+        unsigned int inBlock = offset % blockSize;
+        size_t chunk = std::min<size_t>(length, blockSize - inBlock);
+
+        std::vector<char>& image = journalTxnBlock(block);
+        memcpy(image.data() + inBlock, in, chunk);
+
+        in += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return true;
 }
 
 // Lê blocos inteiros do disco
 void Ext2Shell::readBlock(unsigned int block, void* buffer) {
-    lseek(fd, block_offset(block, blockSize), SEEK_SET);
-    read(fd, buffer, blockSize);
+    if (!readImage(block_offset(block, blockSize), buffer, blockSize)) {
+        throw std::runtime_error("Error: Could not read block " + std::to_string(block) + ".");
+    }
 }
 
 // Escreve blocos inteiros no disco
 void Ext2Shell::writeBlock(unsigned int block, const void* buffer) {
-    lseek(fd, block_offset(block, blockSize), SEEK_SET);
-    write(fd, buffer, blockSize);
+    if (!writeImage(block_offset(block, blockSize), buffer, blockSize)) {
+        throw std::runtime_error("Error: Could not write block " + std::to_string(block) + ".");
+    }
+}
+
+// Diz se o grupo guarda uma cópia do superbloco e da tabela de descritores:
+// todos os grupos, ou com sparse_super só o 0, o 1 e as potências de 3, 5 e 7
+static bool groupHasSuper(unsigned int group, uint32_t roCompat) {
+    if (!(roCompat & EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER) || group <= 1) return true;
+    for (unsigned int base : {3u, 5u, 7u}) {
+        unsigned long long power = base;
+        while (power < group) power *= base;
+        if (power == group) return true;
+    }
+    return false;
+}
+
+// Checksum de um descritor de grupo (uninit_bg): CRC16 do UUID do volume, do
+// número do grupo e do descritor até o campo bg_checksum
+static uint16_t groupDescChecksum(const uint8_t* uuid, uint32_t group, const ext2_group_desc& desc) {
+    auto crc16 = [](uint16_t crc, const void* data, size_t length) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        while (length--) {
+            crc ^= *p++;
+            for (int k = 0; k < 8; k++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+        return crc;
+    };
+    uint16_t crc = crc16(0xFFFF, uuid, 16);
+    crc = crc16(crc, &group, sizeof(group));
+    return crc16(crc, &desc, offsetof(ext2_group_desc, bg_checksum));
+}
+
+// Lê vários blocos de uma vez, na ordem pedida, para 'buffer' (um bloco após
+// o outro). Blocos do diário em memória são copiados direto; os demais viram
+// pedidos de leitura na imagem ou no overlay. Com io_uring, até
+// IO_QUEUE_DEPTH pedidos ficam em voo ao mesmo tempo; quando a leitura vai
+// por pread (sem io_uring, fila indisponível ou ocupada por outra thread),
+// pedidos vizinhos no disco e no buffer são juntados em um único pread.
+void Ext2Shell::readBlocks(const std::vector<unsigned int>& blocks, char* buffer) {
+#ifdef HAVE_LIBURING
+    // Se outra thread está usando a fila, esta lê com pread
+    std::unique_lock<std::mutex> ringLock(ringMutex, std::try_to_lock);
+    const bool useRing = ringLock.owns_lock() && ringReady;
+#else
+    const bool useRing = false;
+#endif
+
+    struct ReadRequest {
+        int fd;
+        off_t offset;
+        char* dest;
+        size_t length;
+    };
+    std::vector<ReadRequest> requests;
+    requests.reserve(blocks.size());
+
+    for (size_t i = 0; i < blocks.size(); i++) {
+        char* dest = buffer + i * blockSize;
+        if (journalFd >= 0) {
+            auto inTxn = txnBlocks.find(blocks[i]);
+            auto inCommitted = committedBlocks.find(blocks[i]);
+            if (inTxn != txnBlocks.end()) {
+                memcpy(dest, inTxn->second.data(), blockSize);
+                continue;
+            }
+            if (inCommitted != committedBlocks.end()) {
+                memcpy(dest, inCommitted->second.data(), blockSize);
+                continue;
+            }
+        }
+
+        ReadRequest request = { fd, block_offset(blocks[i], blockSize), dest, blockSize };
+        if (overlayFd >= 0) {
+            auto found = overlayIndex.find(blocks[i]);
+            if (found != overlayIndex.end()) {
+                request.fd = overlayFd;
+                request.offset = found->second;
+            }
+        }
+
+        if (!useRing && !requests.empty()) {
+            ReadRequest& last = requests.back();
+            if (last.fd == request.fd && last.offset + (off_t)last.length == request.offset &&
+                last.dest + last.length == dest) {
+                last.length += blockSize; // Continua a leitura anterior
+                continue;
+            }
+        }
+        requests.push_back(request);
+    }
+
+    auto readFailed = [&](const ReadRequest& request) {
+        size_t index = (request.dest - buffer) / blockSize;
+        return std::runtime_error("Error: Could not read block " + std::to_string(blocks[index]) + ".");
+    };
+
+#ifdef HAVE_LIBURING
+    if (useRing) {
+        // Um erro não pode sair daqui com leituras em voo: elas escrevem no
+        // buffer de quem chamou, e as conclusões ficariam na fila para a
+        // próxima chamada. O primeiro erro é guardado e lançado só depois que
+        // todas as leituras enviadas terminarem.
+        std::string error;
+        bool abandonRing = false;
+        size_t next = 0;
+        unsigned int inFlight = 0, queued = 0; // Enviadas ao kernel / só preparadas
+        while (true) {
+            while (error.empty() && next < requests.size() && inFlight + queued < IO_QUEUE_DEPTH) {
+                io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+                if (!sqe) break;
+                const ReadRequest& request = requests[next];
+                io_uring_prep_read(sqe, request.fd, request.dest, request.length, request.offset);
+                io_uring_sqe_set_data(sqe, (void*)(uintptr_t)next);
+                next++;
+                queued++;
+            }
+            if (queued > 0 && error.empty()) {
+                int submitted = io_uring_submit(&ring);
+                if (submitted < 0) {
+                    // As entradas preparadas continuam na fila: ela não pode
+                    // mais ser usada, senão iriam ao kernel na próxima chamada
+                    error = "Error: io_uring submission failed.";
+                    abandonRing = true;
+                } else {
+                    inFlight += submitted;
+                    queued -= submitted;
+                }
+            }
+            if (inFlight == 0) break; // Tudo lido, ou erro sem nada em voo
+
+            // Consome as conclusões disponíveis (espera pelo menos uma)
+            io_uring_cqe* cqe;
+            int waited = io_uring_wait_cqe(&ring, &cqe);
+            if (waited == -EINTR) continue;
+            if (waited < 0) {
+                // Sem como esperar as leituras em voo: fechar a fila faz o
+                // kernel cancelá-las
+                if (error.empty()) error = "Error: io_uring completion failed.";
+                abandonRing = true;
+                break;
+            }
+            do {
+                const ReadRequest& request = requests[(uintptr_t)io_uring_cqe_get_data(cqe)];
+                int result = cqe->res;
+                io_uring_cqe_seen(&ring, cqe);
+                inFlight--;
+                // Leitura curta ou erro: repete de forma síncrona
+                if (result != (int)request.length && error.empty() &&
+                    pread(request.fd, request.dest, request.length, request.offset) != (ssize_t)request.length) {
+                    error = readFailed(request).what();
+                }
+            } while (io_uring_peek_cqe(&ring, &cqe) == 0);
+        }
+
+        if (abandonRing) {
+            // As próximas leituras usam pread
+            io_uring_queue_exit(&ring);
+            ringReady = false;
+        }
+        if (!error.empty()) throw std::runtime_error(error);
+        return;
+    }
+#endif
+
+    for (const ReadRequest& request : requests) {
+        if (pread(request.fd, request.dest, request.length, request.offset) != (ssize_t)request.length) {
+            throw readFailed(request);
+        }
+    }
+}
+
+// Avisa o kernel (posix_fadvise WILLNEED) de que os blocos [first, first+count)
+// serão lidos em breve; ele começa a trazê-los para o cache sem bloquear.
+// Blocos que estão no overlay são avisados no arquivo de overlay.
+void Ext2Shell::prefetchBlocks(unsigned int first, unsigned int count) {
+    posix_fadvise(fd, block_offset(first, blockSize), (off_t)count * blockSize, POSIX_FADV_WILLNEED);
+    if (overlayFd < 0 || overlayIndex.empty()) return;
+    for (unsigned int block = first; block < first + count; block++) {
+        auto found = overlayIndex.find(block);
+        if (found != overlayIndex.end()) {
+            posix_fadvise(overlayFd, found->second, blockSize, POSIX_FADV_WILLNEED);
+        }
+    }
+}
+
+// Deslocamento de um descritor de grupo: a tabela começa no bloco seguinte
+// ao do superbloco (bloco 2 com blocos de 1 KiB, bloco 1 nos demais)
+off_t Ext2Shell::groupDescOffset(unsigned int groupNum) {
+    return block_offset(super.s_first_data_block + 1, blockSize) + (off_t)groupNum * sizeof(ext2_group_desc);
 }
 
 // Lê descritores de grupo
 void Ext2Shell::readGroupDesc(unsigned int groupNum, ext2_group_desc* group) {
-    lseek(fd, BASE_OFFSET + blockSize + groupNum * sizeof(ext2_group_desc), SEEK_SET);
-    read(fd, group, sizeof(ext2_group_desc));
+    if (deferAllocation) {
+        *group = deferredGroups[groupNum];
+        return;
+    }
+    if (!readImage(groupDescOffset(groupNum), group, sizeof(ext2_group_desc))) {
+        throw std::runtime_error("Error: Could not read group descriptor " + std::to_string(groupNum) + ".");
+    }
 }
 
 // Escreve descritores de grupo
 void Ext2Shell::writeGroupDesc(unsigned int groupNum, const ext2_group_desc* group) {
-    lseek(fd, BASE_OFFSET + blockSize + groupNum * sizeof(ext2_group_desc), SEEK_SET);
-    write(fd, group, sizeof(struct ext2_group_desc));
+    if (deferAllocation) {
+        deferredGroups[groupNum] = *group;
+        deferredGroupsDirty[groupNum] = true;
+        return;
+    }
+    ext2_group_desc desc = *group;
+    if (uninitGroupsEnabled()) {
+        desc.bg_checksum = groupDescChecksum(super.s_uuid, groupNum, desc);
+    }
+    if (!writeImage(groupDescOffset(groupNum), &desc, sizeof(ext2_group_desc))) {
+        throw std::runtime_error("Error: Could not write group descriptor " + std::to_string(groupNum) + ".");
+    }
 }
 
-// Lê um inode específico do disco
-void Ext2Shell::readInode(unsigned int inodeNum, ext2_inode* inode) {
+// Deslocamento de um inode na sua tabela. O passo entre inodes é o tamanho
+// gravado no superbloco (128 ou 256 bytes), não o da nossa struct.
+off_t Ext2Shell::inodeOffset(unsigned int inodeNum) {
     unsigned int group = (inodeNum - 1) / super.s_inodes_per_group;
     ext2_group_desc groupDesc;
     readGroupDesc(group, &groupDesc);
 
     unsigned int index = (inodeNum - 1) % super.s_inodes_per_group;
-    unsigned int offset = groupDesc.bg_inode_table * blockSize + index * sizeof(ext2_inode);
-    lseek(fd, BASE_OFFSET - 1024 + offset, SEEK_SET);
-    read(fd, inode, sizeof(ext2_inode));
+    return block_offset(groupDesc.bg_inode_table, blockSize) + (off_t)index * inodeSize;
+}
+
+// Lê um inode específico do disco
+void Ext2Shell::readInode(unsigned int inodeNum, ext2_inode* inode) {
+    if (!readImage(inodeOffset(inodeNum), inode, sizeof(ext2_inode))) {
+        throw std::runtime_error("Error: Could not read inode " + std::to_string(inodeNum) + ".");
+    }
 }
 
-// Escreve um inode específico no disco
+// Escreve um inode específico no disco (só os 128 bytes da struct; a parte
+// estendida de inodes maiores é preservada)
 void Ext2Shell::writeInode(unsigned int inodeNum, const ext2_inode* inode) {
-    unsigned int group = (inodeNum - 1) / super.s_inodes_per_group;
-    ext2_group_desc groupDesc;
-    readGroupDesc(group, &groupDesc);
+    if (!writeImage(inodeOffset(inodeNum), inode, sizeof(ext2_inode))) {
+        throw std::runtime_error("Error: Could not write inode " + std::to_string(inodeNum) + ".");
+    }
+}
 
-    unsigned int index = (inodeNum - 1) % super.s_inodes_per_group;
-    unsigned int offset = groupDesc.bg_inode_table * blockSize + index * sizeof(ext2_inode);
-    lseek(fd, BASE_OFFSET - 1024 + offset, SEEK_SET);
-    write(fd, inode, sizeof(ext2_inode));
+// Tamanho de um arquivo em 64 bits: em arquivos regulares a parte alta fica
+// em i_dir_acl (i_size_high), usada quando o FS tem o recurso large_file
+unsigned long long Ext2Shell::inodeFileSize(const ext2_inode& inode) {
+    unsigned long long size = inode.i_size;
+    if (S_ISREG(inode.i_mode)) {
+        size |= (unsigned long long)inode.i_dir_acl << 32;
+    }
+    return size;
+}
+
+// Grava o tamanho de um arquivo em 64 bits; tamanhos a partir de 2 GiB
+// exigem o recurso large_file no superbloco
+void Ext2Shell::setInodeFileSize(ext2_inode& inode, unsigned long long size) {
+    inode.i_size = (uint32_t)size;
+    if (S_ISREG(inode.i_mode)) {
+        inode.i_dir_acl = (uint32_t)(size >> 32);
+        if (size > 0x7fffffffULL && !(super.s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_LARGE_FILE)) {
+            super.s_feature_ro_compat |= EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+            writeSuperBlock();
+        }
+    }
+}
+
+// Quantidade de grupos de blocos do FS
+unsigned int Ext2Shell::groupCount() {
+    return (super.s_blocks_count - super.s_first_data_block + super.s_blocks_per_group - 1) / super.s_blocks_per_group;
+}
+
+// Escreve o superbloco (cópia em memória) de volta no disco
+void Ext2Shell::writeSuperBlock() {
+    if (deferAllocation) {
+        deferredSuperDirty = true;
+        return;
+    }
+    if (!writeImage(BASE_OFFSET, &super, sizeof(super))) {
+        throw std::runtime_error("Error: Could not write the superblock.");
+    }
 }
 
 
@@ -110,10 +680,13 @@ void Ext2Shell::writeInode(unsigned int inodeNum, const ext2_inode* inode) {
 
 // Executa o loop principal do shell
 void Ext2Shell::run() {
+    // Com a entrada vinda de um pipe não há banner nem prompt, então a saída
+    // padrão fica só com a saída dos comandos (ex.: export-tar ... - | gzip)
+    const bool interactive = isatty(STDIN_FILENO);
     std::string line;
-    std::cout << "nEXT2 Shell initialized. Type 'exit' to quit." << std::endl;
+    if (interactive) std::cout << "nEXT2 Shell initialized. Type 'exit' to quit." << std::endl;
     while (true) {
-        std::cout << getPrompt();
+        if (interactive) std::cout << getPrompt();
         if (!std::getline(std::cin, line) || line == "exit") {
             break;
         }
@@ -121,7 +694,278 @@ void Ext2Shell::run() {
             processCommand(line);
         }
     }
-    std::cout << "Exiting shell." << std::endl;
+    if (interactive) std::cout << "Exiting shell." << std::endl;
+}
+
+// --- Modo Servidor ---
+
+// Pedido de parada do servidor (SIGINT/SIGTERM)
+static volatile sig_atomic_t serverStopRequested = 0;
+
+static void requestServerStop(int) {
+    serverStopRequested = 1;
+}
+
+// Cada resposta vai para o cliente como [tamanho u32][saída do comando], na
+// mesma ordem dos comandos recebidos. Uma saída que não cabe no campo de
+// tamanho vira uma mensagem de erro, para não quebrar o enquadramento.
+static std::string frameResponse(const std::string& output) {
+    if (output.size() > UINT32_MAX) {
+        return frameResponse("Error: Response too large (" + std::to_string(output.size()) + " bytes).\n");
+    }
+    uint32_t length = output.size();
+    std::string frame(reinterpret_cast<const char*>(&length), sizeof(length));
+    return frame + output;
+}
+
+// Executa um comando no diretório corrente do cliente, capturando tudo o que
+// ele escreveria em cout/cerr
+std::string Ext2Shell::executeInSession(Session& session, const std::string& line) {
+    std::lock_guard<std::mutex> lock(fsMutex);
+
+    // Desvia cout/cerr para a resposta enquanto o comando executa
+    struct Redirect {
+        std::ostream& stream;
+        std::streambuf* old;
+        Redirect(std::ostream& stream, std::streambuf* target) : stream(stream), old(stream.rdbuf(target)) {}
+        ~Redirect() { stream.rdbuf(old); }
+    };
+    std::ostringstream output;
+    Redirect outRedirect(std::cout, output.rdbuf());
+    Redirect errRedirect(std::cerr, output.rdbuf());
+    try {
+        currentPath = session.path;
+        updateCurrentDirectory(session.inodeNum);
+    } catch (const std::exception&) {
+        // O diretório do cliente sumiu ou ficou ilegível: volta para a raiz
+        currentPath.clear();
+        updateCurrentDirectory(EXT2_ROOT_INO);
+    }
+    dispatchCommand(line);
+    session.inodeNum = currentInodeNum;
+    session.path = currentPath;
+    return output.str();
+}
+
+// Laço do servidor: um único processo com a imagem aberta atende vários
+// clientes. Cada cliente pode enviar vários comandos de uma vez (um por
+// linha) sem esperar as respostas; eles são executados em ordem e as
+// respostas voltam na mesma ordem. 'exit' encerra a conexão do cliente e
+// 'shutdown' encerra o servidor.
+void Ext2Shell::serve(const std::string& socketPath) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Error: Socket path too long.");
+    }
+    memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    serving = true;
+
+    // Um socket deixado por um servidor anterior é substituído
+    struct stat st;
+    if (stat(socketPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socketPath.c_str());
+    }
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listenFd, 16) != 0) {
+        if (listenFd >= 0) close(listenFd);
+        throw std::runtime_error("Error: Could not listen on socket '" + socketPath + "'.");
+    }
+    fcntl(listenFd, F_SETFL, O_NONBLOCK);
+
+    struct sigaction action = {};
+    action.sa_handler = requestServerStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct Client {
+        int fd;
+        std::string input;   // Bytes recebidos ainda sem '\n'
+        std::string output;  // Respostas ainda não enviadas
+        Session session;
+        bool closing;        // Não lê mais; fecha quando 'output' esvaziar
+    };
+    std::vector<Client> clients;
+
+    std::cout << "Serving '" << imagePath << "' on '" << socketPath << "'." << std::endl;
+    bool stop = false;
+    while (!stop && !serverStopRequested) {
+        std::vector<pollfd> fds(1 + clients.size());
+        fds[0] = { listenFd, POLLIN, 0 };
+        for (size_t i = 0; i < clients.size(); i++) {
+            short events = clients[i].closing ? 0 : POLLIN;
+            if (!clients[i].output.empty()) events |= POLLOUT;
+            fds[i + 1] = { clients[i].fd, events, 0 };
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (size_t i = 0; i < clients.size(); i++) {
+            Client& client = clients[i];
+            short revents = fds[i + 1].revents;
+
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                char buffer[65536];
+                ssize_t got = read(client.fd, buffer, sizeof(buffer));
+                bool eof = false;
+                if (got > 0) {
+                    client.input.append(buffer, got);
+                } else if (got == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    eof = true; // Cliente terminou de enviar (ou caiu)
+                }
+
+                auto runLine = [&](std::string line) {
+                    if (!line.empty() && line.back() == '\r') line.pop_back();
+                    if (line == "exit") {
+                        client.closing = true;
+                    } else if (line == "shutdown") {
+                        client.output += frameResponse("Server shutting down.\n");
+                        client.closing = true;
+                        stop = true;
+                    } else {
+                        client.output += frameResponse(executeInSession(client.session, line));
+                    }
+                };
+
+                // Executa todas as linhas completas recebidas
+                size_t start = 0, end;
+                while (!client.closing && (end = client.input.find('\n', start)) != std::string::npos) {
+                    std::string line = client.input.substr(start, end - start);
+                    start = end + 1;
+                    runLine(line);
+                }
+                client.input.erase(0, start);
+
+                // No fim da entrada, a última linha pode chegar sem '\n'
+                if (eof) {
+                    if (got == 0 && !client.closing && !client.input.empty()) runLine(client.input);
+                    client.input.clear();
+                    client.closing = true;
+                }
+            }
+
+            if (!client.output.empty()) {
+                ssize_t sent = write(client.fd, client.output.data(), client.output.size());
+                if (sent > 0) {
+                    client.output.erase(0, sent);
+                } else if (sent < 0 && errno != EAGAIN && errno != EINTR) {
+                    client.output.clear(); // Cliente desconectou
+                    client.closing = true;
+                }
+            }
+        }
+
+        // Fecha quem terminou e já recebeu todas as respostas
+        for (size_t i = clients.size(); i-- > 0;) {
+            if (clients[i].closing && clients[i].output.empty()) {
+                close(clients[i].fd);
+                clients.erase(clients.begin() + i);
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int clientFd;
+            while ((clientFd = accept(listenFd, nullptr, nullptr)) >= 0) {
+                fcntl(clientFd, F_SETFL, O_NONBLOCK);
+                clients.push_back({ clientFd, "", "", { EXT2_ROOT_INO, {} }, false });
+            }
+        }
+    }
+
+    // Entrega, de forma bloqueante, o que ficou pendente (ex.: a resposta do 'shutdown')
+    for (Client& client : clients) {
+        fcntl(client.fd, F_SETFL, 0);
+        if (!client.output.empty() && write(client.fd, client.output.data(), client.output.size()) < 0) {
+            // Cliente já desconectou; nada a fazer
+        }
+        close(client.fd);
+    }
+    close(listenFd);
+    unlink(socketPath.c_str());
+    std::cout << "Server stopped." << std::endl;
+}
+
+// Cliente: os comandos são enviados sem esperar as respostas (pipelining) e
+// cada resposta é impressa assim que chega
+int Ext2Shell::runClient(const std::string& socketPath, const std::vector<std::string>& commands) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Error: Socket path too long." << std::endl;
+        return 1;
+    }
+    memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "Error: Could not connect to '" << socketPath << "'." << std::endl;
+        if (sock >= 0) close(sock);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // Com comandos na linha de comando, todos vão de uma vez; senão, a
+    // entrada padrão é repassada conforme chega
+    bool sending = true;
+    if (!commands.empty()) {
+        std::string batch;
+        for (const auto& command : commands) batch += command + "\n";
+        for (size_t sent = 0; sent < batch.size();) {
+            ssize_t n = write(sock, batch.data() + sent, batch.size() - sent);
+            if (n <= 0) break;
+            sent += n;
+        }
+        shutdown(sock, SHUT_WR);
+        sending = false;
+    }
+
+    std::string pending;
+    while (true) {
+        pollfd fds[2] = { { sock, POLLIN, 0 }, { STDIN_FILENO, (short)(sending ? POLLIN : 0), 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (fds[1].revents & (POLLIN | POLLHUP)) {
+            char buffer[65536];
+            ssize_t got = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (got <= 0) {
+                shutdown(sock, SHUT_WR); // Fim da entrada: o servidor responde o que falta e fecha
+                sending = false;
+            } else {
+                for (ssize_t sent = 0; sent < got;) {
+                    ssize_t n = write(sock, buffer + sent, got - sent);
+                    if (n <= 0) { sending = false; break; }
+                    sent += n;
+                }
+            }
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            char buffer[65536];
+            ssize_t got = read(sock, buffer, sizeof(buffer));
+            if (got <= 0) break;
+            pending.append(buffer, got);
+
+            // Imprime cada resposta completa
+            while (pending.size() >= sizeof(uint32_t)) {
+                uint32_t length;
+                memcpy(&length, pending.data(), sizeof(length));
+                if (pending.size() < sizeof(length) + length) break;
+                std::cout.write(pending.data() + sizeof(length), length);
+                pending.erase(0, sizeof(length) + length);
+            }
+            std::cout.flush();
+        }
+    }
+
+    close(sock);
+    return 0;
 }
 
 // Gera o prompt baseado no caminho atual
@@ -176,6 +1020,13 @@ std::vector<std::string> Ext2Shell::tokenize(const std::string& input) {
 
 // Processa um comando lido do usuário
 void Ext2Shell::processCommand(const std::string& line) {
+    // Impede que a thread de liberação adiada mexa nos metadados durante o comando
+    std::lock_guard<std::mutex> lock(fsMutex);
+    dispatchCommand(line);
+}
+
+// Executa um comando. Deve ser chamada com fsMutex adquirida.
+void Ext2Shell::dispatchCommand(const std::string& line) {
     std::vector<std::string> tokens = tokenize(line);
     if (tokens.empty()) return;
 
@@ -195,10 +1046,30 @@ void Ext2Shell::processCommand(const std::string& line) {
         else if (command == "rmdir" && args.size() == 1) cmd_rmdir(args[0]);
         else if (command == "cp" && args.size() == 2) cmd_cp(args[0], args[1]);
         else if (command == "rename" && args.size() == 2) cmd_rename(args[0], args[1]);
+        else if (command == "mv" && args.size() == 2) cmd_mv(args[0], args[1]);
+        else if (command == "ln" && (args.size() == 2 || (args.size() == 3 && args[0] == "-s"))) cmd_ln(args);
+        else if (command == "write" && args.size() == 3) cmd_write(args);
+        else if (command == "append" && args.size() == 2) cmd_append(args[0], args[1]);
+        else if (command == "truncate" && args.size() == 2) cmd_truncate(args[0], args[1]);
+        else if (command == "fallocate" && args.size() == 2) cmd_fallocate(args[0], args[1]);
+        else if (command == "compact" && args.size() <= 2) cmd_compact(args);
+        else if (command == "frag" && args.size() <= 1) cmd_frag(args.empty() ? "" : args[0]);
+        else if (command == "defrag" && args.size() == 1) cmd_defrag(args[0]);
+        else if (command == "sum" && !args.empty()) cmd_sum(args);
+        else if (command == "grep" && args.size() >= 2) cmd_grep(args);
+        else if (command == "dedupscan" && args.size() <= 1) cmd_dedupscan(args);
+        else if (command == "export-tar" && args.size() == 2) cmd_export_tar(args[0], args[1]);
+        else if (command == "import-tar" && args.size() == 1) cmd_import_tar(args[0]);
+        else if (command == "sync" && args.empty()) cmd_sync();
+        else if (command == "commit" && args.empty()) cmd_commit();
         else if (command.empty()) { /* Faz nada */ }
         else std::cerr << "Error: Unknown command or incorrect arguments." << std::endl;
+
+        // Tudo que o comando alterou vira uma única transação do diário
+        journalCommit();
     } catch (const std::exception& e) {
         std::cerr << "Caught exception: " << e.what() << std::endl;
+        journalAbort();
     }
 }
 
@@ -206,43 +1077,148 @@ void Ext2Shell::processCommand(const std::string& line) {
 
 // Exibe informações do sistema de arquivos
 void Ext2Shell::cmd_info() {
-    std::cout << "Volume name.....: " << super.s_volume_name << std::endl;
-    std::cout << "Image size......: " << super.s_blocks_count * blockSize << " KiB" << std::endl;
-    std::cout << "Free space......: " << super.s_free_blocks_count * blockSize << " KiB" << std::endl;
+    std::cout << "Volume name.....: " << std::string(super.s_volume_name, strnlen(super.s_volume_name, sizeof(super.s_volume_name))) << std::endl;
+    std::cout << "Image size......: " << (unsigned long long)super.s_blocks_count * blockSize / 1024 << " KiB" << std::endl;
+    std::cout << "Free space......: " << (unsigned long long)super.s_free_blocks_count * blockSize / 1024 << " KiB" << std::endl;
     std::cout << "Free inodes.....: " << super.s_free_inodes_count << std::endl;
     std::cout << "Block size......: " << blockSize << " bytes" << std::endl;
-    std::cout << "Groups count....: " << (super.s_blocks_count / super.s_blocks_per_group) << std::endl;
+    std::cout << "Groups count....: " << groupCount() << std::endl;
+    if (overlayFd >= 0) {
+        std::cout << "Overlay.........: " << overlayIndex.size() << " modified blocks in '" << overlayPath << "'" << std::endl;
+    }
+#ifdef HAVE_LIBURING
+    std::cout << "I/O backend.....: " << (ringReady ? "io_uring" : "pread") << std::endl;
+#else
+    std::cout << "I/O backend.....: pread" << std::endl;
+#endif
+}
+
+// --- Iteração especializada por tamanho de bloco ---
+//
+// As rotinas abaixo recebem o tamanho do bloco como parâmetro de template:
+// com 1, 2 ou 4 KiB fixos em tempo de compilação, o compilador conhece os
+// limites dos laços e pode desenrolá-los e vetorizá-los. BlockSize = 0 é a
+// versão genérica, para outros tamanhos, que usa o valor em tempo de execução.
+namespace {
+
+// Chama 'body' com a constante do tamanho de bloco correspondente
+template <typename Body>
+inline auto dispatchBlockSize(unsigned int blockSize, Body&& body) {
+    switch (blockSize) {
+    case 1024: return body(std::integral_constant<unsigned int, 1024>());
+    case 2048: return body(std::integral_constant<unsigned int, 2048>());
+    case 4096: return body(std::integral_constant<unsigned int, 4096>());
+    default:   return body(std::integral_constant<unsigned int, 0>());
+    }
+}
+
+// Percorre as entradas ocupadas de um bloco de diretório. Retorna false se
+// o callback pediu para parar.
+template <unsigned int BlockSize, typename Callback>
+inline bool scanDirBlock(const char* block, unsigned int runtimeSize, Callback& callback) {
+    const unsigned int size = BlockSize ? BlockSize : runtimeSize;
+    unsigned int offset = 0;
+    while (offset < size) {
+        const ext2_dir_entry_2* entry = reinterpret_cast<const ext2_dir_entry_2*>(block + offset);
+        if (entry->rec_len == 0) break; // Bloco corrompido, evita laço infinito
+
+        // Entradas com inode 0 são espaço livre (ex: primeira entrada removida)
+        if (entry->inode != 0 && !callback(entry)) {
+            return false; // O callback pediu para parar a iteração
+        }
+
+        offset += entry->rec_len;
+    }
+    return true;
+}
+
+// Primeiro bit zero entre os 'bits' primeiros de um bitmap (ou -1). Testa
+// 64 bits por vez; só a palavra com o bit livre é olhada bit a bit.
+template <unsigned int BlockSize>
+inline int findFirstZeroBit(const unsigned char* bitmap, unsigned int runtimeSize, unsigned int bits) {
+    const unsigned int words = (BlockSize ? BlockSize : runtimeSize) / sizeof(uint64_t);
+    for (unsigned int w = 0; w < words && w * 64 < bits; w++) {
+        uint64_t word;
+        memcpy(&word, bitmap + w * sizeof(uint64_t), sizeof(word));
+        if (word == ~0ULL) continue;
+        unsigned int bit = w * 64 + __builtin_ctzll(~word);
+        return bit < bits ? (int)bit : -1;
+    }
+    return -1;
+}
+
+// Tipo gravado na entrada de diretório para um inode com este i_mode
+inline unsigned char direntFileType(unsigned int mode) {
+    switch (mode & S_IFMT) {
+    case S_IFREG:  return EXT2_FT_REG_FILE;
+    case S_IFDIR:  return EXT2_FT_DIR;
+    case S_IFCHR:  return EXT2_FT_CHRDEV;
+    case S_IFBLK:  return EXT2_FT_BLKDEV;
+    case S_IFIFO:  return EXT2_FT_FIFO;
+    case S_IFSOCK: return EXT2_FT_SOCK;
+    case S_IFLNK:  return EXT2_FT_SYMLINK;
+    default:       return EXT2_FT_UNKNOWN;
+    }
+}
+
+// Primeiro bit de um bitmap, em [bit, end), com o valor 'value'; 'end' se não
+// houver. Anda 64 bits por vez: a palavra é invertida quando se procura um
+// bit livre e a contagem de zeros à direita dá a posição, então trechos
+// longos (livres ou ocupados) custam uma iteração a cada 64 blocos.
+inline unsigned int findBitmapBit(const unsigned char* bitmap, unsigned int bit, unsigned int end, bool value) {
+    const unsigned int endByte = (end + 7) / 8;
+    while (bit < end) {
+        unsigned int base = bit & ~63u;
+        uint64_t word = 0;
+        memcpy(&word, bitmap + base / 8, std::min(8u, endByte - base / 8));
+        if (!value) word = ~word;
+        word &= ~0ULL << (bit - base); // Ignora os bits antes de 'bit'
+        if (word != 0) return std::min(end, base + (unsigned int)__builtin_ctzll(word));
+        bit = base + 64;
+    }
+    return end;
 }
 
-// Percorre as entradas de um diretório e chama um callback para cada uma
-void Ext2Shell::forEachDirEntry(unsigned int dirInodeNum, std::function<bool(ext2_dir_entry_2*)> callback) {
+} // namespace
+
+// Percorre as entradas de um diretório e chama um callback para cada uma,
+// com um ponteiro direto para o bloco lido (sem cópia). A iteração para
+// assim que o callback retorna false.
+template <typename Callback>
+void Ext2Shell::forEachDirEntry(unsigned int dirInodeNum, Callback&& callback) {
     ext2_inode dirInode;
     readInode(dirInodeNum, &dirInode);
     if (!S_ISDIR(dirInode.i_mode)) return;
 
-    forEachDataBlock(dirInodeNum, [&](const std::vector<char>& block_data) {
-        unsigned int offset = 0;
-        while (offset < blockSize) {
-            ext2_dir_entry_2* entry = (ext2_dir_entry_2*)&block_data[offset];
-            if (entry->inode == 0) break;
-
-            if (!callback(entry)) {
-                // O callback retornou false, para a iteração
-                // (Isso é um truque para poder parar a iteração quando encontramos o que queremos)
-            }
-
-            offset += entry->rec_len;
-        }
+    dispatchBlockSize(blockSize, [&](auto size) {
+        forEachDataBlock(dirInodeNum, [&](const char* block) {
+            return scanDirBlock<decltype(size)::value>(block, blockSize, callback);
+        });
     });
 }
 
 // Retorna o inode de um arquivo/dir pelo nome no diretório atual
 unsigned int Ext2Shell::getInodeByName(const std::string& name) {
-    unsigned int foundInode = 0;
-    forEachDirEntry(currentInodeNum, [&](ext2_dir_entry_2* entry) {
-        std::string entryName(entry->name, entry->name_len);
-        if (entryName == name) {
-            foundInode = entry->inode;
+    return findDirEntry(currentInodeNum, name);
+}
+
+// Procura um nome em um diretório qualquer: pelo índice de hash quando o
+// diretório é indexado, senão varrendo as entradas. Retorna 0 se não achar.
+unsigned int Ext2Shell::findDirEntry(unsigned int dirInodeNum, const std::string& name) {
+    ext2_inode dirInode;
+    readInode(dirInodeNum, &dirInode);
+    if ((dirInode.i_flags & EXT2_INDEX_FL) && dirIndexEnabled()) {
+        bool indexOk = false;
+        unsigned int foundInode = dxLookup(dirInode, name, indexOk);
+        if (indexOk) return foundInode;
+        // Índice inválido: cai na busca linear
+    }
+
+    unsigned int foundInode = 0;
+    forEachDirEntry(dirInodeNum, [&](const ext2_dir_entry_2* entry) {
+        std::string entryName(entry->name, entry->name_len);
+        if (entryName == name) {
+            foundInode = entry->inode;
             return false; // Para a iteração
         }
         return true; // Continua
@@ -250,103 +1226,701 @@ unsigned int Ext2Shell::getInodeByName(const std::string& name) {
     return foundInode;
 }
 
-// Lê todos os blocos de dados de um inode e chama o callback para cada bloco
-void Ext2Shell::forEachDataBlock(unsigned int inodeNum, std::function<void(const std::vector<char>&)> callback) {
+// Diretório pai (entrada '..'). O '..' não está no índice htree: é sempre a
+// segunda entrada do bloco 0. Retorna 0 se não for encontrado.
+unsigned int Ext2Shell::parentDirectory(unsigned int dirInodeNum) {
+    unsigned int parent = 0;
+    forEachDirEntry(dirInodeNum, [&](const ext2_dir_entry_2* entry) {
+        if (entry->name_len == 2 && entry->name[0] == '.' && entry->name[1] == '.') {
+            parent = entry->inode;
+            return false;
+        }
+        return true;
+    });
+    return parent;
+}
+
+// Resolve um caminho (absoluto ou relativo ao diretório atual, com '.' e
+// '..') para o número do inode. Links simbólicos no meio do caminho são
+// seguidos (o último também, com 'followLast' ou com '/' no fim), até
+// SYMLINK_MAX_FOLLOW vezes. Retorna 0 se algum componente não existir.
+unsigned int Ext2Shell::resolvePath(const std::string& path, bool followLast) {
+    // Componentes ainda por resolver, o próximo no fim do vetor
+    std::vector<std::string> pending;
+    auto pushComponents = [&](const std::string& text) {
+        std::vector<std::string> parts;
+        std::stringstream stream(text);
+        std::string part;
+        while (std::getline(stream, part, '/')) {
+            if (!part.empty() && part != ".") parts.push_back(part);
+        }
+        pending.insert(pending.end(), parts.rbegin(), parts.rend());
+    };
+    pushComponents(path);
+    if (!path.empty() && path.back() == '/') followLast = true;
+
+    unsigned int inodeNum = (!path.empty() && path[0] == '/') ? EXT2_ROOT_INO : currentInodeNum;
+    unsigned int parentNum = inodeNum; // Diretório de onde veio inodeNum
+    unsigned int follows = 0;
     ext2_inode inode;
     readInode(inodeNum, &inode);
+    while (true) {
+        if (S_ISLNK(inode.i_mode) && (!pending.empty() || followLast)) {
+            if (++follows > SYMLINK_MAX_FOLLOW) return 0;
+            std::string target = symlinkTarget(inodeNum, inode);
+            if (target.empty()) return 0;
+            // O destino relativo parte do diretório que contém o link
+            inodeNum = target[0] == '/' ? EXT2_ROOT_INO : parentNum;
+            parentNum = inodeNum;
+            pushComponents(target);
+            readInode(inodeNum, &inode);
+            continue;
+        }
+        if (pending.empty()) return inodeNum;
+
+        std::string part = pending.back();
+        pending.pop_back();
+        if (!S_ISDIR(inode.i_mode)) return 0;
+        parentNum = inodeNum;
+        inodeNum = (part == "..") ? parentDirectory(inodeNum) : findDirEntry(inodeNum, part);
+        if (inodeNum == 0) return 0;
+        readInode(inodeNum, &inode);
+    }
+}
+
+// Divide um caminho em diretório pai e último componente (em 'name').
+// Retorna o inode do pai, ou 0 se ele não existir.
+unsigned int Ext2Shell::resolveParent(const std::string& path, std::string& name) {
+    std::string trimmed = path;
+    while (trimmed.size() > 1 && trimmed.back() == '/') trimmed.pop_back();
+    size_t slash = trimmed.rfind('/');
+    name = trimmed.substr(slash == std::string::npos ? 0 : slash + 1);
+    return resolvePath(slash == std::string::npos ? "." : slash == 0 ? "/" : trimmed.substr(0, slash));
+}
+
+// Destino de um link simbólico, pelo cache LRU (inode -> destino). O cache
+// só é invalidado quando o inode é reaproveitado (allocateInode): o destino
+// de um link não muda depois de criado.
+std::string Ext2Shell::symlinkTarget(unsigned int inodeNum, const ext2_inode& inode) {
+    auto cached = symlinkCache.find(inodeNum);
+    if (cached != symlinkCache.end()) {
+        symlinkLru.splice(symlinkLru.begin(), symlinkLru, cached->second);
+        return cached->second->second;
+    }
+
+    std::string target = readSymlinkTarget(inode);
+    symlinkLru.emplace_front(inodeNum, target);
+    symlinkCache[inodeNum] = symlinkLru.begin();
+    if (symlinkLru.size() > SYMLINK_CACHE_MAX) {
+        symlinkCache.erase(symlinkLru.back().first);
+        symlinkLru.pop_back();
+    }
+    return target;
+}
+
+// Remove um inode do cache de links simbólicos
+void Ext2Shell::forgetSymlink(unsigned int inodeNum) {
+    auto cached = symlinkCache.find(inodeNum);
+    if (cached == symlinkCache.end()) return;
+    symlinkLru.erase(cached->second);
+    symlinkCache.erase(cached);
+}
+
+// Desce recursivamente por uma tabela de ponteiros já lida, com 'depth'
+// níveis; 'span' é quantos blocos lógicos cada ponteiro deste nível cobre.
+// As tabelas filhas são lidas todas de uma vez, em um único lote.
+template <typename Callback>
+bool Ext2Shell::walkPointerTable(const unsigned int* pointers, int depth, unsigned int logical,
+                                 unsigned int span, Callback& callback) {
+    const unsigned int perBlock = blockSize / sizeof(unsigned int);
+    if (depth == 1) {
+        for (unsigned int i = 0; i < perBlock; i++) {
+            if (pointers[i] != 0 && !callback(logical + i, pointers[i])) return false;
+        }
+        return true;
+    }
+
+    std::vector<unsigned int> children;
+    std::vector<unsigned int> slots;
+    for (unsigned int i = 0; i < perBlock; i++) {
+        if (pointers[i] == 0) continue;
+        children.push_back(pointers[i]);
+        slots.push_back(i);
+    }
+    std::vector<unsigned int> tables(children.size() * perBlock);
+    readBlocks(children, reinterpret_cast<char*>(tables.data()));
+    for (size_t c = 0; c < children.size(); c++) {
+        if (!walkPointerTable(tables.data() + c * perBlock, depth - 1, logical + slots[c] * span,
+                              span / perBlock, callback)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    // vetor temporário para o bloco lido
-    std::vector<char> buffer(blockSize);
+// Percorre, em ordem lógica, os blocos de dados alocados de um inode
+// (diretos, indireto simples, duplo e triplo), chamando o callback com o
+// índice lógico e o número físico de cada um. Ponteiros nulos são pulados,
+// inclusive subárvores indiretas inteiras. Para quando o callback retorna false.
+template <typename Callback>
+void Ext2Shell::forEachBlockNumber(const ext2_inode& inode, Callback&& callback) {
+    const unsigned int perBlock = blockSize / sizeof(unsigned int);
 
     // Blocos diretos (12 primeiros)
-    for (int i = 0; i < 12; i++) {
+    for (unsigned int i = 0; i < 12; i++) {
         if (inode.i_block[i] == 0) continue;
-        readBlock(inode.i_block[i], buffer.data());
-        callback(buffer);
+        if (!callback(i, inode.i_block[i])) return;
+    }
+
+    BlockBuffer pointerBuffer = blockPool.acquire();
+    unsigned int* pointers = pointerBuffer.as<unsigned int>();
+    unsigned int logical = 12;
+    unsigned int span = 1;
+    for (int depth = 1; depth <= 3; depth++) {
+        if (inode.i_block[11 + depth] != 0) {
+            readBlock(inode.i_block[11 + depth], pointers);
+            if (!walkPointerTable(pointers, depth, logical, span, callback)) return;
+        }
+        span *= perBlock;
+        logical += span;
     }
 }
 
-// Função para adicionar uma entrada de diretório no diretório pai
-int Ext2Shell::addDirectoryEntry(unsigned int parentInodeNum, unsigned int childInodeNum, const std::string& name, unsigned char fileType) {
-    ext2_inode parentInode;
-    // Lê o inode do diretório pai
-    readInode(parentInodeNum, &parentInode);
+// Lê todos os blocos de dados de um inode e chama o callback para cada bloco,
+// com um ponteiro para o bloco dentro do lote lido (válido só durante a
+// chamada). Para quando o callback retorna false.
+template <typename Callback>
+void Ext2Shell::forEachDataBlock(unsigned int inodeNum, Callback&& callback) {
+    ext2_inode inode;
+    readInode(inodeNum, &inode);
 
-    std::vector<char> blockData(blockSize);
+    // Os blocos são lidos em lotes de IO_BATCH_BLOCKS e entregues um a um
+    std::vector<unsigned int> pending;
+    BlockBuffer batchBuffer = blockPool.acquireBatch();
+    char* batch = batchBuffer.data();
+    bool stopped = false;
 
-    // Percorre os 12 blocos diretos do inode pai
-    for (int i = 0; i < 12; i++) {
-        if (parentInode.i_block[i] == 0) continue;  // bloco vazio, pula
+    auto flush = [&]() {
+        readBlocks(pending, batch);
+        for (size_t i = 0; i < pending.size() && !stopped; i++) {
+            stopped = !callback(static_cast<const char*>(batch + i * blockSize));
+        }
+        pending.clear();
+    };
 
-        // Lê o bloco do diretório
-        readBlock(parentInode.i_block[i], blockData.data());
+    forEachBlockNumber(inode, [&](unsigned int, unsigned int blockNum) {
+        pending.push_back(blockNum);
+        if (pending.size() == IO_BATCH_BLOCKS) flush();
+        return !stopped;
+    });
+    if (!stopped && !pending.empty()) flush();
+}
 
-        unsigned int offset = 0;
-        // Varre as entradas do diretório dentro do bloco
-        while (offset < blockSize) {
-            ext2_dir_entry_2* entry = (ext2_dir_entry_2*)&blockData[offset];
+// Percorre o conteúdo de um arquivo até i_size, em ordem lógica. Trechos com
+// dados chegam um bloco por vez (data aponta para o bloco lido); buracos de
+// arquivos esparsos chegam inteiros, com data nulo. Subárvores indiretas
+// vazias são puladas sem leitura, então o custo é proporcional aos dados.
+//
+// A árvore de ponteiros é resolvida inteira antes dos dados, em sequências
+// contíguas (lógico, físico, tamanho). Com o mapa pronto, a leitura
+// antecipada pede ao kernel os blocos à frente da posição atual: quando a
+// leitura chega à metade da janela já pedida, a próxima janela é pedida e
+// o tamanho dobra (até READAHEAD_MAX_BLOCKS), como a leitura sequencial
+// nunca volta atrás. Assim o disco trabalha enquanto o callback escreve.
+void Ext2Shell::forEachFileExtent(const ext2_inode& inode,
+                                  std::function<void(unsigned long long, const char*, size_t)> callback) {
+    const unsigned long long fileSize = inodeFileSize(inode);
+
+    struct BlockRun {
+        unsigned int logical;
+        unsigned int physical;
+        unsigned int count;
+    };
+    std::vector<BlockRun> runs;
+    forEachBlockNumber(inode, [&](unsigned int logical, unsigned int blockNum) {
+        if ((unsigned long long)logical * blockSize >= fileSize) return false;
+        if (!runs.empty()) {
+            BlockRun& last = runs.back();
+            if (last.logical + last.count == logical && last.physical + last.count == blockNum) {
+                last.count++;
+                return true;
+            }
+        }
+        runs.push_back({logical, blockNum, 1});
+        return true;
+    });
+
+    // Estado da leitura antecipada: até onde já foi pedido (em blocos de
+    // dados, contando desde o início), o tamanho do último pedido e o cursor
+    // correspondente nos trechos
+    unsigned long long consumed = 0, requested = 0;
+    unsigned int window = READAHEAD_MIN_BLOCKS;
+    unsigned int issued = 0;
+    size_t aheadRun = 0;
+    unsigned int aheadOffset = 0;
+    auto readahead = [&]() {
+        if (aheadRun == runs.size() || consumed + issued / 2 < requested) return;
+        unsigned long long target = consumed + window;
+        issued = target - requested;
+        while (requested < target && aheadRun < runs.size()) {
+            const BlockRun& run = runs[aheadRun];
+            unsigned int count = std::min<unsigned long long>(run.count - aheadOffset, target - requested);
+            prefetchBlocks(run.physical + aheadOffset, count);
+            requested += count;
+            aheadOffset += count;
+            if (aheadOffset == run.count) {
+                aheadRun++;
+                aheadOffset = 0;
+            }
+        }
+        window = std::min(window * 2, (unsigned int)READAHEAD_MAX_BLOCKS);
+    };
+
+    BlockBuffer batchBuffer = blockPool.acquireBatch();
+    char* batch = batchBuffer.data();
+    std::vector<unsigned int> pending;  // Blocos físicos do lote atual
+    std::vector<unsigned int> logicals; // Índices lógicos correspondentes
+    unsigned long long position = 0;    // Até onde o arquivo já foi entregue
+
+    // Lê o lote de uma vez e entrega os blocos (e os buracos entre eles) em ordem
+    auto flush = [&]() {
+        readBlocks(pending, batch);
+        for (size_t i = 0; i < pending.size(); i++) {
+            unsigned long long offset = (unsigned long long)logicals[i] * blockSize;
+            if (offset > position) {
+                callback(position, nullptr, offset - position); // Buraco
+            }
+            size_t length = std::min<unsigned long long>(blockSize, fileSize - offset);
+            callback(offset, batch + i * blockSize, length);
+            position = offset + length;
+        }
+        consumed += pending.size();
+        pending.clear();
+        logicals.clear();
+    };
+
+    readahead();
+    for (const BlockRun& run : runs) {
+        for (unsigned int i = 0; i < run.count; i++) {
+            pending.push_back(run.physical + i);
+            logicals.push_back(run.logical + i);
+            if (pending.size() == IO_BATCH_BLOCKS) {
+                flush();
+                readahead();
+            }
+        }
+    }
+    if (!pending.empty()) flush();
+
+    if (position < fileSize) {
+        callback(position, nullptr, fileSize - position); // Buraco no fim
+    }
+}
+
+// Percorre recursivamente a subárvore de um diretório, chamando o callback
+// com o caminho, o número e o inode de cada item ('.' e '..' são pulados)
+void Ext2Shell::forEachInodeInTree(unsigned int dirInodeNum, const std::string& path,
+                                   std::function<void(const std::string&, unsigned int, const ext2_inode&)> callback) {
+    std::vector<std::pair<std::string, unsigned int>> children;
+    forEachDirEntry(dirInodeNum, [&](const ext2_dir_entry_2* entry) {
+        std::string name(entry->name, entry->name_len);
+        if (name != "." && name != "..") {
+            children.emplace_back(name, entry->inode);
+        }
+        return true;
+    });
+
+    // Lê de uma vez os blocos da tabela de inodes que contêm os filhos
+    std::vector<unsigned int> tableBlocks;
+    for (const auto& child : children) {
+        tableBlocks.push_back(inodeOffset(child.second) / blockSize);
+    }
+    std::sort(tableBlocks.begin(), tableBlocks.end());
+    tableBlocks.erase(std::unique(tableBlocks.begin(), tableBlocks.end()), tableBlocks.end());
+    std::vector<char> tables(tableBlocks.size() * blockSize);
+    readBlocks(tableBlocks, tables.data());
+
+    for (const auto& child : children) {
+        std::string childPath = (path == "/" ? "/" : path + "/") + child.first;
+        off_t offset = inodeOffset(child.second);
+        size_t index = std::lower_bound(tableBlocks.begin(), tableBlocks.end(), offset / blockSize) - tableBlocks.begin();
+        ext2_inode inode;
+        memcpy(&inode, tables.data() + index * blockSize + offset % blockSize, sizeof(ext2_inode));
+        callback(childPath, child.second, inode);
+        if (S_ISDIR(inode.i_mode)) {
+            forEachInodeInTree(child.second, childPath, callback);
+        }
+    }
+}
+
+// Traduz um índice lógico de bloco do inode para o número físico (0 = buraco)
+unsigned int Ext2Shell::getBlockNumber(const ext2_inode& inode, unsigned int logical) {
+    const unsigned int perBlock = blockSize / sizeof(unsigned int);
+    if (logical < 12) return inode.i_block[logical];
+
+    // Descobre o nível de indireção e o deslocamento dentro dele
+    logical -= 12;
+    int depth = 1;
+    unsigned int span = 1; // blocos lógicos cobertos por um ponteiro do nível mais alto
+    while (logical >= span * perBlock) {
+        logical -= span * perBlock;
+        span *= perBlock;
+        if (++depth > 3) return 0; // Além do indireto triplo
+    }
+
+    BlockBuffer pointerBuffer = blockPool.acquire();
+    unsigned int* pointers = pointerBuffer.as<unsigned int>();
+    unsigned int blockNum = inode.i_block[11 + depth];
+    for (; depth > 0 && blockNum != 0; depth--) {
+        readBlock(blockNum, pointers);
+        blockNum = pointers[(logical / span) % perBlock];
+        span /= perBlock;
+    }
+    return blockNum;
+}
+
+// Faz o índice lógico 'logical' do inode apontar para o bloco físico 'phys',
+// alocando (zerados) os blocos de ponteiros que ainda não existem. Com
+// 'spare', os blocos de ponteiros novos saem do fim desse vetor (blocos já
+// reservados por quem chama) antes de recorrer a allocateBlock. Os blocos de
+// ponteiros novos são contados em i_blocks; quem chama grava o inode.
+int Ext2Shell::setBlockNumber(ext2_inode& inode, unsigned int logical, unsigned int phys,
+                              std::vector<unsigned int>* spare) {
+    const unsigned int perBlock = blockSize / sizeof(unsigned int);
+    if (logical < 12) {
+        inode.i_block[logical] = phys;
+        return 0;
+    }
+
+    logical -= 12;
+    int depth = 1;
+    unsigned int span = 1;
+    while (logical >= span * perBlock) {
+        logical -= span * perBlock;
+        span *= perBlock;
+        if (++depth > 3) return -1;
+    }
+
+    // Aloca um bloco de ponteiros zerado
+    auto newPointerBlock = [&]() -> int {
+        int blockNum;
+        if (spare && !spare->empty()) {
+            blockNum = spare->back();
+            spare->pop_back();
+        } else {
+            blockNum = allocateBlock();
+        }
+        if (blockNum < 0) return -1;
+        BlockBuffer zeros = blockPool.acquire(true);
+        writeBlock(blockNum, zeros.data());
+        inode.i_blocks += blockSize / 512;
+        return blockNum;
+    };
+
+    unsigned int& top = inode.i_block[11 + depth];
+    if (top == 0) {
+        int blockNum = newPointerBlock();
+        if (blockNum < 0) return -1;
+        top = blockNum;
+    }
+
+    BlockBuffer pointerBuffer = blockPool.acquire();
+    unsigned int* pointers = pointerBuffer.as<unsigned int>();
+    unsigned int blockNum = top;
+    for (; depth > 0; depth--) {
+        readBlock(blockNum, pointers);
+        unsigned int index = (logical / span) % perBlock;
+        if (depth == 1) {
+            pointers[index] = phys;
+            writeBlock(blockNum, pointers);
+            break;
+        }
+        if (pointers[index] == 0) {
+            int child = newPointerBlock();
+            if (child < 0) return -1;
+            pointers[index] = child;
+            writeBlock(blockNum, pointers);
+        }
+        blockNum = pointers[index];
+        span /= perBlock;
+    }
+    return 0;
+}
+
+// Conta os blocos de ponteiros que setBlockNumber vai criar ao ligar, em
+// ordem, os índices lógicos crescentes 'logicals'. 'before[i]' recebe quantos
+// deles são criados ao ligar logicals[i] (de cima para baixo), para que quem
+// chama possa reservá-los junto com os dados.
+unsigned long long Ext2Shell::countMissingPointerBlocks(const ext2_inode& inode, const std::vector<unsigned int>& logicals,
+                                                        std::vector<unsigned int>& before) {
+    const unsigned long long perBlock = blockSize / sizeof(unsigned int);
+    before.assign(logicals.size(), 0);
+    unsigned long long total = 0;
+    // Último nó criado em cada nível de cada árvore (os índices são
+    // crescentes, então um nó criado só se repete no índice seguinte)
+    unsigned long long created[4][3];
+    for (auto& levels : created) {
+        for (auto& key : levels) key = std::numeric_limits<unsigned long long>::max();
+    }
+    unsigned long long lastLeaf = std::numeric_limits<unsigned long long>::max();
+
+    BlockBuffer pointerBuffer = blockPool.acquire();
+    unsigned int* pointers = pointerBuffer.as<unsigned int>();
+    for (size_t i = 0; i < logicals.size(); i++) {
+        if (logicals[i] < 12) continue;
+        unsigned long long rel = logicals[i] - 12;
+        // Cada bloco de ponteiros da última camada cobre perBlock índices
+        // alinhados; índices no mesmo bloco já o encontram ligado
+        if (rel / perBlock == lastLeaf) continue;
+        lastLeaf = rel / perBlock;
+
+        int depth = 1;
+        unsigned long long span = perBlock;
+        while (rel >= span) {
+            rel -= span;
+            span *= perBlock;
+            depth++;
+        }
+        bool onDisk = true;
+        unsigned int blockNum = inode.i_block[11 + depth];
+        for (int level = 0; level < depth; level++) {
+            span /= perBlock; // Índices cobertos por cada filho deste nó
+            unsigned long long key = rel / (span * perBlock);
+            if (onDisk && blockNum == 0) onDisk = false;
+            if (!onDisk) {
+                if (created[depth][level] != key) {
+                    created[depth][level] = key;
+                    before[i]++;
+                    total++;
+                }
+                continue;
+            }
+            if (level + 1 < depth) {
+                readBlock(blockNum, pointers);
+                blockNum = pointers[(rel / span) % perBlock];
+            }
+        }
+    }
+    return total;
+}
+
+// Mede a folga de um bloco de diretório: a maior área contígua que uma nova
+// entrada pode usar e o total de bytes que não guardam entradas
+void Ext2Shell::measureDirBlock(DirBlockSlack& slot, const char* blockData) {
+    slot.maxFree = 0;
+    slot.totalFree = 0;
+    unsigned int offset = 0;
+    while (offset < blockSize) {
+        const ext2_dir_entry_2* entry = reinterpret_cast<const ext2_dir_entry_2*>(blockData + offset);
+        if (entry->rec_len == 0) break;
+        unsigned int usedLen = entry->inode == 0 ? 0 : 8 + ((entry->name_len + 3) & ~3);
+        slot.maxFree = std::max(slot.maxFree, (unsigned int)entry->rec_len - usedLen);
+        slot.totalFree += entry->rec_len - usedLen;
+        offset += entry->rec_len;
+    }
+}
 
+// Devolve o mapa de espaço livre do diretório, montando-o na primeira vez
+// com uma única varredura de todos os seus blocos.
+std::vector<Ext2Shell::DirBlockSlack>& Ext2Shell::getDirFreeMap(unsigned int dirInodeNum) {
+    auto it = dirFreeMap.find(dirInodeNum);
+    if (it != dirFreeMap.end()) return it->second;
+
+    std::vector<DirBlockSlack>& freeMap = dirFreeMap[dirInodeNum];
+    ext2_inode dirInode;
+    readInode(dirInodeNum, &dirInode);
+    BlockBuffer blockBuffer = blockPool.acquire();
+    char* blockData = blockBuffer.data();
+    forEachBlockNumber(dirInode, [&](unsigned int logical, unsigned int blockNum) {
+        readBlock(blockNum, blockData);
+        DirBlockSlack slot = {logical, blockNum, 0, 0};
+        measureDirBlock(slot, blockData);
+        freeMap.push_back(slot);
+        return true;
+    });
+    return freeMap;
+}
+
+// Atualiza o mapa de espaço livre depois que um bloco do diretório mudou
+void Ext2Shell::noteDirBlockChanged(unsigned int dirInodeNum, unsigned int blockNum, const char* blockData) {
+    auto it = dirFreeMap.find(dirInodeNum);
+    if (it == dirFreeMap.end()) return;
+    for (DirBlockSlack& slot : it->second) {
+        if (slot.block == blockNum) {
+            measureDirBlock(slot, blockData);
+            return;
+        }
+    }
+}
+
+// Tenta gravar uma nova entrada dentro de um bloco de diretório já lido:
+// reaproveita uma entrada vazia ou divide a folga de uma entrada existente.
+bool Ext2Shell::insertDirEntryInBlock(char* blockData, unsigned int childInodeNum, const std::string& name, unsigned char fileType) {
+    // Tamanho necessário para a nova entrada, alinhado a 4 bytes
+    unsigned int neededLen = 8 + ((name.size() + 3) & ~3);
+
+    unsigned int offset = 0;
+    while (offset < blockSize) {
+        ext2_dir_entry_2* entry = (ext2_dir_entry_2*)&blockData[offset];
+        if (entry->rec_len == 0) break;
+
+        ext2_dir_entry_2* newEntry = nullptr;
+        if (entry->inode == 0 && entry->rec_len >= neededLen) {
+            // Entrada vazia: ocupa no lugar, mantendo o rec_len
+            newEntry = entry;
+        } else {
             // Calcula o tamanho ideal da entrada atual, alinhado a 4 bytes
             unsigned int idealLen = 8 + ((entry->name_len + 3) & ~3);
             // Espaço sobrando após a entrada atual (potencial para nova entrada)
             unsigned int leftover = entry->rec_len - idealLen;
-            // Tamanho necessário para a nova entrada, alinhado a 4 bytes
-            unsigned int neededLen = 8 + ((name.size() + 3) & ~3);
-
-            // Verifica se o espaço sobrando é suficiente para a nova entrada
-            if (leftover >= neededLen) {
+            if (entry->inode != 0 && leftover >= neededLen) {
                 // Ajusta o tamanho da entrada atual para o ideal, liberando espaço
                 entry->rec_len = idealLen;
-
-                // Cria a nova entrada no espaço liberado
-                ext2_dir_entry_2* newEntry = (ext2_dir_entry_2*)&blockData[offset + idealLen];
-                newEntry->inode = childInodeNum;
+                newEntry = (ext2_dir_entry_2*)&blockData[offset + idealLen];
                 newEntry->rec_len = leftover;
-                newEntry->name_len = name.size();
-                newEntry->file_type = fileType;
-                memcpy(newEntry->name, name.c_str(), name.size());
+            }
+        }
 
-                // Escreve o bloco atualizado no disco
-                writeBlock(parentInode.i_block[i], blockData.data());
+        if (newEntry) {
+            newEntry->inode = childInodeNum;
+            newEntry->name_len = name.size();
+            newEntry->file_type = fileType;
+            memcpy(newEntry->name, name.c_str(), name.size());
+            return true;
+        }
 
-                // Incrementa o contador de links do diretório pai SE a entrada for um diretório
-                if (fileType == EXT2_FT_DIR) {
-                    parentInode.i_links_count++;
-                    writeInode(parentInodeNum, &parentInode);
-                }
+        // Avança para a próxima entrada no bloco
+        offset += entry->rec_len;
+    }
+    return false;
+}
+
+// Anexa um bloco novo (não inicializado) ao fim de um diretório, atualizando
+// i_size e i_blocks na cópia em memória; quem chama grava o inode.
+// Retorna o número físico do bloco e, em 'logical', seu índice lógico.
+int Ext2Shell::appendDirBlock(ext2_inode& dirInode, unsigned int& logical) {
+    int blockNum = allocateBlock();
+    if (blockNum < 0) return -1;
+
+    logical = dirInode.i_size / blockSize;
+    if (setBlockNumber(dirInode, logical, blockNum) < 0) {
+        freeBlock(blockNum);
+        return -1;
+    }
+    dirInode.i_size += blockSize;
+    dirInode.i_blocks += blockSize / 512;
+    return blockNum;
+}
+
+// Função para adicionar uma entrada de diretório no diretório pai.
+// Diretórios indexados (htree) usam o índice de hash. Nos lineares, o mapa de
+// espaço livre indica direto qual bloco tem folga; se nenhum tiver, o
+// diretório cresce com um bloco novo (passando pelos indiretos se preciso) ou,
+// se ainda tem um bloco só e o FS suporta dir_index, vira um diretório indexado.
+int Ext2Shell::addDirectoryEntry(unsigned int parentInodeNum, unsigned int childInodeNum, const std::string& name, unsigned char fileType) {
+    ext2_inode parentInode;
+    // Lê o inode do diretório pai
+    readInode(parentInodeNum, &parentInode);
+
+    bool inserted = false;
+    if (parentInode.i_flags & EXT2_INDEX_FL) {
+        int result = dirIndexEnabled() ? dxAddEntry(parentInodeNum, parentInode, childInodeNum, name, fileType) : 1;
+        if (result < 0) return -1;
+        if (result == 0) {
+            inserted = true;
+        } else {
+            // Índice cheio ou não suportado: sem o flag, o kernel e o e2fsck
+            // tratam o diretório como lista linear válida
+            parentInode.i_flags &= ~EXT2_INDEX_FL;
+            writeInode(parentInodeNum, &parentInode);
+        }
+    }
+
+    unsigned int neededLen = 8 + ((name.size() + 3) & ~3);
+    BlockBuffer blockBuffer = blockPool.acquire();
+    char* blockData = blockBuffer.data();
+
+    if (!inserted) {
+        std::vector<DirBlockSlack>& freeMap = getDirFreeMap(parentInodeNum);
+        for (DirBlockSlack& slot : freeMap) {
+            if (slot.maxFree < neededLen) continue;
 
-                return 0; // sucesso
+            readBlock(slot.block, blockData);
+            if (insertDirEntryInBlock(blockData, childInodeNum, name, fileType)) {
+                writeBlock(slot.block, blockData);
+                measureDirBlock(slot, blockData);
+                inserted = true;
+                break;
             }
+            measureDirBlock(slot, blockData); // Mapa desatualizado, corrige
+        }
 
-            // Avança para a próxima entrada no bloco
-            offset += entry->rec_len;
+        // Diretório de um bloco só, cheio: converte para htree e insere pelo índice
+        if (!inserted && dirIndexEnabled() && freeMap.size() == 1 && parentInode.i_size == blockSize) {
+            dirFreeMap.erase(parentInodeNum);
+            if (dxMakeIndexed(parentInodeNum, parentInode) < 0) return -1;
+            int result = dxAddEntry(parentInodeNum, parentInode, childInodeNum, name, fileType);
+            if (result < 0) return -1;
+            inserted = (result == 0);
         }
     }
 
-    // Retorna erro se não houver espaço suficiente em nenhum bloco
-    return -1;
+    if (!inserted) {
+        // Nenhum bloco com folga: anexa um bloco novo ao fim do diretório
+        unsigned int logical;
+        int blockNum = appendDirBlock(parentInode, logical);
+        if (blockNum < 0) return -1;
+
+        // Bloco novo começa como uma única entrada vazia ocupando tudo
+        memset(blockData, 0, blockSize);
+        ext2_dir_entry_2* emptyEntry = reinterpret_cast<ext2_dir_entry_2*>(blockData);
+        emptyEntry->rec_len = blockSize;
+        insertDirEntryInBlock(blockData, childInodeNum, name, fileType);
+        writeBlock(blockNum, blockData);
+        writeInode(parentInodeNum, &parentInode);
+
+        std::vector<DirBlockSlack>& freeMap = getDirFreeMap(parentInodeNum);
+        if (freeMap.empty() || freeMap.back().block != (unsigned int)blockNum) {
+            DirBlockSlack slot = {logical, (unsigned int)blockNum, 0, 0};
+            measureDirBlock(slot, blockData);
+            freeMap.push_back(slot);
+        }
+    }
+
+    // Incrementa o contador de links do diretório pai SE a entrada for um diretório
+    if (fileType == EXT2_FT_DIR) {
+        parentInode.i_links_count++;
+        writeInode(parentInodeNum, &parentInode);
+    }
+
+    // Mantém a cópia em memória do diretório corrente em dia
+    if (parentInodeNum == currentInodeNum) {
+        currentInode = parentInode;
+    }
+
+    return 0; // sucesso
 }
 
-// Remove apenas a Directory Entry sem liberar o inode
-void Ext2Shell::removeDirectoryEntry(unsigned int parentInodeNum, const std::string& name) {
+// Remove apenas a Directory Entry sem liberar o inode.
+// Retorna true se a entrada foi encontrada e removida.
+bool Ext2Shell::removeDirectoryEntry(unsigned int parentInodeNum, const std::string& name) {
     ext2_inode parentInode;
     readInode(parentInodeNum, &parentInode);
 
-    std::vector<char> blockData(blockSize);
-    for (int i = 0; i < 12; i++) {
-        if (parentInode.i_block[i] == 0)
-            continue;
-        readBlock(parentInode.i_block[i], blockData.data());
+    BlockBuffer blockBuffer = blockPool.acquire();
+    char* blockData = blockBuffer.data();
+    bool removed = false;
+    forEachBlockNumber(parentInode, [&](unsigned int, unsigned int blockNum) {
+        readBlock(blockNum, blockData);
 
         ext2_dir_entry_2* prev = nullptr;
         unsigned int offset = 0;
         while (offset < blockSize) {
             auto* e = reinterpret_cast<ext2_dir_entry_2*>(&blockData[offset]);
-            if (e->inode == 0) 
+            if (e->rec_len == 0)
                 break;
 
-            std::string entryName(e->name, e->name_len);
-            if (entryName == name) {
+            if (e->inode != 0 && std::string(e->name, e->name_len) == name) {
                 if (prev) {
                     // junta rec_len
                     prev->rec_len += e->rec_len;
@@ -354,140 +1928,843 @@ void Ext2Shell::removeDirectoryEntry(unsigned int parentInodeNum, const std::str
                     // se for primeiro, marca inode=0 (entry “vazia”)
                     e->inode = 0;
                 }
-                writeBlock(parentInode.i_block[i], blockData.data());
-                return;
+                writeBlock(blockNum, blockData);
+                noteDirBlockChanged(parentInodeNum, blockNum, blockData);
+                removed = true;
+                return false;
             }
             prev = e;
             offset += e->rec_len;
         }
-    }
-}
-
-// Verifica se um bit está marcado no bitmap
-bool Ext2Shell::isBitSet(unsigned char* bitmap, int bit) {
-    int bytePos = bit / 8;
-    int bitPos = bit % 8;
-    return (bitmap[bytePos] & (1 << bitPos)) != 0;
+        return true;
+    });
+    return removed;
 }
 
-// Procura um inode livre em todos os grupos
-int Ext2Shell::findFreeInode() {
-    unsigned int numGroups = (super.s_inodes_count + super.s_inodes_per_group - 1) / super.s_inodes_per_group;
-    // Percorre todos os grupos de inodes
-    for (unsigned int group = 0; group < numGroups; ++group) {
-        ext2_group_desc groupDesc;
-        readGroupDesc(group, &groupDesc);
-        // Se o grupo não tem inodes livres, pula para o próximo
-        if (groupDesc.bg_free_inodes_count > 0) {
-            unsigned char bitmap[blockSize];
-            readBlock(groupDesc.bg_inode_bitmap, bitmap);
-            // Percorre o bitmap do grupo
-            for (unsigned int i = 0; i < super.s_inodes_per_group; ++i) {
-                // Se o bit correspondente ao inode não está marcado, é um inode livre
-                if (!isBitSet(bitmap, i)) {
-                    return group * super.s_inodes_per_group + i + 1;
-                }
-            }
+// Reescreve as entradas de um diretório de forma densa, no menor número de
+// blocos, e libera os blocos que sobrarem no fim. Diretórios indexados só são
+// compactados quando tudo cabe em um bloco (o índice deixa de ser necessário).
+// Retorna quantos blocos foram liberados, ou -1 se o diretório não pode ser
+// compactado.
+int Ext2Shell::compactDirectory(unsigned int dirInodeNum) {
+    ext2_inode dirInode;
+    readInode(dirInodeNum, &dirInode);
+    if (!S_ISDIR(dirInode.i_mode)) return -1;
+
+    // Blocos físicos em ordem lógica; diretórios com buracos ficam de fora
+    std::vector<unsigned int> blocks;
+    bool hasHoles = false;
+    forEachBlockNumber(dirInode, [&](unsigned int logical, unsigned int blockNum) {
+        if (logical != blocks.size()) hasHoles = true;
+        blocks.push_back(blockNum);
+        return true;
+    });
+    if (hasHoles || blocks.empty()) return -1;
+
+    // Empacota as entradas vivas, na ordem atual ('.' e '..' continuam primeiro)
+    std::vector<std::vector<char>> packed;
+    unsigned int pos = blockSize;
+    ext2_dir_entry_2* last = nullptr;
+    forEachDirEntry(dirInodeNum, [&](const ext2_dir_entry_2* entry) {
+        unsigned int len = 8 + ((entry->name_len + 3) & ~3);
+        if (pos + len > blockSize) {
+            if (last) last->rec_len += blockSize - pos;
+            packed.emplace_back(blockSize, 0);
+            pos = 0;
         }
-    }
-    return -1; // Nenhum inode livre em nenhum grupo
-}
+        last = reinterpret_cast<ext2_dir_entry_2*>(&packed.back()[pos]);
+        memcpy(last, entry, 8 + entry->name_len);
+        last->rec_len = len;
+        pos += len;
+        return true;
+    });
+    if (last) last->rec_len += blockSize - pos;
+    if (packed.empty()) return -1;
 
-// Procura um bloco livre em todos os grupos
-int Ext2Shell::findFreeBlock() {
-    unsigned int numGroups = (super.s_blocks_count + super.s_blocks_per_group - 1) / super.s_blocks_per_group;
-    // Percorre todos os grupos de blocos
-    for (unsigned int group = 0; group < numGroups; ++group) {
-        ext2_group_desc groupDesc;
-        readGroupDesc(group, &groupDesc);
-        // Se o grupo não tem blocos livres, pula para o próximo
-        if (groupDesc.bg_free_blocks_count > 0) {
-            unsigned char bitmap[blockSize];
-            readBlock(groupDesc.bg_block_bitmap, bitmap);
-            // Percorre o bitmap do grupo
-            for (unsigned int i = 0; i < super.s_blocks_per_group; ++i) {
-                // Se o bit correspondente ao bloco não está marcado, é um bloco livre
-                if (!isBitSet(bitmap, i)) {
-                    return group * super.s_blocks_per_group + i + 1;
-                }
-            }
-        }
+    bool indexed = (dirInode.i_flags & EXT2_INDEX_FL) != 0;
+    if (indexed && packed.size() > 1) return -1;
+    if (packed.size() >= blocks.size()) return 0; // Nada a ganhar
+
+    for (size_t i = 0; i < packed.size(); i++) {
+        writeBlock(blocks[i], packed[i].data());
     }
-    return -1; // Nenhum bloco livre em nenhum grupo
-}
 
-// Aloca um inode: marca bit no bitmap, atualiza contadores, retorna número do inode alocado
-int Ext2Shell::allocateInode() {
-    int inodeNum = findFreeInode(); // procura inode livre
-    if (inodeNum < 0) return -1;    // não encontrou inode livre
+    dirInode.i_flags &= ~EXT2_INDEX_FL;
+    int freed = truncateBlocks(dirInode, packed.size());
+    dirInode.i_size = packed.size() * blockSize;
+    writeInode(dirInodeNum, &dirInode);
 
-    unsigned char bitmap[blockSize];
-    readBlock(currentGroupDesc.bg_inode_bitmap, bitmap); // lê bitmap do grupo
+    dirFreeMap.erase(dirInodeNum);
+    if (dirInodeNum == currentInodeNum) {
+        currentInode = dirInode;
+    }
+    return freed;
+}
 
-    int bit = (inodeNum - 1) % super.s_inodes_per_group; // bit relativo ao grupo
-    int bytePos = bit / 8;
-    int bitPos = bit % 8;
+// Compacta o diretório se a fração de espaço desperdiçado passou do limiar
+// configurado com 'compact auto' e a compactação liberaria algum bloco
+void Ext2Shell::maybeAutoCompact(unsigned int dirInodeNum) {
+    if (compactThreshold == 0) return;
 
-    bitmap[bytePos] |= (1 << bitPos);  // marca bit como ocupado
-    writeBlock(currentGroupDesc.bg_inode_bitmap, bitmap); // salva bitmap atualizado
+    ext2_inode dirInode;
+    readInode(dirInodeNum, &dirInode);
+    if (dirInode.i_flags & EXT2_INDEX_FL) return;
 
-    // Atualiza contadores de inodes livres no superbloco e no grupo
-    super.s_free_inodes_count--;
-    currentGroupDesc.bg_free_inodes_count--;
+    std::vector<DirBlockSlack>& freeMap = getDirFreeMap(dirInodeNum);
+    if (freeMap.size() < 2) return;
 
-    // Escreve superbloco atualizado no disco (offset fixo)
-    lseek(fd, BASE_OFFSET, SEEK_SET);
-    write(fd, &super, sizeof(super));
+    unsigned long long total = (unsigned long long)freeMap.size() * blockSize;
+    unsigned long long wasted = 0;
+    for (const DirBlockSlack& slot : freeMap) {
+        wasted += slot.totalFree;
+    }
+    unsigned long long neededBlocks = (total - wasted + blockSize - 1) / blockSize;
+    if (wasted * 100 >= total * compactThreshold && neededBlocks < freeMap.size()) {
+        compactDirectory(dirInodeNum);
+    }
+}
 
-    // Atualiza o grupo no disco
-    writeGroupDesc(currentGroupNum, &currentGroupDesc);
+// --- Diretórios Indexados (htree / dir_index) ---
+// Funções de hash portadas de lib/ext2fs/dirhash.c (e2fsprogs), que precisam
+// bater bit a bit com as do kernel para que o índice seja compatível.
+
+namespace {
+
+// Uma rodada de TEA (Tiny Encryption Algorithm) sobre buf
+void teaTransform(uint32_t buf[4], const uint32_t in[4]) {
+    uint32_t sum = 0;
+    uint32_t b0 = buf[0], b1 = buf[1];
+    uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+    for (int n = 0; n < 16; n++) {
+        sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+        b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+    buf[0] += b0;
+    buf[1] += b1;
+}
 
-    return inodeNum; // retorna número do inode alocado
+inline uint32_t rotl32(uint32_t x, int s) { return (x << s) | (x >> (32 - s)); }
+
+// MD4 "pela metade" (3 rodadas de 8 passos) sobre buf
+void halfMD4Transform(uint32_t buf[4], const uint32_t in[8]) {
+    auto F = [](uint32_t x, uint32_t y, uint32_t z) { return z ^ (x & (y ^ z)); };
+    auto G = [](uint32_t x, uint32_t y, uint32_t z) { return (x & y) + ((x ^ y) & z); };
+    auto H = [](uint32_t x, uint32_t y, uint32_t z) { return x ^ y ^ z; };
+    const uint32_t K2 = 013240474631UL, K3 = 015666365641UL;
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    // Rodada 1
+    a = rotl32(a + F(b, c, d) + in[0], 3);  d = rotl32(d + F(a, b, c) + in[1], 7);
+    c = rotl32(c + F(d, a, b) + in[2], 11); b = rotl32(b + F(c, d, a) + in[3], 19);
+    a = rotl32(a + F(b, c, d) + in[4], 3);  d = rotl32(d + F(a, b, c) + in[5], 7);
+    c = rotl32(c + F(d, a, b) + in[6], 11); b = rotl32(b + F(c, d, a) + in[7], 19);
+    // Rodada 2
+    a = rotl32(a + G(b, c, d) + in[1] + K2, 3);  d = rotl32(d + G(a, b, c) + in[3] + K2, 5);
+    c = rotl32(c + G(d, a, b) + in[5] + K2, 9);  b = rotl32(b + G(c, d, a) + in[7] + K2, 13);
+    a = rotl32(a + G(b, c, d) + in[0] + K2, 3);  d = rotl32(d + G(a, b, c) + in[2] + K2, 5);
+    c = rotl32(c + G(d, a, b) + in[4] + K2, 9);  b = rotl32(b + G(c, d, a) + in[6] + K2, 13);
+    // Rodada 3
+    a = rotl32(a + H(b, c, d) + in[3] + K3, 3);  d = rotl32(d + H(a, b, c) + in[7] + K3, 9);
+    c = rotl32(c + H(d, a, b) + in[2] + K3, 11); b = rotl32(b + H(c, d, a) + in[6] + K3, 15);
+    a = rotl32(a + H(b, c, d) + in[1] + K3, 3);  d = rotl32(d + H(a, b, c) + in[5] + K3, 9);
+    c = rotl32(c + H(d, a, b) + in[0] + K3, 11); b = rotl32(b + H(c, d, a) + in[4] + K3, 15);
+
+    buf[0] += a; buf[1] += b; buf[2] += c; buf[3] += d;
 }
 
-// Aloca um bloco: marca bit no bitmap, atualiza contadores, retorna número do bloco alocado
-int Ext2Shell::allocateBlock() {
-    int blockNum = findFreeBlock(); // procura bloco livre
-    if (blockNum < 0) return -1;    // não encontrou bloco livre
+// O hash "legado" original do htree
+uint32_t dxHackHash(const char* name, int len, bool unsignedChars) {
+    uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+    for (int i = 0; i < len; i++) {
+        int c = unsignedChars ? (int)(unsigned char)name[i] : (int)(signed char)name[i];
+        hash = hash1 + (hash0 ^ (c * 7152373));
+        if (hash & 0x80000000) hash -= 0x7fffffff;
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
 
-    unsigned char bitmap[blockSize];
-    readBlock(currentGroupDesc.bg_block_bitmap, bitmap); // lê bitmap do grupo
+// Empacota até num*4 bytes do nome em palavras de 32 bits, com preenchimento
+void str2hashbuf(const char* msg, int len, uint32_t* buf, int num, bool unsignedChars) {
+    uint32_t pad = (uint32_t)len | ((uint32_t)len << 8);
+    pad |= pad << 16;
+
+    uint32_t val = pad;
+    if (len > num * 4) len = num * 4;
+    for (int i = 0; i < len; i++) {
+        int c = unsignedChars ? (int)(unsigned char)msg[i] : (int)(signed char)msg[i];
+        val = c + (val << 8);
+        if ((i % 4) == 3) {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
+    }
+    if (--num >= 0) *buf++ = val;
+    while (--num >= 0) *buf++ = pad;
+}
 
-    int bit = (blockNum - 1) % super.s_blocks_per_group; // bit relativo ao grupo
-    int bytePos = bit / 8;
-    int bitPos = bit % 8;
+} // namespace
 
-    bitmap[bytePos] |= (1 << bitPos);  // marca bit como ocupado
-    writeBlock(currentGroupDesc.bg_block_bitmap, bitmap); // salva bitmap atualizado
+// O FS declara suporte a diretórios indexados?
+bool Ext2Shell::dirIndexEnabled() const {
+    return (super.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) != 0;
+}
 
-    // Atualiza contadores de blocos livres no superbloco e no grupo
-    super.s_free_blocks_count--;
-    currentGroupDesc.bg_free_blocks_count--;
+// Calcula o hash principal de um nome com o algoritmo gravado no dx_root.
+// A variante com/sem sinal vem de s_flags e a semente de s_hash_seed.
+uint32_t Ext2Shell::dxHash(const std::string& name, unsigned char hashVersion) {
+    if (hashVersion <= EXT2_HASH_TEA && (super.s_flags & EXT2_FLAGS_UNSIGNED_HASH)) {
+        hashVersion += 3;
+    }
 
-    // Escreve superbloco atualizado no disco (offset fixo)
-    lseek(fd, BASE_OFFSET, SEEK_SET);
-    write(fd, &super, sizeof(super));
+    uint32_t buf[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    if (super.s_hash_seed[0] | super.s_hash_seed[1] | super.s_hash_seed[2] | super.s_hash_seed[3]) {
+        memcpy(buf, super.s_hash_seed, sizeof(buf));
+    }
 
-    // Atualiza o grupo no disco
-    writeGroupDesc(currentGroupNum, &currentGroupDesc);
+    const char* p = name.data();
+    int len = name.size();
+    uint32_t in[8];
+    uint32_t hash;
+    bool unsignedChars = hashVersion >= EXT2_HASH_LEGACY_UNSIGNED;
+    switch (hashVersion) {
+    case EXT2_HASH_LEGACY:
+    case EXT2_HASH_LEGACY_UNSIGNED:
+        hash = dxHackHash(p, len, unsignedChars);
+        break;
+    case EXT2_HASH_HALF_MD4:
+    case EXT2_HASH_HALF_MD4_UNSIGNED:
+        for (; len > 0; len -= 32, p += 32) {
+            str2hashbuf(p, len, in, 8, unsignedChars);
+            halfMD4Transform(buf, in);
+        }
+        hash = buf[1];
+        break;
+    case EXT2_HASH_TEA:
+    case EXT2_HASH_TEA_UNSIGNED:
+        for (; len > 0; len -= 16, p += 16) {
+            str2hashbuf(p, len, in, 4, unsignedChars);
+            teaTransform(buf, in);
+        }
+        hash = buf[0];
+        break;
+    default:
+        throw std::runtime_error("Unsupported directory hash version " + std::to_string(hashVersion) + ".");
+    }
+    return hash & ~1u; // O bit 0 é reservado para marcar continuação de colisão
+}
 
-    return blockNum; // retorna número do bloco alocado
+// Desce o índice do diretório da raiz até o nó que aponta para a folha onde
+// 'hash' deve estar. Cada nível visitado fica em 'frames' (o último é o nó
+// que aponta para a folha). Retorna false se o índice não for válido.
+bool Ext2Shell::dxProbe(const ext2_inode& dirInode, const std::string& name, uint32_t& hash, std::vector<DxFrame>& frames) {
+    frames.clear();
+    unsigned int rootBlock = getBlockNumber(dirInode, 0);
+    if (rootBlock == 0) return false;
+
+    DxFrame root;
+    root.logical = 0;
+    root.block = rootBlock;
+    root.data.resize(blockSize);
+    readBlock(rootBlock, root.data.data());
+
+    const ext2_dx_root_info* info = reinterpret_cast<const ext2_dx_root_info*>(&root.data[24]);
+    if (info->reserved_zero != 0 || info->info_length != 8 || info->indirect_levels > 1 ||
+        info->hash_version > EXT2_HASH_TEA) {
+        return false;
+    }
+    hash = dxHash(name, info->hash_version);
+
+    root.entriesOffset = 24 + info->info_length;
+    unsigned int levels = info->indirect_levels;
+    frames.push_back(std::move(root));
+
+    for (unsigned int level = 0; ; level++) {
+        DxFrame& frame = frames.back();
+        ext2_dx_countlimit* cl = frame.countLimit();
+        ext2_dx_entry* entries = frame.entries();
+        unsigned int expectedLimit = (blockSize - frame.entriesOffset) / sizeof(ext2_dx_entry);
+        if (cl->limit != expectedLimit || cl->count == 0 || cl->count > cl->limit) return false;
+
+        // Busca binária: última entrada com hash <= alvo (a 0 cobre o início)
+        unsigned int lo = 1, hi = cl->count;
+        while (lo < hi) {
+            unsigned int mid = (lo + hi) / 2;
+            if (entries[mid].hash > hash) hi = mid;
+            else lo = mid + 1;
+        }
+        frame.at = lo - 1;
+        if (level == levels) return true;
+
+        // Desce para o nó interno
+        DxFrame node;
+        node.logical = entries[frame.at].block & 0x0fffffff;
+        node.block = getBlockNumber(dirInode, node.logical);
+        if (node.block == 0) return false;
+        node.entriesOffset = 8;
+        node.data.resize(blockSize);
+        readBlock(node.block, node.data.data());
+        frames.push_back(std::move(node));
+    }
 }
 
-// Libera um inode no grupo correto
-void Ext2Shell::freeInode(unsigned int inodeNum) {
-    if (inodeNum == 0) return;
+// Busca um nome em um diretório indexado lendo só a raiz, o nó interno (se
+// houver) e a folha. 'indexOk' fica false se o índice não puder ser usado.
+unsigned int Ext2Shell::dxLookup(const ext2_inode& dirInode, const std::string& name, bool& indexOk) {
+    std::vector<DxFrame> frames;
+    uint32_t hash;
+    indexOk = dxProbe(dirInode, name, hash, frames);
+    if (!indexOk) return 0;
+
+    DxFrame& frame = frames.back();
+    BlockBuffer leafBuffer = blockPool.acquire();
+    char* leaf = leafBuffer.data();
+    while (true) {
+        unsigned int leafBlock = getBlockNumber(dirInode, frame.entries()[frame.at].block & 0x0fffffff);
+        if (leafBlock == 0) break;
+        readBlock(leafBlock, leaf);
+
+        unsigned int offset = 0;
+        while (offset < blockSize) {
+            const ext2_dir_entry_2* entry = reinterpret_cast<const ext2_dir_entry_2*>(&leaf[offset]);
+            if (entry->rec_len == 0) break;
+            if (entry->inode != 0 && entry->name_len == name.size() &&
+                memcmp(entry->name, name.data(), name.size()) == 0) {
+                return entry->inode;
+            }
+            offset += entry->rec_len;
+        }
+
+        // Nomes com o mesmo hash podem continuar na folha seguinte (bit 0)
+        if (frame.at + 1 >= frame.countLimit()->count) break;
+        uint32_t nextHash = frame.entries()[frame.at + 1].hash;
+        if (!(nextHash & 1) || (nextHash & ~1u) != hash) break;
+        frame.at++;
+    }
+    return 0;
+}
+
+// Insere uma entrada de índice (hash -> bloco lógico) logo após frame.at
+void Ext2Shell::dxInsertIndex(DxFrame& frame, uint32_t hash, unsigned int logical) {
+    ext2_dx_countlimit* cl = frame.countLimit();
+    ext2_dx_entry* entries = frame.entries();
+    unsigned int pos = frame.at + 1;
+    memmove(&entries[pos + 1], &entries[pos], (cl->count - pos) * sizeof(ext2_dx_entry));
+    entries[pos].hash = hash;
+    entries[pos].block = logical;
+    cl->count++;
+    writeBlock(frame.block, frame.data.data());
+}
+
+// Garante espaço no nó que aponta para a folha, para receber mais uma
+// entrada de índice: divide o nó interno ou cria um nível novo abaixo da raiz.
+// Retorna 0 em sucesso, -1 sem espaço em disco e 1 se o índice atingiu o
+// limite de dois níveis.
+int Ext2Shell::dxMakeRoom(ext2_inode& dirInode, std::vector<DxFrame>& frames) {
+    DxFrame& leafParent = frames.back();
+    if (leafParent.countLimit()->count < leafParent.countLimit()->limit) return 0;
+
+    const unsigned int nodeLimit = (blockSize - 8) / sizeof(ext2_dx_entry);
+    auto initNode = [&](DxFrame& node, unsigned int blockNum, unsigned int logical) {
+        node.block = blockNum;
+        node.logical = logical;
+        node.entriesOffset = 8;
+        node.data.assign(blockSize, 0);
+        ext2_dir_entry_2* fake = reinterpret_cast<ext2_dir_entry_2*>(node.data.data());
+        fake->inode = 0;
+        fake->rec_len = blockSize;
+        node.countLimit()->limit = nodeLimit;
+    };
+
+    if (frames.size() == 1) {
+        // Raiz cheia sem nós internos: move todas as entradas para um nó novo
+        // e faz a raiz apontar só para ele (indirect_levels passa a 1)
+        DxFrame& root = frames[0];
+        unsigned int logical;
+        int blockNum = appendDirBlock(dirInode, logical);
+        if (blockNum < 0) return -1;
+
+        DxFrame node;
+        initNode(node, blockNum, logical);
+        unsigned int count = root.countLimit()->count;
+        memcpy(node.entries(), root.entries(), count * sizeof(ext2_dx_entry));
+        node.countLimit()->limit = nodeLimit;
+        node.countLimit()->count = count;
+        node.at = root.at;
+        writeBlock(node.block, node.data.data());
+
+        root.countLimit()->count = 1;
+        root.entries()[0].block = logical;
+        root.at = 0;
+        reinterpret_cast<ext2_dx_root_info*>(&root.data[24])->indirect_levels = 1;
+        writeBlock(root.block, root.data.data());
+
+        frames.push_back(std::move(node));
+        return 0;
+    }
+
+    // Nó interno cheio: precisa de espaço na raiz para dividi-lo
+    DxFrame& root = frames[0];
+    if (root.countLimit()->count >= root.countLimit()->limit) return 1;
+
+    DxFrame& node = frames[1];
+    unsigned int logical;
+    int blockNum = appendDirBlock(dirInode, logical);
+    if (blockNum < 0) return -1;
+
+    // A metade de cima das entradas vai para o nó novo
+    unsigned int count = node.countLimit()->count;
+    unsigned int half = count / 2;
+    DxFrame sibling;
+    initNode(sibling, blockNum, logical);
+    memcpy(sibling.entries(), &node.entries()[half], (count - half) * sizeof(ext2_dx_entry));
+    uint32_t splitHash = node.entries()[half].hash; // Vai para a raiz
+    sibling.countLimit()->limit = nodeLimit;
+    sibling.countLimit()->count = count - half;
+    node.countLimit()->count = half;
+
+    writeBlock(sibling.block, sibling.data.data());
+    writeBlock(node.block, node.data.data());
+    dxInsertIndex(root, splitHash, logical);
+
+    // Continua no nó que contém a posição que estávamos seguindo
+    if (node.at >= half) {
+        sibling.at = node.at - half;
+        frames[1] = std::move(sibling);
+    }
+    return 0;
+}
+
+// Insere uma entrada em um diretório indexado. Se a folha estiver cheia, ela
+// é dividida ao meio (por hash) em um bloco novo, e o índice ganha uma entrada.
+// Retorna 0 em sucesso, -1 em erro e 1 se o índice não puder ser usado.
+int Ext2Shell::dxAddEntry(unsigned int dirInodeNum, ext2_inode& dirInode, unsigned int childInodeNum, const std::string& name, unsigned char fileType) {
+    std::vector<DxFrame> frames;
+    uint32_t hash;
+    if (!dxProbe(dirInode, name, hash, frames)) return 1;
+
+    unsigned int leafLogical = frames.back().entries()[frames.back().at].block & 0x0fffffff;
+    unsigned int leafBlock = getBlockNumber(dirInode, leafLogical);
+    if (leafBlock == 0) return 1;
+
+    BlockBuffer leafBuffer = blockPool.acquire();
+    char* leaf = leafBuffer.data();
+    readBlock(leafBlock, leaf);
+    if (insertDirEntryInBlock(leaf, childInodeNum, name, fileType)) {
+        writeBlock(leafBlock, leaf);
+        return 0;
+    }
+
+    // Folha cheia: abre espaço no índice para a nova folha
+    int room = dxMakeRoom(dirInode, frames);
+    if (room != 0) {
+        writeInode(dirInodeNum, &dirInode);
+        return room;
+    }
+
+    // Coleta as entradas da folha com seus hashes e ordena por hash
+    struct LeafEntry { uint32_t hash; unsigned int offset; };
+    std::vector<LeafEntry> entries;
+    unsigned char hashVersion = reinterpret_cast<ext2_dx_root_info*>(&frames[0].data[24])->hash_version;
+    for (unsigned int offset = 0; offset < blockSize; ) {
+        const ext2_dir_entry_2* entry = reinterpret_cast<const ext2_dir_entry_2*>(&leaf[offset]);
+        if (entry->rec_len == 0) break;
+        if (entry->inode != 0) {
+            entries.push_back({dxHash(std::string(entry->name, entry->name_len), hashVersion), offset});
+        }
+        offset += entry->rec_len;
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const LeafEntry& a, const LeafEntry& b) { return a.hash < b.hash; });
+
+    // Divide ao meio; se a divisão cair no meio de uma colisão, a nova folha
+    // é marcada como continuação (bit 0 do hash no índice)
+    size_t split = entries.size() / 2;
+    uint32_t splitHash = entries[split].hash;
+    uint32_t continued = (split > 0 && entries[split - 1].hash == splitHash) ? 1 : 0;
+
+    unsigned int newLogical;
+    int newBlock = appendDirBlock(dirInode, newLogical);
+    if (newBlock < 0) {
+        writeInode(dirInodeNum, &dirInode);
+        return -1;
+    }
+
+    // Reescreve as duas metades de forma compacta
+    BlockBuffer lowerBuffer = blockPool.acquire(true), upperBuffer = blockPool.acquire(true);
+    char* lower = lowerBuffer.data();
+    char* upper = upperBuffer.data();
+    auto pack = [&](char* out, size_t from, size_t to) {
+        unsigned int pos = 0;
+        ext2_dir_entry_2* last = nullptr;
+        for (size_t i = from; i < to; i++) {
+            const ext2_dir_entry_2* src = reinterpret_cast<const ext2_dir_entry_2*>(&leaf[entries[i].offset]);
+            unsigned int len = 8 + ((src->name_len + 3) & ~3);
+            ext2_dir_entry_2* dst = reinterpret_cast<ext2_dir_entry_2*>(&out[pos]);
+            memcpy(dst, src, 8 + src->name_len);
+            dst->rec_len = len;
+            last = dst;
+            pos += len;
+        }
+        if (last) {
+            last->rec_len += blockSize - pos; // A última entrada vai até o fim do bloco
+        } else {
+            reinterpret_cast<ext2_dir_entry_2*>(out)->rec_len = blockSize;
+        }
+    };
+    pack(lower, 0, split);
+    pack(upper, split, entries.size());
+
+    // A nova entrada vai para a metade correspondente ao seu hash
+    char* target = (hash < splitHash) ? lower : upper;
+    bool placed = insertDirEntryInBlock(target, childInodeNum, name, fileType);
+
+    writeBlock(leafBlock, lower);
+    writeBlock(newBlock, upper);
+    dxInsertIndex(frames.back(), splitHash | continued, newLogical);
+    writeInode(dirInodeNum, &dirInode);
+
+    return placed ? 0 : -1;
+}
+
+// Converte um diretório linear de um único bloco em indexado: o bloco 0 vira
+// a raiz do índice e as entradas (exceto '.' e '..') vão para uma folha nova.
+int Ext2Shell::dxMakeIndexed(unsigned int dirInodeNum, ext2_inode& dirInode) {
+    unsigned int rootBlock = dirInode.i_block[0];
+    BlockBuffer rootBuffer = blockPool.acquire();
+    char* root = rootBuffer.data();
+    readBlock(rootBlock, root);
+
+    unsigned int leafLogical;
+    int leafBlock = appendDirBlock(dirInode, leafLogical);
+    if (leafBlock < 0) return -1;
+
+    // Copia as entradas depois de '.' e '..' para a folha, compactando
+    BlockBuffer leafBuffer = blockPool.acquire(true);
+    char* leaf = leafBuffer.data();
+    ext2_dir_entry_2* dot = reinterpret_cast<ext2_dir_entry_2*>(root);
+    ext2_dir_entry_2* dotdot = reinterpret_cast<ext2_dir_entry_2*>(&root[dot->rec_len]);
+    unsigned int pos = 0;
+    ext2_dir_entry_2* last = nullptr;
+    for (unsigned int offset = dot->rec_len + dotdot->rec_len; offset < blockSize; ) {
+        const ext2_dir_entry_2* entry = reinterpret_cast<const ext2_dir_entry_2*>(&root[offset]);
+        if (entry->rec_len == 0) break;
+        if (entry->inode != 0) {
+            unsigned int len = 8 + ((entry->name_len + 3) & ~3);
+            last = reinterpret_cast<ext2_dir_entry_2*>(&leaf[pos]);
+            memcpy(last, entry, 8 + entry->name_len);
+            last->rec_len = len;
+            pos += len;
+        }
+        offset += entry->rec_len;
+    }
+    if (last) last->rec_len += blockSize - pos;
+    else reinterpret_cast<ext2_dir_entry_2*>(leaf)->rec_len = blockSize;
+    writeBlock(leafBlock, leaf);
+
+    // Monta a raiz: '.', '..' cobrindo o resto do bloco, dx_root_info e o índice
+    unsigned int dotdotInode = dotdot->inode;
+    memset(root, 0, blockSize);
+    dot = reinterpret_cast<ext2_dir_entry_2*>(root);
+    dot->inode = dirInodeNum;
+    dot->rec_len = 12;
+    dot->name_len = 1;
+    dot->file_type = EXT2_FT_DIR;
+    dot->name[0] = '.';
+    dotdot = reinterpret_cast<ext2_dir_entry_2*>(&root[12]);
+    dotdot->inode = dotdotInode;
+    dotdot->rec_len = blockSize - 12;
+    dotdot->name_len = 2;
+    dotdot->file_type = EXT2_FT_DIR;
+    dotdot->name[0] = dotdot->name[1] = '.';
+
+    ext2_dx_root_info* info = reinterpret_cast<ext2_dx_root_info*>(&root[24]);
+    info->hash_version = super.s_def_hash_version <= EXT2_HASH_TEA ? super.s_def_hash_version : EXT2_HASH_HALF_MD4;
+    info->info_length = 8;
+    info->indirect_levels = 0;
+    ext2_dx_countlimit* cl = reinterpret_cast<ext2_dx_countlimit*>(&root[32]);
+    cl->limit = (blockSize - 32) / sizeof(ext2_dx_entry);
+    cl->count = 1;
+    reinterpret_cast<ext2_dx_entry*>(&root[32])[0].block = leafLogical;
+    writeBlock(rootBlock, root);
+
+    dirInode.i_flags |= EXT2_INDEX_FL;
+    writeInode(dirInodeNum, &dirInode);
+    return 0;
+}
+
+// Verifica se um bit está marcado no bitmap
+bool Ext2Shell::isBitSet(unsigned char* bitmap, int bit) {
+    int bytePos = bit / 8;
+    int bitPos = bit % 8;
+    return (bitmap[bytePos] & (1 << bitPos)) != 0;
+}
+
+// Grupos não inicializados (uninit_bg): os bitmaps desses grupos não
+// existem no disco até a primeira alocação, e são montados em memória
+bool Ext2Shell::uninitGroupsEnabled() const {
+    return (super.s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_GDT_CSUM) != 0;
+}
+
+// Lê o bitmap de blocos de um grupo. Num grupo BLOCK_UNINIT, só os
+// metadados do próprio grupo estão ocupados.
+void Ext2Shell::readBlockBitmap(unsigned int group, const ext2_group_desc& groupDesc, unsigned char* bitmap) {
+    if (deferAllocation) {
+        auto cached = deferredBitmaps.find(groupDesc.bg_block_bitmap);
+        if (cached != deferredBitmaps.end()) {
+            memcpy(bitmap, cached->second.data(), blockSize);
+            return;
+        }
+    }
+    if (!uninitGroupsEnabled() || !(groupDesc.bg_flags & EXT2_BG_BLOCK_UNINIT)) {
+        readBlock(groupDesc.bg_block_bitmap, bitmap);
+        return;
+    }
+
+    memset(bitmap, 0, blockSize);
+    unsigned int first = group * super.s_blocks_per_group + super.s_first_data_block;
+    unsigned int groupBlocks = blocksInGroup(group);
+    auto mark = [&](unsigned int block) {
+        if (block >= first && block - first < groupBlocks) {
+            bitmap[(block - first) / 8] |= 1 << ((block - first) % 8);
+        }
+    };
+    if (groupHasSuper(group, super.s_feature_ro_compat)) {
+        unsigned int gdtBlocks = (groupCount() * sizeof(ext2_group_desc) + blockSize - 1) / blockSize;
+        for (unsigned int b = 0; b < 1 + gdtBlocks + super.s_reserved_gdt_blocks; b++) mark(first + b);
+    }
+    mark(groupDesc.bg_block_bitmap);
+    mark(groupDesc.bg_inode_bitmap);
+    unsigned int tableBlocks = (super.s_inodes_per_group * inodeSize + blockSize - 1) / blockSize;
+    for (unsigned int b = 0; b < tableBlocks; b++) mark(groupDesc.bg_inode_table + b);
+    // Bits além do fim do grupo ficam marcados, como no disco
+    for (unsigned int i = groupBlocks; i < blockSize * 8; i++) bitmap[i / 8] |= 1 << (i % 8);
+}
+
+// Grava o bitmap de blocos; o grupo deixa de ser não inicializado. Quem
+// chama grava o descritor em seguida.
+void Ext2Shell::writeBlockBitmap(ext2_group_desc& groupDesc, const unsigned char* bitmap) {
+    if (deferAllocation) {
+        deferredBitmaps[groupDesc.bg_block_bitmap].assign(bitmap, bitmap + blockSize);
+    } else {
+        writeBlock(groupDesc.bg_block_bitmap, bitmap);
+    }
+    groupDesc.bg_flags &= ~EXT2_BG_BLOCK_UNINIT;
+}
+
+// Lê o bitmap de inodes de um grupo. Num grupo INODE_UNINIT, todos estão livres.
+void Ext2Shell::readInodeBitmap(const ext2_group_desc& groupDesc, unsigned char* bitmap) {
+    if (deferAllocation) {
+        auto cached = deferredBitmaps.find(groupDesc.bg_inode_bitmap);
+        if (cached != deferredBitmaps.end()) {
+            memcpy(bitmap, cached->second.data(), blockSize);
+            return;
+        }
+    }
+    if (!uninitGroupsEnabled() || !(groupDesc.bg_flags & EXT2_BG_INODE_UNINIT)) {
+        readBlock(groupDesc.bg_inode_bitmap, bitmap);
+        return;
+    }
+
+    memset(bitmap, 0, blockSize);
+    for (unsigned int i = super.s_inodes_per_group; i < blockSize * 8; i++) bitmap[i / 8] |= 1 << (i % 8);
+}
+
+// Grava o bitmap de inodes; o grupo deixa de ser não inicializado. Quem
+// chama grava o descritor em seguida.
+void Ext2Shell::writeInodeBitmap(ext2_group_desc& groupDesc, const unsigned char* bitmap) {
+    if (deferAllocation) {
+        deferredBitmaps[groupDesc.bg_inode_bitmap].assign(bitmap, bitmap + blockSize);
+    } else {
+        writeBlock(groupDesc.bg_inode_bitmap, bitmap);
+    }
+    groupDesc.bg_flags &= ~EXT2_BG_INODE_UNINIT;
+}
+
+// Alocação adiada: a partir daqui, descritores de grupo, bitmaps e
+// superbloco só mudam em memória. Serve para operações que alocam muitos
+// inodes e blocos seguidos (import-tar), que assim gravam cada bitmap e
+// descritor uma única vez, no fim.
+void Ext2Shell::beginDeferredAllocation() {
+    unsigned int numGroups = groupCount();
+    deferredGroups.resize(numGroups);
+    for (unsigned int group = 0; group < numGroups; group++) {
+        readGroupDesc(group, &deferredGroups[group]);
+    }
+    deferredGroupsDirty.assign(numGroups, false);
+    deferredBitmaps.clear();
+    deferredSuperDirty = false;
+    deferAllocation = true;
+}
+
+// Grava os bitmaps, descritores e superbloco alterados desde
+// beginDeferredAllocation() e volta ao modo normal
+void Ext2Shell::endDeferredAllocation() {
+    if (!deferAllocation) return;
+    deferAllocation = false;
+    for (const auto& bitmap : deferredBitmaps) {
+        writeBlock(bitmap.first, bitmap.second.data());
+    }
+    for (unsigned int group = 0; group < deferredGroups.size(); group++) {
+        if (deferredGroupsDirty[group]) writeGroupDesc(group, &deferredGroups[group]);
+    }
+    if (deferredSuperDirty) writeSuperBlock();
+    deferredBitmaps.clear();
+    deferredGroups.clear();
+    deferredGroupsDirty.clear();
+}
+
+// Procura um inode livre em todos os grupos
+int Ext2Shell::findFreeInode() {
+    unsigned int numGroups = (super.s_inodes_count + super.s_inodes_per_group - 1) / super.s_inodes_per_group;
+    // Percorre todos os grupos de inodes
+    for (unsigned int group = 0; group < numGroups; ++group) {
+        ext2_group_desc groupDesc;
+        readGroupDesc(group, &groupDesc);
+        // Se o grupo não tem inodes livres, pula para o próximo
+        if (groupDesc.bg_free_inodes_count > 0) {
+            BlockBuffer bitmapBuffer = blockPool.acquire();
+            unsigned char* bitmap = bitmapBuffer.as<unsigned char>();
+            readInodeBitmap(groupDesc, bitmap);
+            // Procura o primeiro bit não marcado (inode livre) no bitmap do grupo
+            int bit = dispatchBlockSize(blockSize, [&](auto size) {
+                return findFirstZeroBit<decltype(size)::value>(bitmap, blockSize, super.s_inodes_per_group);
+            });
+            if (bit >= 0) {
+                return group * super.s_inodes_per_group + bit + 1;
+            }
+        }
+    }
+    return -1; // Nenhum inode livre em nenhum grupo
+}
+
+// Procura um bloco livre em todos os grupos
+int Ext2Shell::findFreeBlock() {
+    unsigned int numGroups = groupCount();
+    // Percorre todos os grupos de blocos
+    for (unsigned int group = 0; group < numGroups; ++group) {
+        ext2_group_desc groupDesc;
+        readGroupDesc(group, &groupDesc);
+        // Se o grupo não tem blocos livres, pula para o próximo
+        if (groupDesc.bg_free_blocks_count > 0) {
+            BlockBuffer bitmapBuffer = blockPool.acquire();
+            unsigned char* bitmap = bitmapBuffer.as<unsigned char>();
+            readBlockBitmap(group, groupDesc, bitmap);
+            // Procura o primeiro bloco livre do grupo (o último grupo pode ser menor)
+            unsigned int groupBlocks = blocksInGroup(group);
+            int bit = dispatchBlockSize(blockSize, [&](auto size) {
+                return findFirstZeroBit<decltype(size)::value>(bitmap, blockSize, groupBlocks);
+            });
+            if (bit >= 0) {
+                return group * super.s_blocks_per_group + bit + super.s_first_data_block;
+            }
+        }
+    }
+    return -1; // Nenhum bloco livre em nenhum grupo
+}
+
+// Aloca um inode: marca bit no bitmap, atualiza contadores, retorna número do inode alocado
+int Ext2Shell::allocateInode() {
+    int inodeNum = findFreeInode(); // procura inode livre
+    if (inodeNum < 0) return -1;    // não encontrou inode livre
+    forgetSymlink(inodeNum);        // O número pode ter sido de um link apagado
+
+    // O inode livre pode estar em qualquer grupo, não só no do diretório atual
+    unsigned int group = (inodeNum - 1) / super.s_inodes_per_group;
+    ext2_group_desc groupDesc;
+    readGroupDesc(group, &groupDesc);
+
+    BlockBuffer bitmapBuffer = blockPool.acquire();
+    unsigned char* bitmap = bitmapBuffer.as<unsigned char>();
+    readInodeBitmap(groupDesc, bitmap); // lê bitmap do grupo
+
+    int bit = (inodeNum - 1) % super.s_inodes_per_group; // bit relativo ao grupo
+    int bytePos = bit / 8;
+    int bitPos = bit % 8;
+
+    bitmap[bytePos] |= (1 << bitPos);  // marca bit como ocupado
+    writeInodeBitmap(groupDesc, bitmap); // salva bitmap atualizado
+
+    // Inodes além do último usado na tabela podem nunca ter sido zerados;
+    // o contador de não usados passa a excluir o inode recém-alocado
+    if (uninitGroupsEnabled() && (unsigned int)bit >= super.s_inodes_per_group - groupDesc.bg_itable_unused) {
+        groupDesc.bg_itable_unused = super.s_inodes_per_group - bit - 1;
+    }
+
+    // Atualiza contadores de inodes livres no superbloco e no grupo
+    super.s_free_inodes_count--;
+    groupDesc.bg_free_inodes_count--;
+
+    // Escreve superbloco atualizado no disco
+    writeSuperBlock();
+
+    // Atualiza o grupo no disco
+    writeGroupDesc(group, &groupDesc);
+    if (group == currentGroupNum) currentGroupDesc = groupDesc;
+
+    // Zera a entrada inteira na tabela: com inodes de 256 bytes, a parte
+    // estendida não é coberta pela struct e pode guardar lixo de um uso anterior
+    std::vector<char> zeros(inodeSize, 0);
+    if (!writeImage(inodeOffset(inodeNum), zeros.data(), inodeSize)) {
+        throw std::runtime_error("Error: Could not clear inode " + std::to_string(inodeNum) + ".");
+    }
+
+    return inodeNum; // retorna número do inode alocado
+}
+
+// Aloca um bloco: marca bit no bitmap, atualiza contadores, retorna número do bloco alocado
+int Ext2Shell::allocateBlock() {
+    int blockNum = findFreeBlock(); // procura bloco livre
+    if (blockNum < 0) return -1;    // não encontrou bloco livre
+
+    // O bloco livre pode estar em qualquer grupo, não só no do diretório atual
+    unsigned int group = (blockNum - super.s_first_data_block) / super.s_blocks_per_group;
+    ext2_group_desc groupDesc;
+    readGroupDesc(group, &groupDesc);
+
+    BlockBuffer bitmapBuffer = blockPool.acquire();
+    unsigned char* bitmap = bitmapBuffer.as<unsigned char>();
+    readBlockBitmap(group, groupDesc, bitmap); // lê bitmap do grupo
+
+    int bit = (blockNum - super.s_first_data_block) % super.s_blocks_per_group; // bit relativo ao grupo
+    int bytePos = bit / 8;
+    int bitPos = bit % 8;
+
+    bitmap[bytePos] |= (1 << bitPos);  // marca bit como ocupado
+    writeBlockBitmap(groupDesc, bitmap); // salva bitmap atualizado
+
+    // Atualiza contadores de blocos livres no superbloco e no grupo
+    super.s_free_blocks_count--;
+    groupDesc.bg_free_blocks_count--;
+
+    // Escreve superbloco atualizado no disco
+    writeSuperBlock();
+
+    // Atualiza o grupo no disco
+    writeGroupDesc(group, &groupDesc);
+    if (group == currentGroupNum) currentGroupDesc = groupDesc;
+
+    return blockNum; // retorna número do bloco alocado
+}
+
+// Libera um inode no grupo correto
+void Ext2Shell::freeInode(unsigned int inodeNum) {
+    if (inodeNum == 0) return;
     // Calcula em qual grupo este inode realmente está
     unsigned int group = (inodeNum - 1) / super.s_inodes_per_group;
     // Lê o descritor do grupo correto
     ext2_group_desc groupDesc;
     readGroupDesc(group, &groupDesc);
     // Lê e modifica o bitmap do grupo correto
-    unsigned char bitmap[blockSize];
-    readBlock(groupDesc.bg_inode_bitmap, bitmap);
+    BlockBuffer bitmapBuffer = blockPool.acquire();
+    unsigned char* bitmap = bitmapBuffer.as<unsigned char>();
+    readInodeBitmap(groupDesc, bitmap);
     int bit = (inodeNum - 1) % super.s_inodes_per_group;
     bitmap[bit / 8] &= ~(1 << (bit % 8)); // Limpa o bit
-    writeBlock(groupDesc.bg_inode_bitmap, bitmap);
+    writeInodeBitmap(groupDesc, bitmap);
     // Atualiza os contadores do superbloco e do grupo correto
     super.s_free_inodes_count++;
     groupDesc.bg_free_inodes_count++;
@@ -498,8 +2775,7 @@ void Ext2Shell::freeInode(unsigned int inodeNum) {
         groupDesc.bg_used_dirs_count--;
     }
     // Salva os metadados atualizados.
-    lseek(fd, BASE_OFFSET, SEEK_SET);
-    write(fd, &super, sizeof(super));
+    writeSuperBlock();
     writeGroupDesc(group, &groupDesc);
 }
 
@@ -508,866 +2784,4254 @@ void Ext2Shell::freeBlock(unsigned int blockNum) {
     if (blockNum == 0) return;
 
     // Calcula em qual grupo este bloco realmente está
-    unsigned int group = (blockNum - 1) / super.s_blocks_per_group; 
+    unsigned int group = (blockNum - super.s_first_data_block) / super.s_blocks_per_group; 
     // Lê o descritor do grupo correto
     ext2_group_desc groupDesc;
     readGroupDesc(group, &groupDesc);
     // Lê e modifica o bitmap do grupo correto.
-    unsigned char bitmap[blockSize];
-    readBlock(groupDesc.bg_block_bitmap, bitmap);
-    int bit = (blockNum - 1) % super.s_blocks_per_group;
+    BlockBuffer bitmapBuffer = blockPool.acquire();
+    unsigned char* bitmap = bitmapBuffer.as<unsigned char>();
+    readBlockBitmap(group, groupDesc, bitmap);
+    int bit = (blockNum - super.s_first_data_block) % super.s_blocks_per_group;
     bitmap[bit / 8] &= ~(1 << (bit % 8)); // Limpa o bit
-    writeBlock(groupDesc.bg_block_bitmap, bitmap);
+    writeBlockBitmap(groupDesc, bitmap);
     // Atualiza os contadores do superbloco e do grupo correto.
     super.s_free_blocks_count++;
     groupDesc.bg_free_blocks_count++;
     // Salva os metadados atualizados.
-    lseek(fd, BASE_OFFSET, SEEK_SET);
-    write(fd, &super, sizeof(super));
+    writeSuperBlock();
     writeGroupDesc(group, &groupDesc);
 }
 
-std::string formatPermissions(unsigned short mode) {
-    std::string p;
-    // Determine file type
-    if (S_ISDIR(mode)) p += 'd';
-    else if (S_ISREG(mode)) p += 'f';
-    else if (S_ISLNK(mode)) p += 'l';
-    else p += '?';
+// Libera vários blocos de uma vez: ordena a lista e faz uma única
+// leitura/escrita de bitmap e de descritor por grupo, e uma única escrita do
+// superbloco. Só conta bits que estavam realmente marcados, para que reprocessar
+// um órfão interrompido não corrompa os contadores.
+void Ext2Shell::freeBlocks(std::vector<unsigned int>& blocks) {
+    std::sort(blocks.begin(), blocks.end());
+
+    BlockBuffer bitmapBuffer = blockPool.acquire();
+    unsigned char* bitmap = bitmapBuffer.as<unsigned char>();
+    unsigned int freed = 0;
+    size_t i = 0;
+    while (i < blocks.size()) {
+        if (blocks[i] == 0) { i++; continue; }
+
+        unsigned int group = (blocks[i] - super.s_first_data_block) / super.s_blocks_per_group;
+        ext2_group_desc groupDesc;
+        readGroupDesc(group, &groupDesc);
+        readBlockBitmap(group, groupDesc, bitmap);
+
+        // Limpa todos os bits deste grupo
+        unsigned int groupFreed = 0;
+        for (; i < blocks.size() && (blocks[i] - super.s_first_data_block) / super.s_blocks_per_group == group; i++) {
+            int bit = (blocks[i] - super.s_first_data_block) % super.s_blocks_per_group;
+            if (isBitSet(bitmap, bit)) {
+                bitmap[bit / 8] &= ~(1 << (bit % 8));
+                groupFreed++;
+            }
+        }
 
-    // User permissions
-    p += (mode & S_IRUSR) ? 'r' : '-';
-    p += (mode & S_IWUSR) ? 'w' : '-';
-    p += (mode & S_IXUSR) ? 'x' : '-';
-    // Group permissions
-    p += (mode & S_IRGRP) ? 'r' : '-';
-    p += (mode & S_IWGRP) ? 'w' : '-';
-    p += (mode & S_IXGRP) ? 'x' : '-';
-    // Other permissions
-    p += (mode & S_IROTH) ? 'r' : '-';
-    p += (mode & S_IWOTH) ? 'w' : '-';
-    p += (mode & S_IXOTH) ? 'x' : '-';
-    
-    return p;
+        writeBlockBitmap(groupDesc, bitmap);
+        groupDesc.bg_free_blocks_count += groupFreed;
+        writeGroupDesc(group, &groupDesc);
+        freed += groupFreed;
+    }
+
+    super.s_free_blocks_count += freed;
+    writeSuperBlock();
 }
 
-std::string formatSize(unsigned int size) {
-    std::stringstream ss;
-    double s = static_cast<double>(size);
-    ss << std::fixed << std::setprecision(1);
+// Marca como ocupados 'count' blocos contíguos a partir de 'first', com uma
+// leitura/escrita de bitmap por grupo e uma escrita do superbloco
+void Ext2Shell::allocateRun(unsigned int first, unsigned int count) {
+    BlockBuffer bitmapBuffer = blockPool.acquire();
+    unsigned char* bitmap = bitmapBuffer.as<unsigned char>();
+    unsigned int blockNum = first;
+    unsigned int end = first + count;
+    while (blockNum < end) {
+        unsigned int group = (blockNum - super.s_first_data_block) / super.s_blocks_per_group;
+        ext2_group_desc groupDesc;
+        readGroupDesc(group, &groupDesc);
+        readBlockBitmap(group, groupDesc, bitmap);
+
+        unsigned int groupEnd = std::min(end, (group + 1) * super.s_blocks_per_group + super.s_first_data_block);
+        unsigned int marked = 0;
+        for (; blockNum < groupEnd; blockNum++) {
+            int bit = (blockNum - super.s_first_data_block) % super.s_blocks_per_group;
+            if (!isBitSet(bitmap, bit)) {
+                bitmap[bit / 8] |= (1 << (bit % 8));
+                marked++;
+            }
+        }
 
-    if (s < 1024) {
-        ss << std::setprecision(0) << s << " B";
-    } else if (s < 1024 * 1024) {
-        ss << (s / 1024.0) << " KiB";
-    } else if (s < 1024 * 1024 * 1024) {
-        ss << (s / (1024.0 * 1024.0)) << " MiB";
-    } else {
-        ss << (s / (1024.0 * 1024.0 * 1024.0)) << " GiB";
+        writeBlockBitmap(groupDesc, bitmap);
+        groupDesc.bg_free_blocks_count -= marked;
+        writeGroupDesc(group, &groupDesc);
+        if (group == currentGroupNum) currentGroupDesc = groupDesc;
+        super.s_free_blocks_count -= marked;
     }
-    return ss.str();
+    writeSuperBlock();
 }
 
+// Reserva 'count' blocos procurando a partir de 'goal' e dando a volta no fim
+// do FS. Primeiro tenta um trecho contíguo que caiba tudo; se não houver, junta
+// só trechos de pelo menos RESERVE_MIN_RUN blocos e, por fim, quaisquer trechos
+// livres, na ordem em que aparecem. Os trechos são medidos 64 bits por vez nos
+// bitmaps (em cache durante a alocação adiada). Os trechos (início, tamanho)
+// vão para 'extents' já marcados como ocupados. Retorna -1 se faltar espaço.
+int Ext2Shell::reserveBlocks(unsigned int count, unsigned int goal,
+                             std::vector<std::pair<unsigned int, unsigned int>>& extents) {
+    extents.clear();
+    if (count == 0) return 0;
+    if (count > super.s_free_blocks_count) return -1;
+    if (goal < super.s_first_data_block || goal >= super.s_blocks_count) goal = super.s_first_data_block;
+
+    const unsigned int numGroups = groupCount();
+    const unsigned int goalGroup = (goal - super.s_first_data_block) / super.s_blocks_per_group;
+    const unsigned int goalBit = (goal - super.s_first_data_block) % super.s_blocks_per_group;
+    BlockBuffer bitmapBuffer = blockPool.acquire();
+    unsigned char* bitmap = bitmapBuffer.as<unsigned char>();
+
+    // Percorre os trechos livres a partir de goal, aceitando só os de pelo
+    // menos 'minRun' blocos (ou o que ainda falta, se for menos)
+    auto scan = [&](unsigned int minRun) {
+        unsigned int needed = count;
+        for (unsigned int n = 0; n <= numGroups && needed > 0; n++) {
+            unsigned int group = (goalGroup + n) % numGroups;
+            ext2_group_desc groupDesc;
+            readGroupDesc(group, &groupDesc);
+            if (groupDesc.bg_free_blocks_count < std::min(minRun, needed)) continue;
+            readBlockBitmap(group, groupDesc, bitmap);
+
+            // Na volta completa, o grupo de goal só é visto até goal
+            unsigned int bit = (n == 0) ? goalBit : 0;
+            unsigned int end = (n == numGroups) ? goalBit : blocksInGroup(group);
+            while (needed > 0) {
+                unsigned int runStart = findBitmapBit(bitmap, bit, end, false);
+                if (runStart >= end) break;
+                bit = findBitmapBit(bitmap, runStart, std::min(end, runStart + needed), true);
+                unsigned int runLength = bit - runStart;
+                if (runLength < std::min(minRun, needed)) continue;
+                extents.emplace_back(group * super.s_blocks_per_group + runStart + super.s_first_data_block, runLength);
+                needed -= runLength;
+            }
+        }
+        return needed == 0;
+    };
 
-std::string formatTime(uint32_t timestamp) {
-    time_t raw_time = timestamp;
-    struct tm* timeinfo = localtime(&raw_time);
-    char buffer[80];
-    strftime(buffer, sizeof(buffer), "%d/%m/%Y %H:%M", timeinfo);
-    return std::string(buffer);
+    bool found = false;
+    for (unsigned int minRun : { count, std::min(count, (unsigned int)RESERVE_MIN_RUN), 1u }) {
+        extents.clear();
+        if ((found = scan(minRun))) break;
+    }
+    if (!found) {
+        extents.clear();
+        return -1;
+    }
+    for (const auto& extent : extents) {
+        allocateRun(extent.first, extent.second);
+    }
+    return 0;
 }
 
-
-// Lista os arquivos e diretórios no diretório atual
-void Ext2Shell::cmd_ls() {
-    forEachDirEntry(currentInodeNum, [](ext2_dir_entry_2* entry) {
-        std::string name(entry->name, entry->name_len);
-        std::cout << name << std::endl;
-        std::cout << "inode: " << entry->inode << std::endl;
-        std::cout << "record length: " << entry->rec_len << std::endl;
-        std::cout << "name lenght: " << static_cast<int>(entry->name_len) << std::endl;
-        std::cout << "file type: " << static_cast<int>(entry->file_type) << std::endl;
-        std::cout << std::endl;
-        return true;
-    });
+// Número de blocos de um grupo (o último pode ser menor)
+unsigned int Ext2Shell::blocksInGroup(unsigned int group) {
+    unsigned int first = group * super.s_blocks_per_group + super.s_first_data_block;
+    return std::min(super.s_blocks_per_group, super.s_blocks_count - first);
 }
 
-// Muda o diretório atual para o especificado
-void Ext2Shell::cmd_cd(const std::string& path) {
-    if (path == "..") {
-        if (!currentPath.empty()) {
-            currentPath.pop_back();
-            // Refaz o caminho desde a raiz para encontrar o inode
-            unsigned int newInodeNum = EXT2_ROOT_INO;
-            // salva o estado atual
-            auto tempPath = currentPath; 
-            currentPath.clear();
-            updateCurrentDirectory(newInodeNum);
-            // navega até o novo diretório
-            for(const auto& dir : tempPath){
-                cmd_cd(dir);
+// Escreve 'count' blocos contíguos de uma vez só
+void Ext2Shell::writeBlockRun(unsigned int first, unsigned int count, const void* buffer) {
+    if (journalFd >= 0) {
+        // Os dados vão direto para a imagem, fora do diário. Antes, as
+        // transações fechadas precisam estar gravadas: blocos liberados nelas
+        // podem estar sendo reaproveitados aqui.
+        journalFlush();
+        bool inJournal = false;
+        for (unsigned int i = 0; i < count; i++) {
+            if (txnBlocks.count(first + i)) {
+                // Bloco já alterado nesta transação: segue por ela
+                writeBlock(first + i, static_cast<const char*>(buffer) + (size_t)i * blockSize);
+                continue;
             }
+            if (journaledBlocks.count(first + i)) inJournal = true;
+        }
+        // Uma reaplicação do diário traria de volta o conteúdo antigo
+        if (inJournal) journalCheckpoint();
+    }
+
+    size_t length = (size_t)count * blockSize;
+    if (!diskWrite(block_offset(first, blockSize), buffer, length)) {
+        throw std::runtime_error("Error: Could not write blocks starting at " + std::to_string(first) + ".");
+    }
+}
+
+// Coleta um bloco de ponteiros com 'depth' níveis e tudo o que está abaixo dele
+// (nível por nível, lendo todas as tabelas de um nível em um único lote)
+void Ext2Shell::collectTreeBlocks(unsigned int blockNum, int depth, std::vector<unsigned int>& blocks) {
+    if (blockNum == 0) return;
+    blocks.push_back(blockNum);
+
+    const unsigned int perBlock = blockSize / sizeof(unsigned int);
+    std::vector<unsigned int> level = {blockNum};
+    for (; depth > 0 && !level.empty(); depth--) {
+        std::vector<unsigned int> tables(level.size() * perBlock);
+        readBlocks(level, reinterpret_cast<char*>(tables.data()));
+        level.clear();
+        for (unsigned int child : tables) {
+            if (child == 0) continue;
+            blocks.push_back(child);
+            level.push_back(child);
+        }
+    }
+}
+
+// Coleta todos os blocos (dados e ponteiros) referenciados por um inode.
+// Um link simbólico rápido guarda texto em i_block e um dispositivo guarda
+// o seu número: nenhum dos dois tem ponteiros para blocos.
+void Ext2Shell::collectInodeBlocks(const ext2_inode& inode, std::vector<unsigned int>& blocks) {
+    bool hasBlocks = S_ISREG(inode.i_mode) || S_ISDIR(inode.i_mode) || (S_ISLNK(inode.i_mode) && inode.i_blocks != 0);
+    if (!hasBlocks) return;
+    for (int i = 0; i < 12; i++) {
+        collectTreeBlocks(inode.i_block[i], 0, blocks);
+    }
+    collectTreeBlocks(inode.i_block[12], 1, blocks); // Indireto simples
+    collectTreeBlocks(inode.i_block[13], 2, blocks); // Indireto duplo
+    collectTreeBlocks(inode.i_block[14], 3, blocks); // Indireto triplo
+}
+
+// Libera todos os blocos de dados com índice lógico >= firstLogical e os
+// blocos de ponteiros que ficarem vazios, em uma única chamada de freeBlocks.
+// Atualiza i_block/i_blocks na cópia em memória; quem chama grava o inode.
+// Retorna quantos blocos foram liberados.
+unsigned int Ext2Shell::truncateBlocks(ext2_inode& inode, unsigned int firstLogical) {
+    const unsigned int perBlock = blockSize / sizeof(unsigned int);
+    std::vector<unsigned int> toFree;
+
+    for (unsigned int i = firstLogical; i < 12; i++) {
+        if (inode.i_block[i] == 0) continue;
+        toFree.push_back(inode.i_block[i]);
+        inode.i_block[i] = 0;
+    }
+
+    // Poda uma subárvore que cobre os blocos lógicos a partir de 'start',
+    // 'span' por ponteiro. Retorna true se o próprio bloco foi para toFree.
+    std::function<bool(unsigned int, int, unsigned int, unsigned int)> prune =
+        [&](unsigned int blockNum, int depth, unsigned int start, unsigned int span) {
+        if (start >= firstLogical) {
+            collectTreeBlocks(blockNum, depth, toFree); // Subárvore inteira sai
+            return true;
+        }
+
+        BlockBuffer pointerBuffer = blockPool.acquire();
+        unsigned int* pointers = pointerBuffer.as<unsigned int>();
+        readBlock(blockNum, pointers);
+        bool changed = false;
+        bool empty = true;
+        for (unsigned int i = 0; i < perBlock; i++) {
+            if (pointers[i] == 0) continue;
+            unsigned int childStart = start + i * span;
+            if (childStart + span > firstLogical) {
+                bool released = (depth == 1) ? (toFree.push_back(pointers[i]), true)
+                                             : prune(pointers[i], depth - 1, childStart, span / perBlock);
+                if (released) {
+                    pointers[i] = 0;
+                    changed = true;
+                    continue;
+                }
+            }
+            empty = false;
+        }
+
+        if (empty) {
+            toFree.push_back(blockNum);
+            return true;
+        }
+        if (changed) writeBlock(blockNum, pointers);
+        return false;
+    };
+
+    unsigned int logical = 12;
+    unsigned int span = 1;
+    for (int depth = 1; depth <= 3; depth++) {
+        unsigned int& top = inode.i_block[11 + depth];
+        if (top != 0 && prune(top, depth, logical, span)) {
+            top = 0;
+        }
+        span *= perBlock;
+        logical += span;
+    }
+
+    unsigned int freed = toFree.size();
+    freeBlocks(toFree);
+    inode.i_blocks -= std::min(inode.i_blocks, freed * (blockSize / 512));
+    return freed;
+}
+
+// Coloca um inode (já sem nenhuma entrada de diretório) na lista de órfãos do
+// superbloco. Como no ext3, o i_dtime do órfão guarda o próximo da lista.
+void Ext2Shell::orphanAdd(unsigned int inodeNum, ext2_inode& inode) {
+    inode.i_dtime = super.s_last_orphan;
+    writeInode(inodeNum, &inode);
+
+    super.s_last_orphan = inodeNum;
+    writeSuperBlock();
+}
+
+// Libera até 'maxInodes' órfãos a partir do início da lista, juntando os
+// blocos de todos eles em uma única chamada de freeBlocks. Cada inode é
+// desligado dos seus blocos e gravado antes de os blocos voltarem ao bitmap:
+// se o processo cair no meio, o órfão que continua na lista não aponta para
+// blocos que outro arquivo já pode ter recebido.
+// Deve ser chamada com fsMutex adquirida.
+void Ext2Shell::reapOrphans(unsigned int maxInodes) {
+    if (super.s_last_orphan == 0) return;
+
+    std::vector<unsigned int> inodes;
+    std::vector<unsigned int> blocks;
+
+    unsigned int inodeNum = super.s_last_orphan;
+    while (inodeNum != 0 && inodes.size() < maxInodes) {
+        if (inodeNum > super.s_inodes_count) {
+            std::cerr << "Warning: Invalid orphan inode " << inodeNum << ", dropping orphan list." << std::endl;
+            inodeNum = 0;
+            break;
+        }
+        ext2_inode inode;
+        readInode(inodeNum, &inode);
+        size_t before = blocks.size();
+        collectInodeBlocks(inode, blocks);
+        if (blocks.size() > before) {
+            memset(inode.i_block, 0, sizeof(inode.i_block));
+            inode.i_blocks = 0;
+            writeInode(inodeNum, &inode);
+        }
+        inodes.push_back(inodeNum);
+        inodeNum = inode.i_dtime; // Próximo órfão
+    }
+
+    freeBlocks(blocks);
+
+    BlockBuffer bitmapBuffer = blockPool.acquire();
+    unsigned char* bitmap = bitmapBuffer.as<unsigned char>();
+    for (unsigned int num : inodes) {
+        ext2_inode inode;
+        readInode(num, &inode);
+        inode.i_dtime = time(nullptr);
+        writeInode(num, &inode);
+
+        // Confere o bitmap para não liberar duas vezes um órfão interrompido
+        ext2_group_desc groupDesc;
+        readGroupDesc((num - 1) / super.s_inodes_per_group, &groupDesc);
+        readInodeBitmap(groupDesc, bitmap);
+        if (isBitSet(bitmap, (num - 1) % super.s_inodes_per_group)) {
+            freeInode(num);
+        }
+    }
+
+    // Retira o lote processado do início da lista
+    super.s_last_orphan = inodeNum;
+    writeSuperBlock();
+}
+
+// Laço da thread de fundo: dorme até haver órfãos e os libera em lotes,
+// soltando a trava entre um lote e outro para não travar o shell. Também
+// faz o commit em grupo do diário quando o prazo se esgota sem que o
+// limite de transações tenha sido atingido. Um lote que falha é registrado
+// e só é tentado de novo quando o início da lista de órfãos mudar.
+void Ext2Shell::reaperLoop() {
+    std::unique_lock<std::mutex> lock(fsMutex);
+    unsigned int failedOrphan = 0; // Início da lista no último lote que falhou
+    auto hasOrphans = [this, &failedOrphan] {
+        return super.s_last_orphan != 0 && super.s_last_orphan != failedOrphan;
+    };
+    auto hasWork = [this, &hasOrphans] { return reaperStop || hasOrphans(); };
+    while (true) {
+        if (journalPending > 0) {
+            if (!reaperCv.wait_for(lock, std::chrono::milliseconds(JOURNAL_COMMIT_MS), hasWork)) {
+                try {
+                    journalFlush();
+                } catch (const std::exception& e) {
+                    std::cerr << "Caught exception while committing the journal: " << e.what() << std::endl;
+                }
+                continue;
+            }
+        } else {
+            reaperCv.wait(lock, hasWork);
+        }
+        if (!hasOrphans()) {
+            return; // reaperStop e nada pendente
+        }
+        try {
+            reapOrphans(16);
+            journalCommit();
+        } catch (const std::exception& e) {
+            std::cerr << "Caught exception while freeing orphans: " << e.what() << std::endl;
+            journalAbort();
+            failedOrphan = super.s_last_orphan;
+        }
+
+        lock.unlock();
+        std::this_thread::yield();
+        lock.lock();
+    }
+}
+
+// --- Diário de metadados ---
+
+// CRC-32 (polinômio 0xEDB88320) dos registros do diário
+static uint32_t journalChecksum(const char* data, size_t length) {
+    static uint32_t table[256];
+    static bool ready = false;
+    if (!ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        ready = true;
+    }
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+// Cabeçalho de cada transação no arquivo de diário. Em seguida vêm 'count'
+// números de bloco (u32) e as imagens completas desses blocos.
+struct JournalHeader {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t count;
+    uint32_t checksum; // CRC-32 do registro inteiro, calculado com este campo zerado
+};
+
+// Imagem de um bloco na transação aberta; na primeira alteração ela parte
+// do conteúdo mais recente (transação fechada ou disco)
+std::vector<char>& Ext2Shell::journalTxnBlock(unsigned int block) {
+    auto found = txnBlocks.find(block);
+    if (found != txnBlocks.end()) return found->second;
+
+    std::vector<char> image(blockSize);
+    auto committed = committedBlocks.find(block);
+    if (committed != committedBlocks.end()) {
+        image = committed->second;
+    } else if (!diskRead(block_offset(block, blockSize), image.data(), blockSize)) {
+        throw std::runtime_error("Error: Could not read block " + std::to_string(block) + ".");
+    }
+    return txnBlocks.emplace(block, std::move(image)).first->second;
+}
+
+// Reaplica na imagem as transações completas deixadas no diário por uma
+// execução interrompida. Um registro truncado ou com checksum inválido marca
+// o fim do diário: a transação dele nunca foi confirmada.
+void Ext2Shell::journalReplay() {
+    int jfd = open(journalPath.c_str(), O_RDONLY);
+    if (jfd < 0) return;
+
+    struct stat st;
+    std::vector<char> log;
+    if (fstat(jfd, &st) == 0 && st.st_size > 0) {
+        log.resize(st.st_size);
+        if (pread(jfd, log.data(), log.size(), 0) != (ssize_t)log.size()) {
+            close(jfd);
+            throw std::runtime_error("Error: Could not read journal file '" + journalPath + "'.");
+        }
+    }
+    close(jfd);
+
+    size_t pos = 0;
+    unsigned int replayed = 0;
+    while (pos + sizeof(JournalHeader) <= log.size()) {
+        JournalHeader header;
+        memcpy(&header, &log[pos], sizeof(header));
+        if (header.magic != JOURNAL_MAGIC) break;
+        if (replayed > 0 && header.sequence != journalSequence + 1) break;
+
+        size_t recordSize = sizeof(header) + (size_t)header.count * (sizeof(uint32_t) + blockSize);
+        if (header.count == 0 || recordSize > log.size() - pos) break;
+
+        uint32_t checksum = header.checksum;
+        memset(&log[pos + offsetof(JournalHeader, checksum)], 0, sizeof(uint32_t));
+        if (journalChecksum(&log[pos], recordSize) != checksum) break;
+
+        const char* numbers = &log[pos + sizeof(header)];
+        const char* images = numbers + (size_t)header.count * sizeof(uint32_t);
+        for (uint32_t i = 0; i < header.count; i++) {
+            uint32_t block;
+            memcpy(&block, numbers + i * sizeof(uint32_t), sizeof(block));
+            if (block >= super.s_blocks_count) {
+                throw std::runtime_error("Error: Journal references block " + std::to_string(block) + " outside the image.");
+            }
+            if (!diskWrite(block_offset(block, blockSize), images + (size_t)i * blockSize, blockSize)) {
+                throw std::runtime_error("Error: Could not write block " + std::to_string(block) + ".");
+            }
+        }
+
+        journalSequence = header.sequence;
+        replayed++;
+        pos += recordSize;
+    }
+
+    if (!diskSync()) {
+        throw std::runtime_error("Error: Could not sync the image after journal replay.");
+    }
+    if (replayed > 0) {
+        std::cout << "Journal: replayed " << replayed << " transaction(s) from '" << journalPath << "'." << std::endl;
+    }
+    // Sem o diário ativo nesta execução, o arquivo já cumpriu seu papel
+    if (!journalEnabled) {
+        unlink(journalPath.c_str());
+    }
+}
+
+// Fecha a transação aberta: serializa os blocos alterados em um registro e
+// os passa para a lista de transações aguardando o commit em grupo
+void Ext2Shell::journalCommit() {
+    if (journalFd < 0 || txnBlocks.empty()) return;
+
+    JournalHeader header;
+    header.magic = JOURNAL_MAGIC;
+    header.sequence = ++journalSequence;
+    header.count = txnBlocks.size();
+    header.checksum = 0;
+
+    size_t start = journalBuffer.size();
+    journalBuffer.resize(start + sizeof(header) + (size_t)header.count * (sizeof(uint32_t) + blockSize));
+    char* numbers = &journalBuffer[start + sizeof(header)];
+    char* images = numbers + (size_t)header.count * sizeof(uint32_t);
+    for (auto& entry : txnBlocks) {
+        uint32_t block = entry.first;
+        memcpy(numbers, &block, sizeof(block));
+        memcpy(images, entry.second.data(), blockSize);
+        numbers += sizeof(block);
+        images += blockSize;
+        committedBlocks[entry.first] = std::move(entry.second);
+    }
+    memcpy(&journalBuffer[start], &header, sizeof(header));
+    header.checksum = journalChecksum(&journalBuffer[start], journalBuffer.size() - start);
+    memcpy(&journalBuffer[start], &header, sizeof(header));
+
+    txnBlocks.clear();
+    journalPending++;
+
+    if (journalPending >= JOURNAL_GROUP_TXNS || journalBuffer.size() >= JOURNAL_GROUP_BYTES) {
+        journalFlush();
+    } else if (journalPending == 1) {
+        reaperCv.notify_one(); // A thread de fundo passa a contar o prazo do commit
+    }
+}
+
+// Descarta a transação aberta (comando que falhou no meio). O estado em
+// memória derivado dos blocos descartados é recarregado.
+void Ext2Shell::journalAbort() {
+    if (journalFd < 0 || txnBlocks.empty()) return;
+
+    txnBlocks.clear();
+    dirFreeMap.clear();
+    try {
+        readImage(BASE_OFFSET, &super, sizeof(super));
+        updateCurrentDirectory(currentInodeNum);
+    } catch (const std::exception& e) {
+        std::cerr << "Caught exception while rolling back: " << e.what() << std::endl;
+    }
+}
+
+// Commit em grupo: um fdatasync torna duráveis todas as transações fechadas
+// desde o último commit; depois os blocos são escritos no lugar definitivo
+void Ext2Shell::journalFlush() {
+    if (journalFd < 0 || journalPending == 0) return;
+
+    // Dados escritos direto na imagem precisam chegar antes dos metadados que apontam para eles
+    if (!diskSync()) {
+        throw std::runtime_error("Error: Could not sync the image.");
+    }
+    if (pwrite(journalFd, journalBuffer.data(), journalBuffer.size(), journalBytes) != (ssize_t)journalBuffer.size() ||
+        fdatasync(journalFd) != 0) {
+        throw std::runtime_error("Error: Could not write journal file '" + journalPath + "'.");
+    }
+    journalBytes += journalBuffer.size();
+
+    for (const auto& entry : committedBlocks) {
+        if (!diskWrite(block_offset(entry.first, blockSize), entry.second.data(), blockSize)) {
+            throw std::runtime_error("Error: Could not write block " + std::to_string(entry.first) + ".");
+        }
+        journaledBlocks.insert(entry.first);
+    }
+    committedBlocks.clear();
+    journalBuffer.clear();
+    journalPending = 0;
+
+    if (journalBytes >= JOURNAL_MAX_BYTES) {
+        journalCheckpoint();
+    }
+}
+
+// Checkpoint: com a imagem sincronizada, o conteúdo do diário não é mais
+// necessário e o arquivo volta a ficar vazio
+void Ext2Shell::journalCheckpoint() {
+    if (journalFd < 0) return;
+
+    journalFlush();
+    if (!diskSync()) {
+        throw std::runtime_error("Error: Could not sync the image.");
+    }
+    if (ftruncate(journalFd, 0) != 0) {
+        throw std::runtime_error("Error: Could not truncate journal file '" + journalPath + "'.");
+    }
+    journalBytes = 0;
+    journaledBlocks.clear();
+}
+
+std::string formatPermissions(unsigned short mode) {
+    std::string p;
+    // Determine file type
+    if (S_ISDIR(mode)) p += 'd';
+    else if (S_ISREG(mode)) p += 'f';
+    else if (S_ISLNK(mode)) p += 'l';
+    else p += '?';
+
+    // User permissions
+    p += (mode & S_IRUSR) ? 'r' : '-';
+    p += (mode & S_IWUSR) ? 'w' : '-';
+    p += (mode & S_IXUSR) ? 'x' : '-';
+    // Group permissions
+    p += (mode & S_IRGRP) ? 'r' : '-';
+    p += (mode & S_IWGRP) ? 'w' : '-';
+    p += (mode & S_IXGRP) ? 'x' : '-';
+    // Other permissions
+    p += (mode & S_IROTH) ? 'r' : '-';
+    p += (mode & S_IWOTH) ? 'w' : '-';
+    p += (mode & S_IXOTH) ? 'x' : '-';
+    
+    return p;
+}
+
+std::string formatSize(unsigned long long size) {
+    std::stringstream ss;
+    double s = static_cast<double>(size);
+    ss << std::fixed << std::setprecision(1);
+
+    if (s < 1024) {
+        ss << std::setprecision(0) << s << " B";
+    } else if (s < 1024 * 1024) {
+        ss << (s / 1024.0) << " KiB";
+    } else if (s < 1024 * 1024 * 1024) {
+        ss << (s / (1024.0 * 1024.0)) << " MiB";
+    } else {
+        ss << (s / (1024.0 * 1024.0 * 1024.0)) << " GiB";
+    }
+    return ss.str();
+}
+
+
+std::string formatTime(uint32_t timestamp) {
+    time_t raw_time = timestamp;
+    struct tm* timeinfo = localtime(&raw_time);
+    char buffer[80];
+    strftime(buffer, sizeof(buffer), "%d/%m/%Y %H:%M", timeinfo);
+    return std::string(buffer);
+}
+
+
+// Lista os arquivos e diretórios no diretório atual
+void Ext2Shell::cmd_ls() {
+    forEachDirEntry(currentInodeNum, [](const ext2_dir_entry_2* entry) {
+        std::string name(entry->name, entry->name_len);
+        std::cout << name << std::endl;
+        std::cout << "inode: " << entry->inode << std::endl;
+        std::cout << "record length: " << entry->rec_len << std::endl;
+        std::cout << "name lenght: " << static_cast<int>(entry->name_len) << std::endl;
+        std::cout << "file type: " << static_cast<int>(entry->file_type) << std::endl;
+        std::cout << std::endl;
+        return true;
+    });
+}
+
+// Muda o diretório atual para o especificado
+void Ext2Shell::cmd_cd(const std::string& path) {
+    if (path == "..") {
+        if (!currentPath.empty()) {
+            currentPath.pop_back();
+            // Refaz o caminho desde a raiz para encontrar o inode
+            unsigned int newInodeNum = EXT2_ROOT_INO;
+            // salva o estado atual
+            auto tempPath = currentPath; 
+            currentPath.clear();
+            updateCurrentDirectory(newInodeNum);
+            // navega até o novo diretório
+            for(const auto& dir : tempPath){
+                cmd_cd(dir);
+            }
+        }
+        return;
+    }
+    
+    if (path == ".") return;
+
+    unsigned int inodeNum = getInodeByName(path);
+    if (inodeNum == 0) {
+        std::cerr << "Error: Directory '" << path << "' not found." << std::endl;
+        return;
+    }
+
+    ext2_inode newInode;
+    readInode(inodeNum, &newInode);
+    if (S_ISLNK(newInode.i_mode)) {
+        // Link para diretório: o caminho do prompt mostra o nome do link
+        inodeNum = resolvePath(path);
+        if (inodeNum != 0) readInode(inodeNum, &newInode);
+    }
+    if (inodeNum == 0 || !S_ISDIR(newInode.i_mode)) {
+        std::cerr << "Error: '" << path << "' is not a directory." << std::endl;
+        return;
+    }
+
+    updateCurrentDirectory(inodeNum);
+    currentPath.push_back(path);
+}
+
+// Exibe o caminho atual
+void Ext2Shell::cmd_pwd() {
+    // Inicia a string do caminho sempre com a barra da raiz.
+    std::string pathStr = "/";
+
+    // Percorre o vetor que armazena as partes do caminho (ex: "banana", "subpasta").
+    for (const auto& part : currentPath) {
+        // Adiciona cada parte do caminho seguida por uma barra.
+        pathStr += part + "/";
+    }
+
+    // Imprime a string do caminho final.
+    std::cout << pathStr << std::endl;
+}
+
+// --- Implementações dos Comandos de Manipulação de Arquivos e Diretórios ---
+
+// Exibe os atributos de um arquivo ou diretório
+void Ext2Shell::cmd_attr(const std::string& name) {
+    // Encontra o inode pelo nome no diretório atual
+    unsigned int inodeNum = getInodeByName(name);
+    if (inodeNum == 0) {
+        std::cerr << "Error: File or directory '" << name << "' not found." << std::endl;
+        return;
+    }
+
+    // Ler os dados do inode
+    ext2_inode targetInode;
+    readInode(inodeNum, &targetInode);
+
+    // Formatar as informações extraidas
+    std::string perms_str = formatPermissions(targetInode.i_mode);
+    std::string size_str = formatSize(inodeFileSize(targetInode));
+    std::string mtime_str = formatTime(targetInode.i_mtime);
+
+    // Printar o header e as informações extraidas
+    std::cout << " permissões  uid  gid      tamanho      modificado em" << std::endl;
+    std::cout << std::left 
+              << std::setw(12) << perms_str
+              << std::setw(5) << targetInode.i_uid
+              << std::setw(5) << targetInode.i_gid
+              << std::setw(15) << size_str
+              << mtime_str << std::endl;
+}
+
+// Exibe o conteúdo de um arquivo
+void Ext2Shell::cmd_cat(const std::string& name) {
+    // Verifica se o arquivo existe
+    unsigned int inodeNum = getInodeByName(name);
+    if (inodeNum == 0) {
+        std::cerr << "Error: File '" << name << "' not found." << std::endl;
+        return;
+    }
+
+    ext2_inode fileInode;
+    readInode(inodeNum, &fileInode);
+    if (S_ISLNK(fileInode.i_mode)) {
+        inodeNum = resolvePath(name);
+        if (inodeNum == 0) {
+            std::cerr << "Error: Cannot resolve symbolic link '" << name << "'." << std::endl;
+            return;
+        }
+        readInode(inodeNum, &fileInode);
+    }
+
+    // Verifica se é um arquivo regular
+    if (!S_ISREG(fileInode.i_mode)) {
+        std::cerr << "Error: '" << name << "' is not a regular file." << std::endl;
+        return;
+    }
+
+    // Lê os blocos do arquivo e imprime o conteúdo; buracos (ponteiro 0)
+    // de arquivos esparsos saem como zeros
+    static const std::vector<char> zeros(64 * 1024, 0);
+    forEachFileExtent(fileInode, [&](unsigned long long, const char* data, size_t length) {
+        if (data) {
+            std::cout.write(data, length);
+            return;
+        }
+        while (length > 0) {
+            size_t chunk = std::min(length, zeros.size());
+            std::cout.write(zeros.data(), chunk);
+            length -= chunk;
+        }
+    });
+
+    // Adiciona uma linha vazia ao final da saída
+    std::cout << std::endl;
+}
+
+// Cria um novo arquivo vazio
+void Ext2Shell::cmd_touch(const std::string& name) {
+    // Validar comprimento do nome
+    if (name.length() >= EXT2_NAME_LEN) {
+        std::cerr << "Error: Name too long (max " << EXT2_NAME_LEN - 1 << " characters)." << std::endl;        return;
+    }
+
+    // Verifica se o arquivo já existe no diretório atual
+    if (getInodeByName(name) != 0) {
+        std::cerr << "Error: File '" << name << "' already exists." << std::endl;
+        return;
+    }
+
+    // Tenta alocar um novo inode
+    int newInodeNum = allocateInode();
+    if (newInodeNum < 0) {
+        std::cerr << "Error: No free inodes available." << std::endl;
+        return;
+    }
+
+    // Inicializa o novo inode com valores padrão para arquivo regular
+    ext2_inode newInode = {};
+    newInode.i_mode = EXT2_S_IFREG | 0644;
+    newInode.i_uid = 0;
+    newInode.i_gid = 0;
+    newInode.i_size = 0;
+    newInode.i_links_count = 1;
+    newInode.i_blocks = 0;
+    newInode.i_atime = newInode.i_ctime = newInode.i_mtime = (uint32_t)time(nullptr);
+    memset(newInode.i_block, 0, sizeof(newInode.i_block));
+
+    // Escreve o novo inode no disco
+    writeInode(newInodeNum, &newInode);
+
+    // Adiciona a entrada do arquivo no diretório atual
+    if (addDirectoryEntry(currentInodeNum, newInodeNum, name, EXT2_FT_REG_FILE) < 0) {
+        std::cerr << "Error: Failed to add directory entry." << std::endl;
+        freeInode(newInodeNum);
+        return;
+    }
+
+    std::cout << "File '" << name << "' created successfully." << std::endl;
+}
+
+// Cria um novo diretório
+void Ext2Shell::cmd_mkdir(const std::string& name) {
+    // Verifica se já existe arquivo ou diretório com o mesmo nome
+    if (getInodeByName(name) != 0) {
+        std::cerr << "Error: File or directory '" << name << "' already exists." << std::endl;
+        return;
+    }
+
+    if (createDirectory(currentInodeNum, name) < 0) return;
+
+    std::cout << "Directory '" << name << "' created successfully." << std::endl;
+}
+
+// Cria um diretório vazio (com '.' e '..') dentro de 'parentInodeNum'.
+// Retorna o número do inode novo ou -1 (a mensagem de erro já foi impressa).
+int Ext2Shell::createDirectory(unsigned int parentInodeNum, const std::string& name) {
+    // Aloca um inode para o novo diretório
+    int inodeNum = allocateInode();
+    if (inodeNum < 0) {
+        std::cerr << "Error: No free inodes available." << std::endl;
+        return -1;
+    }
+
+    // Aloca um bloco para armazenar as entradas '.' e '..'
+    int blockNum = allocateBlock();
+    if (blockNum < 0) {
+        std::cerr << "Error: No free blocks available." << std::endl;
+        freeInode(inodeNum); // Libera o inode já alocado
+        return -1;
+    }
+
+    // Prepara o inode com as propriedades do diretório
+    ext2_inode dirInode = {};
+    dirInode.i_mode = EXT2_S_IFDIR | 0755;  // Diretório com permissão rwxr-xr-x
+    dirInode.i_uid = 0;
+    dirInode.i_gid = 0;
+    dirInode.i_size = blockSize;             // Tamanho do diretório: 1 bloco
+    dirInode.i_links_count = 2;              // '.' e referência do pai
+    dirInode.i_blocks = blockSize / 512;     // número de setores de 512 bytes
+    dirInode.i_atime = dirInode.i_ctime = dirInode.i_mtime = (uint32_t)time(nullptr);
+    memset(dirInode.i_block, 0, sizeof(dirInode.i_block));
+    dirInode.i_block[0] = blockNum;          // Aponta para o bloco alocado
+
+    // Grava o inode no disco
+    writeInode(inodeNum, &dirInode);
+
+    // Cria as entradas especiais '.' e '..' no bloco do diretório
+    BlockBuffer blockBuffer = blockPool.acquire(true);
+    char* blockData = blockBuffer.data();
+    ext2_dir_entry_2* dotEntry = reinterpret_cast<ext2_dir_entry_2*>(blockData);
+
+    // Entrada '.'
+    dotEntry->inode = inodeNum;
+    dotEntry->rec_len = 12;
+    dotEntry->name_len = 1;
+    dotEntry->file_type = EXT2_FT_DIR;
+    dotEntry->name[0] = '.';
+
+    // Entrada '..' logo após '.'
+    ext2_dir_entry_2* dotDotEntry = reinterpret_cast<ext2_dir_entry_2*>(blockData + 12);
+    dotDotEntry->inode = parentInodeNum;
+    dotDotEntry->rec_len = blockSize - 12;
+    dotDotEntry->name_len = 2;
+    dotDotEntry->file_type = EXT2_FT_DIR;
+    dotDotEntry->name[0] = '.';
+    dotDotEntry->name[1] = '.';
+
+    // Escreve o bloco do diretório no disco
+    writeBlock(blockNum, blockData);
+
+    // Adiciona a entrada do novo diretório no diretório pai
+    if (addDirectoryEntry(parentInodeNum, inodeNum, name, EXT2_FT_DIR) < 0) {
+        std::cerr << "Error: Failed to add directory entry." << std::endl;
+        freeBlock(blockNum);   // Libera bloco e inode em caso de falha
+        freeInode(inodeNum);
+        return -1;
+    }
+
+    // Incrementa o contador de diretórios do grupo onde o inode novo está
+    unsigned int group = (inodeNum - 1) / super.s_inodes_per_group;
+    ext2_group_desc groupDesc;
+    readGroupDesc(group, &groupDesc);
+    groupDesc.bg_used_dirs_count++;
+    writeGroupDesc(group, &groupDesc);
+    if (group == currentGroupNum) currentGroupDesc = groupDesc;
+
+    return inodeNum;
+}
+
+// Remove um arquivo
+void Ext2Shell::cmd_rm(const std::string& name) {
+    // Encontra o inode do arquivo pelo nome
+    unsigned int targetInodeNum = getInodeByName(name);
+    if (targetInodeNum == 0) {
+        std::cerr << "Error: File '" << name << "' not found." << std::endl;
+        return;
+    }
+
+    // Verifica se é um arquivo regular
+    ext2_inode targetInode;
+    readInode(targetInodeNum, &targetInode);
+    if (S_ISDIR(targetInode.i_mode)) {
+        std::cerr << "Error: '" << name << "' is a directory. Use 'rmdir' instead." << std::endl;
+        return;
+    }
+
+    // Remove a entrada do diretório pai
+    bool entryRemoved = removeDirectoryEntry(currentInodeNum, name);
+
+    if (!entryRemoved) { return; }
+    maybeAutoCompact(currentInodeNum);
+
+    // Decrementa os links; se não sobrar nenhum, o inode vai para a lista de
+    // órfãos e seus blocos são liberados em segundo plano pela reaperThread
+    targetInode.i_links_count--;
+    writeInode(targetInodeNum, &targetInode);
+    if (targetInode.i_links_count == 0) {
+        orphanAdd(targetInodeNum, targetInode);
+        reaperCv.notify_one();
+    }
+
+    std::cout << "File '" << name << "' removed successfully." << std::endl;
+}
+
+// Remove um diretório vazio
+void Ext2Shell::cmd_rmdir(const std::string& name) {
+    // Encontra o inode do diretório pelo nome
+    unsigned int targetInodeNum = getInodeByName(name);
+    if (targetInodeNum == 0) {
+        std::cerr << "Error: Directory '" << name << "' not found." << std::endl;
+        return;
+    }
+
+    // Verifica se é um diretório e se está vazio
+    ext2_inode targetInode;
+    readInode(targetInodeNum, &targetInode);
+
+    if (!S_ISDIR(targetInode.i_mode)) {
+        std::cerr << "Error: '" << name << "' is not a directory." << std::endl;
+        return;
+    }
+
+    if (targetInode.i_links_count > 2) {
+        std::cerr << "Error: Directory '" << name << "' is not empty (contains subdirectories)." << std::endl;
+        return;
+    }
+
+    // Verifica se está vazio (verificação mais rigorosa, em todos os blocos)
+    bool isTrulyEmpty = true;
+    forEachDirEntry(targetInodeNum, [&](const ext2_dir_entry_2* e) {
+        std::string entryName(e->name, e->name_len);
+        if (entryName != "." && entryName != "..") {
+            isTrulyEmpty = false;
+            return false;
+        }
+        return true;
+    });
+    if (!isTrulyEmpty) {
+        std::cerr << "Error: Directory '" << name << "' is not empty (contains files)." << std::endl;
+        return;
+    }
+
+    // Remove a entrada do diretório pai
+    bool entryRemoved = removeDirectoryEntry(currentInodeNum, name);
+
+    if (!entryRemoved) {
+        std::cerr << "Error: Could not remove directory entry for '" << name << "'." << std::endl;
+        return;
+    }
+
+    maybeAutoCompact(currentInodeNum);
+
+    // Atualiza o inode do diretório atual (o '..' do removido deixa de contar)
+    readInode(currentInodeNum, &currentInode);
+    currentInode.i_links_count--;
+    writeInode(currentInodeNum, &currentInode);
+
+    // Atualiza o inode do diretório a ser deletado
+    targetInode.i_links_count = 0;
+    targetInode.i_dtime = time(nullptr);
+    writeInode(targetInodeNum, &targetInode);
+
+    // Libera os blocos de dados do diretório
+    std::vector<unsigned int> blocks;
+    collectInodeBlocks(targetInode, blocks);
+    freeBlocks(blocks);
+
+    // Libera o inode do diretório (freeInode também ajusta bg_used_dirs_count)
+    freeInode(targetInodeNum);
+    dirFreeMap.erase(targetInodeNum);
+
+    std::cout << "Directory '" << name << "' removed successfully." << std::endl;
+}
+
+// Copia um arquivo do sistema de arquivos para o sistema local
+void Ext2Shell::cmd_cp(const std::string& source, const std::string& dest) {
+    // Verifica se o arquivo de origem existe
+    unsigned int sourceInodeNum = getInodeByName(source);
+    if (sourceInodeNum == 0) {
+        std::cerr << "Error: Source file '" << source << "' does not exist." << std::endl;
+        return;
+    }
+
+    // Lê o inode do arquivo de origem
+    ext2_inode sourceInode;
+    readInode(sourceInodeNum, &sourceInode);
+
+    // Verifica se é um arquivo regular
+    if (!S_ISREG(sourceInode.i_mode)) {
+        std::cerr << "Error: Source '" << source << "' is not a regular file." << std::endl;
+        return;
+    }
+
+    // Abre o arquivo de destino
+    // Se o arquivo ja existe, vai ser sobrescrito (truncado para 0)
+    int outFd = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outFd < 0) { // Verifica se o arquivo de destino pode ser aberto (o arquivo foi criado com sucesso)
+        std::cerr << "Error: Could not open destination file '" << dest << "' for writing." << std::endl;
+        return;
+    }
+
+    // Blocos de dados consecutivos são acumulados e escritos de uma vez;
+    // buracos não são escritos: o pwrite seguinte já cai no offset certo e o
+    // destino continua esparso (e, como foi truncado, já lê zeros ali)
+    const size_t maxPending = 256 * (size_t)blockSize;
+    std::vector<char> pending;
+    pending.reserve(maxPending);
+    unsigned long long pendingOffset = 0;
+    bool writeFailed = false;
+    auto flush = [&]() {
+        if (!pending.empty() && pwrite(outFd, pending.data(), pending.size(), pendingOffset) != (ssize_t)pending.size()) {
+            writeFailed = true;
+        }
+        pending.clear();
+    };
+
+    forEachFileExtent(sourceInode, [&](unsigned long long offset, const char* data, size_t length) {
+        if (!data) {
+            flush();
+            return;
+        }
+        if (pending.empty()) pendingOffset = offset;
+        pending.insert(pending.end(), data, data + length);
+        if (pending.size() >= maxPending) flush();
+    });
+    flush();
+
+    // Garante o tamanho final mesmo quando o arquivo termina em buraco
+    if (ftruncate(outFd, inodeFileSize(sourceInode)) != 0) writeFailed = true;
+    close(outFd); // Fecha o arquivo de destino
+
+    if (writeFailed) {
+        std::cerr << "Error: Failed to write destination file '" << dest << "'." << std::endl;
+        return;
+    }
+
+    std::cout << "File '" << source << "' copied to '" << dest << "' successfully." << std::endl;
+}
+
+// Renomeia um arquivo ou diretório
+void Ext2Shell::cmd_rename(const std::string& oldName, const std::string& newName) {
+    // Validações iniciais
+    if (newName.length() >= EXT2_NAME_LEN) {
+        std::cerr << "Error: New name is too long." << std::endl;
+        return;
+    }
+    unsigned int inodeNum = getInodeByName(oldName);
+    if (inodeNum == 0) {
+        std::cerr << "Error: '" << oldName << "' not found." << std::endl;
+        return;
+    }
+    if (getInodeByName(newName) != 0) {
+        std::cerr << "Error: '" << newName << "' already exists." << std::endl;
+        return;
+    }
+
+    // Procura a entrada em todos os blocos do diretório atual
+    bool operationCompleted = false;
+    bool needsMove = false;
+    unsigned char fileType = EXT2_FT_UNKNOWN;
+    BlockBuffer blockBuffer = blockPool.acquire();
+    char* blockData = blockBuffer.data();
+    forEachBlockNumber(currentInode, [&](unsigned int, unsigned int blockNum) {
+        readBlock(blockNum, blockData);
+
+        unsigned int offset = 0;
+        ext2_dir_entry_2* entry_to_rename = nullptr;
+        // Encontra o ponteiro para a entrada que queremos renomear
+        while (offset < blockSize) {
+            ext2_dir_entry_2* entry = (ext2_dir_entry_2*)&blockData[offset];
+            if (entry->rec_len == 0) break;
+            if (entry->inode == inodeNum && std::string(entry->name, entry->name_len) == oldName) {
+                entry_to_rename = entry;
+                break;
+            }
+            offset += entry->rec_len;
+        }
+        if (!entry_to_rename) return true;
+
+        // Calcula o espaço mínimo que a nova entrada precisa
+        unsigned int neededLen = (8 + newName.length() + 3) & ~3;
+
+        // Se o novo nome cabe na entrada atual, renomeia diretamente (em um
+        // diretório indexado o novo nome tem outro hash e pode mudar de folha)
+        if (neededLen <= entry_to_rename->rec_len && !(currentInode.i_flags & EXT2_INDEX_FL)) {
+            entry_to_rename->name_len = newName.length();
+            memset(entry_to_rename->name, 0, oldName.length()); // Limpa o nome antigo
+            strncpy(entry_to_rename->name, newName.c_str(), entry_to_rename->name_len);
+
+            // Salva a alteração e termina
+            writeBlock(blockNum, blockData);
+            noteDirBlockChanged(currentInodeNum, blockNum, blockData);
+            operationCompleted = true;
+        } else {
+            // Não cabe: a entrada será removida e adicionada de novo com o novo nome
+            fileType = entry_to_rename->file_type;
+            needsMove = true;
+        }
+        return false;
+    });
+
+    if (needsMove) {
+        removeDirectoryEntry(currentInodeNum, oldName);
+        if (addDirectoryEntry(currentInodeNum, inodeNum, newName, fileType) < 0) {
+            std::cerr << "Error: Could not add new entry for '" << newName << "'. Filesystem may be inconsistent." << std::endl;
+            return;
+        }
+        // addDirectoryEntry conta um link novo para subdiretórios, mas o '..'
+        // do diretório renomeado continua sendo o mesmo
+        if (fileType == EXT2_FT_DIR) {
+            currentInode.i_links_count--;
+            writeInode(currentInodeNum, &currentInode);
+        }
+        operationCompleted = true;
+    }
+
+    if (operationCompleted) {
+        std::cout << "Renamed '" << oldName << "' to '" << newName << "' successfully." << std::endl;
+    } else {
+        std::cerr << "Error: Could not find entry to rename." << std::endl;
+    }
+}
+
+// Move um arquivo ou diretório para outro diretório (e/ou outro nome), só
+// trocando entradas de diretório: os dados não são lidos nem copiados. Se o
+// destino for um diretório existente, o item vai para dentro dele com o mesmo
+// nome. Num diretório movido, o '..' passa a apontar para o novo pai.
+void Ext2Shell::cmd_mv(const std::string& source, const std::string& destination) {
+    auto validName = [](const std::string& name) { return !name.empty() && name != "." && name != ".."; };
+
+    std::string sourceName;
+    unsigned int sourceParent = resolveParent(source, sourceName);
+    if (!validName(sourceName)) {
+        std::cerr << "Error: Cannot move '" << source << "'." << std::endl;
+        return;
+    }
+    unsigned int inodeNum = sourceParent != 0 ? findDirEntry(sourceParent, sourceName) : 0;
+    if (inodeNum == 0) {
+        std::cerr << "Error: '" << source << "' not found." << std::endl;
+        return;
+    }
+
+    unsigned int destParent;
+    std::string destName;
+    unsigned int existing = resolvePath(destination);
+    ext2_inode destInode;
+    if (existing != 0) {
+        readInode(existing, &destInode);
+        if (!S_ISDIR(destInode.i_mode)) {
+            std::cerr << "Error: '" << destination << "' already exists." << std::endl;
+            return;
+        }
+        destParent = existing;
+        destName = sourceName;
+        if (findDirEntry(destParent, destName) != 0) {
+            std::cerr << "Error: '" << destName << "' already exists in '" << destination << "'." << std::endl;
+            return;
+        }
+    } else {
+        destParent = resolveParent(destination, destName);
+        if (destParent != 0) readInode(destParent, &destInode);
+        if (destParent == 0 || !S_ISDIR(destInode.i_mode) || !validName(destName)) {
+            std::cerr << "Error: Invalid destination '" << destination << "'." << std::endl;
+            return;
+        }
+    }
+    if (destName.length() >= EXT2_NAME_LEN) {
+        std::cerr << "Error: New name is too long." << std::endl;
+        return;
+    }
+
+    ext2_inode inode;
+    readInode(inodeNum, &inode);
+    const bool isDir = S_ISDIR(inode.i_mode);
+    if (isDir) {
+        // Um diretório não pode ir para dentro de si mesmo
+        for (unsigned int dir = destParent; dir != 0; dir = parentDirectory(dir)) {
+            if (dir == inodeNum) {
+                std::cerr << "Error: Cannot move '" << source << "' into itself." << std::endl;
+                return;
+            }
+            if (dir == EXT2_ROOT_INO) break;
+        }
+    }
+
+    // A entrada nova vem antes da remoção: uma falha não perde o item
+    if (addDirectoryEntry(destParent, inodeNum, destName, direntFileType(inode.i_mode)) < 0) {
+        std::cerr << "Error: Could not add entry for '" << destination << "'." << std::endl;
+        return;
+    }
+    removeDirectoryEntry(sourceParent, sourceName);
+
+    if (isDir) {
+        // addDirectoryEntry contou o link do '..' no pai novo; o antigo perde o dele
+        ext2_inode oldParent;
+        readInode(sourceParent, &oldParent);
+        oldParent.i_links_count--;
+        writeInode(sourceParent, &oldParent);
+        if (sourceParent == currentInodeNum) currentInode = oldParent;
+
+        // '..' é a segunda entrada do primeiro bloco (também nos indexados)
+        BlockBuffer blockBuffer = blockPool.acquire();
+        char* blockData = blockBuffer.data();
+        readBlock(inode.i_block[0], blockData);
+        ext2_dir_entry_2* dot = reinterpret_cast<ext2_dir_entry_2*>(blockData);
+        ext2_dir_entry_2* dotDot = reinterpret_cast<ext2_dir_entry_2*>(blockData + dot->rec_len);
+        dotDot->inode = destParent;
+        writeBlock(inode.i_block[0], blockData);
+    }
+    inode.i_ctime = (uint32_t)time(nullptr);
+    writeInode(inodeNum, &inode);
+
+    // Se o diretório corrente estava dentro do diretório movido, refaz o
+    // caminho mostrado no prompt subindo pelos '..'
+    if (isDir) {
+        bool affected = false;
+        for (unsigned int dir = currentInodeNum; dir != 0 && !affected; dir = parentDirectory(dir)) {
+            affected = dir == inodeNum;
+            if (dir == EXT2_ROOT_INO) break;
+        }
+        if (affected) {
+            std::vector<std::string> path;
+            for (unsigned int dir = currentInodeNum; dir != EXT2_ROOT_INO;) {
+                unsigned int parent = parentDirectory(dir);
+                if (parent == 0) break;
+                forEachDirEntry(parent, [&](const ext2_dir_entry_2* entry) {
+                    std::string name(entry->name, entry->name_len);
+                    if (entry->inode != dir || name == "." || name == "..") return true;
+                    path.insert(path.begin(), name);
+                    return false;
+                });
+                dir = parent;
+            }
+            currentPath = path;
+        }
+    }
+
+    std::cout << "Moved '" << source << "' to '" << destination << "' successfully." << std::endl;
+}
+
+// Cria um link: físico (nova entrada para o mesmo inode) ou, com -s,
+// simbólico. Se 'link' for um diretório existente, o link vai dentro dele
+// com o nome final do destino.
+// Uso: ln [-s] <destino> <link>
+void Ext2Shell::cmd_ln(const std::vector<std::string>& args) {
+    const bool symbolic = args.size() == 3;
+    const std::string& target = args[args.size() - 2];
+    const std::string& link = args.back();
+
+    unsigned int targetInodeNum = 0;
+    ext2_inode targetInode;
+    if (symbolic) {
+        // O destino de um link simbólico é só texto; não precisa existir
+        if (target.empty() || target.size() >= blockSize) {
+            std::cerr << "Error: Symbolic link target must have 1 to " << blockSize - 1 << " bytes." << std::endl;
+            return;
+        }
+    } else {
+        targetInodeNum = resolvePath(target, false);
+        if (targetInodeNum == 0) {
+            std::cerr << "Error: '" << target << "' not found." << std::endl;
+            return;
+        }
+        readInode(targetInodeNum, &targetInode);
+        if (S_ISDIR(targetInode.i_mode)) {
+            std::cerr << "Error: '" << target << "' is a directory; hard links to directories are not allowed."
+                      << std::endl;
+            return;
+        }
+        if (targetInode.i_links_count == 0xffff) {
+            std::cerr << "Error: Too many links to '" << target << "'." << std::endl;
+            return;
+        }
+    }
+
+    std::string name;
+    unsigned int parent;
+    unsigned int existing = resolvePath(link);
+    ext2_inode parentInode;
+    if (existing != 0 && (readInode(existing, &parentInode), S_ISDIR(parentInode.i_mode))) {
+        parent = existing;
+        std::string trimmed = target;
+        while (trimmed.size() > 1 && trimmed.back() == '/') trimmed.pop_back();
+        size_t slash = trimmed.rfind('/');
+        name = trimmed.substr(slash == std::string::npos ? 0 : slash + 1);
+    } else {
+        parent = resolveParent(link, name);
+        if (parent != 0) readInode(parent, &parentInode);
+        if (parent == 0 || !S_ISDIR(parentInode.i_mode)) {
+            std::cerr << "Error: Invalid link path '" << link << "'." << std::endl;
+            return;
+        }
+    }
+    if (name.empty() || name == "." || name == ".." || name == "/") {
+        std::cerr << "Error: Invalid link name '" << link << "'." << std::endl;
+        return;
+    }
+    if (name.length() >= EXT2_NAME_LEN) {
+        std::cerr << "Error: Name too long (max " << EXT2_NAME_LEN - 1 << " characters)." << std::endl;
+        return;
+    }
+    if (findDirEntry(parent, name) != 0) {
+        std::cerr << "Error: '" << name << "' already exists." << std::endl;
+        return;
+    }
+
+    if (!symbolic) {
+        if (addDirectoryEntry(parent, targetInodeNum, name, direntFileType(targetInode.i_mode)) < 0) {
+            std::cerr << "Error: Failed to add directory entry." << std::endl;
+            return;
+        }
+        targetInode.i_links_count++;
+        targetInode.i_ctime = (uint32_t)time(nullptr);
+        writeInode(targetInodeNum, &targetInode);
+        std::cout << "Link '" << name << "' to '" << target << "' created successfully." << std::endl;
+        return;
+    }
+
+    int inodeNum = allocateInode();
+    if (inodeNum < 0) {
+        std::cerr << "Error: No free inodes available." << std::endl;
+        return;
+    }
+    ext2_inode inode = {};
+    inode.i_mode = S_IFLNK | 0777;
+    inode.i_links_count = 1;
+    inode.i_atime = inode.i_ctime = inode.i_mtime = (uint32_t)time(nullptr);
+    if (storeSymlinkTarget(inode, target) < 0) {
+        std::cerr << "Error: No free blocks available." << std::endl;
+        freeInode(inodeNum);
+        return;
+    }
+    writeInode(inodeNum, &inode);
+
+    if (addDirectoryEntry(parent, inodeNum, name, EXT2_FT_SYMLINK) < 0) {
+        // Um link lento já tem bloco: a liberação adiada cuida dele
+        std::cerr << "Error: Failed to add directory entry." << std::endl;
+        inode.i_links_count = 0;
+        orphanAdd(inodeNum, inode);
+        reaperCv.notify_one();
+        return;
+    }
+
+    std::cout << "Symbolic link '" << name << "' -> '" << target << "' created successfully." << std::endl;
+}
+
+// Lê um tamanho em bytes com sufixo opcional; usado pelos comandos e pelas
+// opções de linha de comando (--mkfs, --block-size)
+bool Ext2Shell::parseSize(const std::string& text, unsigned long long& value) {
+    if (text.empty() || text[0] < '0' || text[0] > '9') return false;
+    errno = 0;
+    char* end = nullptr;
+    value = strtoull(text.c_str(), &end, 10);
+    if (errno == ERANGE) return false;
+    unsigned int shift = 0;
+    switch (*end) {
+    case '\0': break;
+    case 'K': case 'k': shift = 10; end++; break;
+    case 'M': case 'm': shift = 20; end++; break;
+    case 'G': case 'g': shift = 30; end++; break;
+    case 'T': case 't': shift = 40; end++; break;
+    default: return false;
+    }
+    if (*end != '\0' || (value << shift) >> shift != value) return false;
+    value <<= shift;
+    return true;
+}
+
+// Resolve o caminho de um arquivo regular (seguindo links simbólicos).
+// Retorna 0, com a mensagem de erro já mostrada, se ele não existir ou não
+// for um arquivo regular.
+unsigned int Ext2Shell::resolveRegularFile(const std::string& path, ext2_inode& inode) {
+    unsigned int inodeNum = resolvePath(path);
+    if (inodeNum == 0) {
+        std::cerr << "Error: File '" << path << "' not found." << std::endl;
+        return 0;
+    }
+    readInode(inodeNum, &inode);
+    if (!S_ISREG(inode.i_mode)) {
+        std::cerr << "Error: '" << path << "' is not a regular file." << std::endl;
+        return 0;
+    }
+    return inodeNum;
+}
+
+// Grava no arquivo os bytes devolvidos por 'read' (0 = fim dos dados) a
+// partir de 'offset', em lotes de até 256 blocos. Só os blocos das pontas
+// escritos pela metade são lidos antes (leitura-modificação-escrita); os do
+// meio vão direto para o disco, em trechos contíguos. Buracos e blocos além
+// do fim recebem blocos novos, reservados juntos logo depois do bloco
+// anterior do arquivo, e a árvore de ponteiros cresce conforme preciso.
+// Atualiza i_block, i_blocks e o tamanho; quem chama grava o inode.
+// 'written' recebe os bytes gravados mesmo em caso de erro. Retorna -1 se
+// faltar espaço e -2 se o arquivo passar do tamanho máximo.
+int Ext2Shell::writeFileData(unsigned int inodeNum, ext2_inode& inode, unsigned long long offset,
+                             const std::function<size_t(char*, size_t)>& read, unsigned long long& written) {
+    const unsigned long long perBlock = blockSize / sizeof(unsigned int);
+    const unsigned long long maxBlocks = 12 + perBlock + perBlock * perBlock + perBlock * perBlock * perBlock;
+    const unsigned int batch = 256;
+    std::vector<char> buffer((size_t)batch * blockSize);
+    BlockBuffer oldBuffer = blockPool.acquire();
+    written = 0;
+
+    // Blocos novos vão logo depois do bloco anterior do arquivo ou, se não
+    // houver, no começo do grupo do inode
+    unsigned long long position = offset;
+    unsigned int goal = 0;
+    if (offset / blockSize > 0 && offset / blockSize <= maxBlocks) {
+        goal = getBlockNumber(inode, offset / blockSize - 1);
+    }
+    goal = goal != 0 ? goal + 1
+                     : (inodeNum - 1) / super.s_inodes_per_group * super.s_blocks_per_group + super.s_first_data_block;
+
+    int result = 0;
+    bool eof = false;
+    while (!eof) {
+        const unsigned long long firstLogical = position / blockSize;
+        const size_t head = position % blockSize;
+        size_t filled = 0;
+        while (head + filled < buffer.size()) {
+            size_t got = read(buffer.data() + head + filled, buffer.size() - head - filled);
+            if (got == 0) {
+                eof = true;
+                break;
+            }
+            filled += got;
+        }
+        if (filled == 0) break;
+        const size_t end = head + filled;
+        const size_t tail = end % blockSize; // Bytes usados do último bloco (0 = cheio)
+        const unsigned int count = (end + blockSize - 1) / blockSize;
+        if (firstLogical + count > maxBlocks) {
+            result = -2;
+            break;
+        }
+
+        std::vector<unsigned int> phys(count);
+        std::vector<unsigned int> holes;
+        for (unsigned int i = 0; i < count; i++) {
+            phys[i] = getBlockNumber(inode, firstLogical + i);
+            if (phys[i] == 0) holes.push_back(i);
+        }
+
+        // Pontas escritas pela metade: o resto do bloco vem do conteúdo
+        // antigo ou, se o bloco ainda não existe, fica zerado
+        for (unsigned int i : { 0u, count - 1 }) {
+            size_t keepHead = i == 0 ? head : 0;
+            size_t keepTail = i == count - 1 && tail != 0 ? tail : blockSize;
+            if (keepHead == 0 && keepTail == blockSize) continue;
+            char* block = buffer.data() + (size_t)i * blockSize;
+            if (phys[i] != 0) readBlock(phys[i], oldBuffer.data());
+            else memset(oldBuffer.data(), 0, blockSize);
+            memcpy(block, oldBuffer.data(), keepHead);
+            memcpy(block + keepTail, oldBuffer.data() + keepTail, blockSize - keepTail);
+            if (count == 1) break;
+        }
+
+        // Buracos do lote: uma reserva só, de preferência contígua
+        unsigned int mapped = count;
+        if (!holes.empty()) {
+            std::vector<std::pair<unsigned int, unsigned int>> extents;
+            if (inode.i_blocks + (unsigned long long)holes.size() * (blockSize / 512) > UINT32_MAX ||
+                reserveBlocks(holes.size(), goal, extents) < 0) {
+                mapped = holes.front();
+                result = -1;
+            } else {
+                size_t next = 0;
+                for (const auto& extent : extents) {
+                    for (unsigned int k = 0; k < extent.second; k++) phys[holes[next++]] = extent.first + k;
+                }
+                for (size_t h = 0; h < holes.size(); h++) {
+                    if (setBlockNumber(inode, firstLogical + holes[h], phys[holes[h]]) < 0) {
+                        // Sem bloco para os ponteiros: devolve o resto da reserva
+                        std::vector<unsigned int> unused;
+                        for (size_t r = h; r < holes.size(); r++) unused.push_back(phys[holes[r]]);
+                        freeBlocks(unused);
+                        mapped = holes[h];
+                        result = -1;
+                        break;
+                    }
+                    inode.i_blocks += blockSize / 512;
+                }
+            }
+        }
+
+        for (unsigned int i = 0; i < mapped;) {
+            unsigned int run = 1;
+            while (i + run < mapped && phys[i + run] == phys[i] + run) run++;
+            writeBlockRun(phys[i], run, buffer.data() + (size_t)i * blockSize);
+            i += run;
+        }
+        if (mapped > 0) goal = phys[mapped - 1] + 1;
+
+        size_t stored = mapped == count ? filled : (size_t)mapped * blockSize > head ? mapped * blockSize - head : 0;
+        written += stored;
+        position += stored;
+        if (result < 0) break;
+    }
+
+    if (position > inodeFileSize(inode)) setInodeFileSize(inode, position);
+    return result;
+}
+
+// Muda o tamanho de um arquivo. Ao encolher, os blocos depois do novo fim e
+// os de ponteiros que ficarem vazios são liberados de uma vez; ao crescer,
+// o trecho novo fica como buraco. O fim do bloco que contém o menor dos dois
+// tamanhos é zerado, para que um crescimento posterior leia zeros ali.
+// Quem chama grava o inode. Retorna -2 se o tamanho passar do máximo.
+int Ext2Shell::truncateFile(ext2_inode& inode, unsigned long long size) {
+    const unsigned long long perBlock = blockSize / sizeof(unsigned int);
+    const unsigned long long maxBlocks = 12 + perBlock + perBlock * perBlock + perBlock * perBlock * perBlock;
+    if ((size + blockSize - 1) / blockSize > maxBlocks) return -2;
+
+    const unsigned long long oldSize = inodeFileSize(inode);
+    if (size < oldSize) truncateBlocks(inode, (size + blockSize - 1) / blockSize);
+
+    const unsigned long long edge = std::min(size, oldSize);
+    if (edge % blockSize != 0) {
+        unsigned int blockNum = getBlockNumber(inode, edge / blockSize);
+        if (blockNum != 0) {
+            BlockBuffer blockBuffer = blockPool.acquire();
+            readBlock(blockNum, blockBuffer.data());
+            memset(blockBuffer.data() + edge % blockSize, 0, blockSize - edge % blockSize);
+            writeBlock(blockNum, blockBuffer.data());
+        }
+    }
+    setInodeFileSize(inode, size);
+    return 0;
+}
+
+// Grava o conteúdo de 'source' (arquivo local, ou "-" para o resto da entrada
+// padrão) no arquivo 'path' da imagem, a partir de 'offset' ou, com
+// 'append', a partir do fim atual
+void Ext2Shell::writeFromSource(const std::string& path, unsigned long long offset, bool append,
+                                const std::string& source) {
+    const bool fromStdin = source == "-";
+    if (fromStdin && serving) {
+        std::cerr << "Error: Reading data from standard input is not available in server mode." << std::endl;
+        return;
+    }
+    ext2_inode inode;
+    unsigned int inodeNum = resolveRegularFile(path, inode);
+    if (inodeNum == 0) return;
+
+    int inFd = -1;
+    if (!fromStdin) {
+        inFd = open(source.c_str(), O_RDONLY);
+        if (inFd < 0) {
+            std::cerr << "Error: Could not open local file '" << source << "' for reading." << std::endl;
+            return;
+        }
+        posix_fadvise(inFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    bool readFailed = false;
+    auto read = [&](char* dst, size_t length) -> size_t {
+        if (fromStdin) {
+            std::cin.read(dst, length);
+            return std::cin.gcount();
+        }
+        ssize_t got;
+        do {
+            got = ::read(inFd, dst, length);
+        } while (got < 0 && errno == EINTR);
+        if (got < 0) readFailed = true;
+        return got > 0 ? got : 0;
+    };
+
+    if (append) offset = inodeFileSize(inode);
+    unsigned long long written = 0;
+    int result;
+    beginDeferredAllocation();
+    try {
+        result = writeFileData(inodeNum, inode, offset, read, written);
+    } catch (...) {
+        endDeferredAllocation();
+        if (inFd >= 0) close(inFd);
+        throw;
+    }
+    endDeferredAllocation();
+    if (inFd >= 0) close(inFd);
+    // Os dados ocupam o resto da entrada padrão, mesmo se a gravação parou antes
+    if (fromStdin) std::cin.ignore(std::numeric_limits<std::streamsize>::max());
+
+    inode.i_mtime = inode.i_ctime = (uint32_t)time(nullptr);
+    writeInode(inodeNum, &inode);
+
+    if (result == -1) std::cerr << "Error: No space left on device." << std::endl;
+    if (result == -2) std::cerr << "Error: File size limit exceeded." << std::endl;
+    if (readFailed) std::cerr << "Error: Could not read local file '" << source << "'." << std::endl;
+    if (result == 0 || written > 0) {
+        std::cout << "Wrote " << written << " bytes to '" << path << "' at offset " << offset << "." << std::endl;
+    }
+}
+
+// Grava dados no arquivo a partir de um offset
+// Uso: write <arquivo> <offset> <arquivo_local|->
+void Ext2Shell::cmd_write(const std::vector<std::string>& args) {
+    unsigned long long offset;
+    if (!parseSize(args[1], offset)) {
+        std::cerr << "Error: Invalid offset '" << args[1] << "'." << std::endl;
+        return;
+    }
+    writeFromSource(args[0], offset, false, args[2]);
+}
+
+// Acrescenta dados ao fim do arquivo
+// Uso: append <arquivo> <arquivo_local|->
+void Ext2Shell::cmd_append(const std::string& name, const std::string& source) {
+    writeFromSource(name, 0, true, source);
+}
+
+// Muda o tamanho do arquivo, liberando os blocos que sobrarem ou deixando
+// um buraco no fim
+// Uso: truncate <arquivo> <tamanho>
+void Ext2Shell::cmd_truncate(const std::string& name, const std::string& sizeText) {
+    unsigned long long size;
+    if (!parseSize(sizeText, size)) {
+        std::cerr << "Error: Invalid size '" << sizeText << "'." << std::endl;
+        return;
+    }
+    ext2_inode inode;
+    unsigned int inodeNum = resolveRegularFile(name, inode);
+    if (inodeNum == 0) return;
+
+    if (truncateFile(inode, size) < 0) {
+        std::cerr << "Error: File size limit exceeded." << std::endl;
+        return;
+    }
+    inode.i_mtime = inode.i_ctime = (uint32_t)time(nullptr);
+    writeInode(inodeNum, &inode);
+    std::cout << "File '" << name << "' truncated to " << size << " bytes." << std::endl;
+}
+
+// Reserva e zera os blocos que faltam no arquivo para cobrir [0, size). O
+// ext2 não tem extents "não escritos" como o ext4, então os blocos novos são
+// zerados no disco para que leiam como zeros. Um arquivo sem nenhum bloco é
+// montado como no import-tar (dados e ponteiros numa reserva só, árvore em
+// memória); nos outros, só os buracos são preenchidos, reservados juntos logo
+// depois do bloco anterior. O tamanho só cresce. 'allocated' recebe quantos
+// blocos de dados foram reservados. Retorna -1 se faltar espaço e -2 se o
+// tamanho passar do máximo. Quem chama grava o inode.
+int Ext2Shell::preallocateFile(unsigned int inodeNum, ext2_inode& inode, unsigned long long size,
+                               unsigned long long& allocated) {
+    const unsigned long long perBlock = blockSize / sizeof(unsigned int);
+    const unsigned long long maxBlocks = 12 + perBlock + perBlock * perBlock + perBlock * perBlock * perBlock;
+    const unsigned long long dataBlocks = (size + blockSize - 1) / blockSize;
+    allocated = 0;
+    if (dataBlocks > maxBlocks) return -2;
+    const unsigned long long oldSize = inodeFileSize(inode);
+    unsigned int goal = (inodeNum - 1) / super.s_inodes_per_group * super.s_blocks_per_group + super.s_first_data_block;
+
+    if (inode.i_blocks == 0) {
+        auto zeros = [](char* dst, size_t length) {
+            memset(dst, 0, length);
+            return true;
+        };
+        if (dataBlocks > 0 && importFileData(inode, dataBlocks * blockSize, zeros, goal) < 0) return -1;
+        allocated = dataBlocks;
+        setInodeFileSize(inode, std::max(size, oldSize));
+        return 0;
+    }
+
+    std::vector<bool> mapped(dataBlocks, false);
+    forEachBlockNumber(inode, [&](unsigned int logical, unsigned int) {
+        if (logical >= dataBlocks) return false;
+        mapped[logical] = true;
+        return true;
+    });
+    std::vector<unsigned int> holes;
+    for (unsigned long long logical = 0; logical < dataBlocks; logical++) {
+        if (!mapped[logical]) holes.push_back(logical);
+    }
+
+    int result = 0;
+    if (!holes.empty()) {
+        if (holes.front() > 0) {
+            unsigned int previous = getBlockNumber(inode, holes.front() - 1);
+            if (previous != 0) goal = previous + 1;
+        }
+        // Os blocos de ponteiros que faltam entram na mesma reserva, cada um
+        // logo antes do primeiro bloco de dados que ele indexa
+        std::vector<unsigned int> pointersBefore;
+        unsigned long long pointerCount = countMissingPointerBlocks(inode, holes, pointersBefore);
+        unsigned long long total = holes.size() + pointerCount;
+        std::vector<std::pair<unsigned int, unsigned int>> extents;
+        if (inode.i_blocks + total * (blockSize / 512) > UINT32_MAX || reserveBlocks(total, goal, extents) < 0) {
+            return -1;
+        }
+        std::vector<unsigned int> reserved;
+        reserved.reserve(total);
+        for (const auto& extent : extents) {
+            for (unsigned int k = 0; k < extent.second; k++) reserved.push_back(extent.first + k);
+        }
+        std::vector<unsigned int> phys, spare;
+        phys.reserve(holes.size());
+        spare.reserve(pointerCount);
+        size_t next = 0;
+        for (size_t h = 0; h < holes.size(); h++) {
+            for (unsigned int p = 0; p < pointersBefore[h]; p++) spare.push_back(reserved[next++]);
+            phys.push_back(reserved[next++]);
+        }
+        std::reverse(spare.begin(), spare.end()); // setBlockNumber consome do fim
+
+        // Zera os blocos reservados antes de ligá-los ao arquivo
+        const unsigned int batch = 256;
+        std::vector<char> zeros((size_t)batch * blockSize, 0);
+        for (const auto& extent : extents) {
+            for (unsigned int done = 0; done < extent.second; done += batch) {
+                writeBlockRun(extent.first + done, std::min(batch, extent.second - done), zeros.data());
+            }
+        }
+
+        for (size_t h = 0; h < holes.size(); h++) {
+            if (setBlockNumber(inode, holes[h], phys[h], &spare) < 0) {
+                // Sem bloco para os ponteiros: devolve o resto da reserva
+                std::vector<unsigned int> unused(phys.begin() + h, phys.end());
+                unused.insert(unused.end(), spare.begin(), spare.end());
+                freeBlocks(unused);
+                result = -1;
+                break;
+            }
+            inode.i_blocks += blockSize / 512;
+            allocated++;
+        }
+    }
+    if (result == 0 && size > oldSize) setInodeFileSize(inode, size);
+    return result;
+}
+
+// Pré-aloca o arquivo até 'tamanho' bytes, em trechos contíguos, para que
+// gravações futuras caiam em blocos já reservados
+// Uso: fallocate <arquivo> <tamanho>
+void Ext2Shell::cmd_fallocate(const std::string& name, const std::string& sizeText) {
+    unsigned long long size;
+    if (!parseSize(sizeText, size)) {
+        std::cerr << "Error: Invalid size '" << sizeText << "'." << std::endl;
+        return;
+    }
+    ext2_inode inode;
+    unsigned int inodeNum = resolveRegularFile(name, inode);
+    if (inodeNum == 0) return;
+
+    unsigned long long allocated = 0;
+    int result;
+    beginDeferredAllocation();
+    try {
+        result = preallocateFile(inodeNum, inode, size, allocated);
+    } catch (...) {
+        endDeferredAllocation();
+        throw;
+    }
+    endDeferredAllocation();
+
+    if (allocated > 0 || result == 0) {
+        inode.i_mtime = inode.i_ctime = (uint32_t)time(nullptr);
+        writeInode(inodeNum, &inode);
+    }
+    if (result == -1) {
+        std::cerr << "Error: No space left on device." << std::endl;
+        return;
+    }
+    if (result == -2) {
+        std::cerr << "Error: File size limit exceeded." << std::endl;
+        return;
+    }
+    std::cout << "Preallocated " << allocated << " blocks for '" << name << "' (" << inodeFileSize(inode)
+              << " bytes)." << std::endl;
+}
+
+// Compacta um diretório ou configura a compactação automática
+// Uso: compact [diretorio] | compact auto <percentual|off>
+void Ext2Shell::cmd_compact(const std::vector<std::string>& args) {
+    if (!args.empty() && args[0] == "auto") {
+        if (args.size() != 2) {
+            std::cerr << "Error: Usage: compact auto <percent|off>" << std::endl;
+            return;
+        }
+        if (args[1] == "off") {
+            compactThreshold = 0;
+            std::cout << "Automatic compaction disabled." << std::endl;
+            return;
+        }
+        int percent = std::atoi(args[1].c_str());
+        if (percent <= 0 || percent > 100) {
+            std::cerr << "Error: Threshold must be between 1 and 100." << std::endl;
+            return;
+        }
+        compactThreshold = percent;
+        std::cout << "Directories will be compacted after removals when " << percent << "% or more of their space is unused." << std::endl;
+        return;
+    }
+    if (args.size() > 1) {
+        std::cerr << "Error: Usage: compact [directory]" << std::endl;
+        return;
+    }
+
+    // Sem argumento, compacta o diretório atual
+    std::string name = args.empty() ? "." : args[0];
+    unsigned int dirInodeNum = args.empty() ? currentInodeNum : getInodeByName(name);
+    if (dirInodeNum == 0) {
+        std::cerr << "Error: Directory '" << name << "' not found." << std::endl;
+        return;
+    }
+
+    ext2_inode dirInode;
+    readInode(dirInodeNum, &dirInode);
+    if (!S_ISDIR(dirInode.i_mode)) {
+        std::cerr << "Error: '" << name << "' is not a directory." << std::endl;
+        return;
+    }
+    unsigned int before = dirInode.i_size / blockSize;
+
+    int freed = compactDirectory(dirInodeNum);
+    if (freed < 0) {
+        std::cerr << "Error: Directory '" << name << "' cannot be compacted (indexed or sparse)." << std::endl;
+        return;
+    }
+    readInode(dirInodeNum, &dirInode);
+    std::cout << "Directory '" << name << "' compacted: " << before << " -> " << dirInode.i_size / blockSize
+              << " blocks (" << freed << " blocks freed)." << std::endl;
+}
+
+// Conta os extents (sequências de blocos físicos contíguos) dos dados de um
+// inode. Um intervalo preenchido só por blocos de ponteiros do próprio arquivo
+// não quebra o extent: é o layout do alocador do ext2 (e do defrag), com cada
+// bloco indireto logo antes dos dados que ele mapeia.
+unsigned int Ext2Shell::countExtents(const ext2_inode& inode, unsigned int* dataBlocks) {
+    // Só os blocos de ponteiros: a árvore de cada indireto sem o último nível
+    std::vector<unsigned int> pointerBlocks;
+    collectTreeBlocks(inode.i_block[12], 0, pointerBlocks);
+    collectTreeBlocks(inode.i_block[13], 1, pointerBlocks);
+    collectTreeBlocks(inode.i_block[14], 2, pointerBlocks);
+    std::sort(pointerBlocks.begin(), pointerBlocks.end());
+
+    auto onlyPointers = [&](unsigned int from, unsigned int to) { // [from, to)
+        auto low = std::lower_bound(pointerBlocks.begin(), pointerBlocks.end(), from);
+        auto high = std::lower_bound(pointerBlocks.begin(), pointerBlocks.end(), to);
+        return (unsigned int)(high - low) == to - from;
+    };
+
+    unsigned int extents = 0, blocks = 0;
+    unsigned int prevLogical = 0, prevPhys = 0;
+    forEachBlockNumber(inode, [&](unsigned int logical, unsigned int phys) {
+        if (blocks == 0 || logical != prevLogical + 1 || phys <= prevPhys || !onlyPointers(prevPhys + 1, phys)) {
+            extents++;
+        }
+        blocks++;
+        prevLogical = logical;
+        prevPhys = phys;
+        return true;
+    });
+    if (dataBlocks) *dataBlocks = blocks;
+    return extents;
+}
+
+// Relatório de fragmentação: extents por arquivo (um arquivo ou a subárvore
+// de um diretório) e histograma dos tamanhos de extents livres por grupo
+void Ext2Shell::cmd_frag(const std::string& name) {
+    unsigned int inodeNum = name.empty() ? currentInodeNum : getInodeByName(name);
+    if (inodeNum == 0) {
+        std::cerr << "Error: File or directory '" << name << "' not found." << std::endl;
+        return;
+    }
+    ext2_inode inode;
+    readInode(inodeNum, &inode);
+
+    if (!S_ISDIR(inode.i_mode)) {
+        // Links e dispositivos guardam texto ou números em i_block, não blocos
+        if (!S_ISREG(inode.i_mode)) {
+            std::cerr << "Error: '" << name << "' is not a regular file or directory." << std::endl;
+            return;
+        }
+        unsigned int blocks;
+        unsigned int extents = countExtents(inode, &blocks);
+        std::cout << name << ": " << blocks << " blocks in " << extents << " extent(s)" << std::endl;
+        return;
+    }
+
+    // Extents por arquivo da subárvore
+    struct FileFrag { std::string path; unsigned int blocks; unsigned int extents; };
+    std::vector<FileFrag> files;
+    unsigned long long totalBlocks = 0, totalExtents = 0;
+    forEachInodeInTree(inodeNum, name.empty() ? "." : name, [&](const std::string& path, unsigned int, const ext2_inode& child) {
+        if (!S_ISREG(child.i_mode)) return;
+        unsigned int blocks;
+        unsigned int extents = countExtents(child, &blocks);
+        files.push_back({path, blocks, extents});
+        totalBlocks += blocks;
+        totalExtents += extents;
+    });
+    std::sort(files.begin(), files.end(), [](const FileFrag& a, const FileFrag& b) { return a.extents > b.extents; });
+
+    unsigned int fragmented = 0;
+    std::cout << std::left << std::setw(10) << "extents" << std::setw(10) << "blocks" << "file" << std::endl;
+    for (const FileFrag& f : files) {
+        if (f.extents <= 1) continue;
+        fragmented++;
+        std::cout << std::left << std::setw(10) << f.extents << std::setw(10) << f.blocks << f.path << std::endl;
+    }
+    std::cout << files.size() << " files, " << fragmented << " fragmented, " << totalBlocks << " blocks in "
+              << totalExtents << " extents" << std::endl << std::endl;
+
+    // Histograma de extents livres: baldes de potências de 2 (1, 2-3, 4-7, ...)
+    const int buckets = 16;
+    std::cout << "Free extents per group (bucket = 2^n blocks):" << std::endl;
+    unsigned int numGroups = groupCount();
+    BlockBuffer bitmapBuffer = blockPool.acquire();
+    unsigned char* bitmap = bitmapBuffer.as<unsigned char>();
+    for (unsigned int group = 0; group < numGroups; ++group) {
+        ext2_group_desc groupDesc;
+        readGroupDesc(group, &groupDesc);
+        readBlockBitmap(group, groupDesc, bitmap);
+
+        std::vector<unsigned int> histogram(buckets, 0);
+        unsigned int runLen = 0, largest = 0, extents = 0, freeBlocks = 0;
+        unsigned int groupBlocks = blocksInGroup(group);
+        for (unsigned int i = 0; i <= groupBlocks; ++i) {
+            if (i < groupBlocks && !isBitSet(bitmap, i)) {
+                runLen++;
+                continue;
+            }
+            if (runLen > 0) {
+                int bucket = 0;
+                while ((runLen >> (bucket + 1)) != 0 && bucket < buckets - 1) bucket++;
+                histogram[bucket]++;
+                largest = std::max(largest, runLen);
+                freeBlocks += runLen;
+                extents++;
+                runLen = 0;
+            }
+        }
+
+        std::cout << "group " << std::setw(4) << group << " free " << std::setw(6) << freeBlocks
+                  << " extents " << std::setw(5) << extents << " largest " << std::setw(6) << largest << " |";
+        for (int b = 0; b < buckets; b++) {
+            if (histogram[b]) std::cout << " " << (1u << b) << ":" << histogram[b];
+        }
+        std::cout << std::endl;
+    }
+}
+
+// Realoca os blocos de um arquivo para uma única sequência contígua (ou, se o
+// arquivo não couber em um trecho livre, para o menor número de trechos
+// grandes que reserveBlocks achar), reescrevendo a árvore de ponteiros (cada
+// bloco indireto fica logo antes dos dados que ele mapeia, como no alocador
+// do ext2)
+void Ext2Shell::cmd_defrag(const std::string& name) {
+    unsigned int inodeNum = getInodeByName(name);
+    if (inodeNum == 0) {
+        std::cerr << "Error: File '" << name << "' not found." << std::endl;
+        return;
+    }
+    ext2_inode oldInode;
+    readInode(inodeNum, &oldInode);
+    if (!S_ISREG(oldInode.i_mode)) {
+        std::cerr << "Error: '" << name << "' is not a regular file." << std::endl;
+        return;
+    }
+
+    unsigned int dataBlocks;
+    unsigned int oldExtents = countExtents(oldInode, &dataBlocks);
+    if (oldExtents <= 1) {
+        std::cout << "File '" << name << "' is already contiguous." << std::endl;
+        return;
+    }
+
+    // Mapeamento antigo em ordem lógica
+    std::vector<std::pair<unsigned int, unsigned int>> mapping; // (lógico, físico)
+    forEachBlockNumber(oldInode, [&](unsigned int logical, unsigned int phys) {
+        mapping.emplace_back(logical, phys);
+        return true;
+    });
+
+    // Planeja o novo layout: para cada bloco lógico, os nós de ponteiros do
+    // caminho (ainda não posicionados) vêm antes do bloco de dados
+    const unsigned int perBlock = blockSize / sizeof(unsigned int);
+    struct PointerNode { unsigned int position; std::vector<unsigned int> pointers; };
+    std::map<unsigned long long, PointerNode> nodes;    // chave: (slot, nível, início)
+    std::vector<std::pair<bool, unsigned long long>> layout; // (é dado?, índice em mapping | chave do nó)
+    struct PathStep { unsigned long long key; unsigned int index; };
+    std::vector<std::vector<PathStep>> paths(mapping.size());
+
+    for (size_t m = 0; m < mapping.size(); m++) {
+        unsigned int logical = mapping[m].first;
+        if (logical >= 12) {
+            unsigned int rest = logical - 12;
+            unsigned int start = 12;
+            int depth = 1;
+            unsigned int span = 1;
+            while (rest >= span * perBlock) {
+                rest -= span * perBlock;
+                start += span * perBlock;
+                span *= perBlock;
+                depth++;
+            }
+            unsigned int slot = 11 + depth;
+            unsigned int nodeStart = start;
+            for (int level = depth; level >= 1; level--) {
+                unsigned long long key = ((unsigned long long)slot << 56) | ((unsigned long long)level << 48) | nodeStart;
+                unsigned int index = (rest / span) % perBlock;
+                if (nodes.find(key) == nodes.end()) {
+                    nodes[key] = {(unsigned int)layout.size(), std::vector<unsigned int>(perBlock, 0)};
+                    layout.emplace_back(false, key);
+                }
+                paths[m].push_back({key, index});
+                nodeStart += index * span;
+                rest %= span;
+                span /= perBlock;
+            }
+        }
+        layout.emplace_back(true, m);
+    }
+
+    unsigned int total = layout.size();
+    std::vector<std::pair<unsigned int, unsigned int>> extents;
+    unsigned int goal = (inodeNum - 1) / super.s_inodes_per_group * super.s_blocks_per_group + super.s_first_data_block;
+    if (reserveBlocks(total, goal, extents) < 0) {
+        std::cerr << "Error: Not enough free blocks to relocate '" << name << "' (" << total << " needed)." << std::endl;
+        return;
+    }
+    if (extents.size() >= oldExtents) {
+        // Os trechos livres não dão um layout melhor que o atual
+        std::vector<unsigned int> reserved;
+        for (const auto& extent : extents) {
+            for (unsigned int i = 0; i < extent.second; i++) reserved.push_back(extent.first + i);
+        }
+        freeBlocks(reserved);
+        std::cout << "File '" << name << "' cannot be made more contiguous with the current free space ("
+                  << oldExtents << " extent(s))." << std::endl;
+        return;
+    }
+    std::vector<unsigned int> newBlock; // Posição no layout -> bloco físico
+    newBlock.reserve(total);
+    for (const auto& extent : extents) {
+        for (unsigned int i = 0; i < extent.second; i++) newBlock.push_back(extent.first + i);
+    }
+
+    // Preenche os ponteiros com as novas posições
+    ext2_inode newInode = oldInode;
+    memset(newInode.i_block, 0, sizeof(newInode.i_block));
+    std::vector<unsigned int> dataPosition(mapping.size());
+    for (unsigned int pos = 0; pos < total; pos++) {
+        if (layout[pos].first) dataPosition[layout[pos].second] = pos;
+    }
+    for (size_t m = 0; m < mapping.size(); m++) {
+        unsigned int newPhys = newBlock[dataPosition[m]];
+        if (paths[m].empty()) {
+            newInode.i_block[mapping[m].first] = newPhys;
+            continue;
+        }
+        // Topo do caminho no inode; cada nível aponta para o seguinte
+        const PathStep& top = paths[m].front();
+        newInode.i_block[top.key >> 56] = newBlock[nodes[top.key].position];
+        for (size_t step = 0; step < paths[m].size(); step++) {
+            unsigned int target = (step + 1 < paths[m].size())
+                ? newBlock[nodes[paths[m][step + 1].key].position]
+                : newPhys;
+            nodes[paths[m][step].key].pointers[paths[m][step].index] = target;
+        }
+    }
+
+    // Copia em blocos grandes: cada trecho contíguo do lote é escrito com uma única chamada
+    const unsigned int batch = 256;
+    std::vector<char> buffer((size_t)batch * blockSize);
+    for (unsigned int pos = 0; pos < total; pos += batch) {
+        unsigned int count = std::min(batch, total - pos);
+        for (unsigned int i = 0; i < count; i++) {
+            char* dst = &buffer[(size_t)i * blockSize];
+            const auto& item = layout[pos + i];
+            if (item.first) {
+                readBlock(mapping[item.second].second, dst);
+            } else {
+                memcpy(dst, nodes[item.second].pointers.data(), blockSize);
+            }
+        }
+        for (unsigned int i = 0; i < count;) {
+            unsigned int run = 1;
+            while (i + run < count && newBlock[pos + i + run] == newBlock[pos + i] + run) run++;
+            writeBlockRun(newBlock[pos + i], run, &buffer[(size_t)i * blockSize]);
+            i += run;
+        }
+    }
+
+    // Só depois de os dados estarem no lugar novo o inode passa a apontar para lá
+    writeInode(inodeNum, &newInode);
+    std::vector<unsigned int> oldBlocks;
+    collectInodeBlocks(oldInode, oldBlocks);
+    freeBlocks(oldBlocks);
+
+    std::cout << "File '" << name << "' defragmented: " << dataBlocks << " data blocks in "
+              << countExtents(newInode, nullptr) << " extent(s), starting at block " << newBlock.front() << "."
+              << std::endl;
+}
+
+// --- Comandos que leem arquivos em paralelo (sum, grep) ---
+
+// Executa task(0) ... task(count - 1) com um pool de threads: cada thread
+// pega o próximo índice até acabar. A thread do comando também trabalha e
+// continua com fsMutex, então nada muda a imagem enquanto as outras leem.
+// Se uma tarefa lança exceção, as threads param de pegar índices e, depois
+// que todas terminam, a primeira exceção é relançada na thread do comando.
+void Ext2Shell::parallelFor(size_t count, const std::function<void(size_t)>& task) {
+    std::atomic<size_t> next(0);
+    std::exception_ptr failure;
+    std::mutex failureMutex;
+    auto worker = [&]() {
+        try {
+            for (size_t i = next++; i < count; i = next++) {
+                task(i);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(failureMutex);
+            if (!failure) failure = std::current_exception();
+            next = count;
+        }
+    };
+
+    unsigned int threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+    threads = std::min(threads, (unsigned int)MAX_WORKER_THREADS);
+    std::vector<std::thread> pool;
+    for (unsigned int t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+    if (failure) std::rethrow_exception(failure);
+}
+
+// --- Somas de verificação (comando sum) ---
+
+namespace {
+
+// CRC32C (Castagnoli, polinômio refletido 0x82F63B78), o mesmo do ext4
+uint32_t crc32cSoftware(uint32_t crc, const unsigned char* data, size_t length) {
+    static const std::vector<uint32_t> table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c >> 1) ^ (0x82F63B78 & (0 - (c & 1)));
+            t[i] = c;
+        }
+        return t;
+    }();
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+// Com SSE4.2 a CPU calcula o CRC32C em hardware, 8 bytes por instrução
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(uint32_t crc, const unsigned char* data, size_t length) {
+    uint64_t wide = crc;
+    while (length >= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        wide = _mm_crc32_u64(wide, word);
+        data += sizeof(word);
+        length -= sizeof(word);
+    }
+    crc = (uint32_t)wide;
+    while (length-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32cUpdate(uint32_t crc, const unsigned char* data, size_t length) {
+#if defined(__x86_64__)
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    if (hardware) return crc32cHardware(crc, data, length);
+#endif
+    return crc32cSoftware(crc, data, length);
+}
+
+// SHA-256 (FIPS 180-4), para manifestos compatíveis com sha256sum
+class Sha256 {
+public:
+    Sha256() : length(0), used(0) {
+        static const uint32_t initial[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+        memcpy(state, initial, sizeof(state));
+    }
+
+    void update(const unsigned char* data, size_t size) {
+        length += size;
+        if (used > 0) {
+            size_t take = std::min(size, sizeof(buffer) - used);
+            memcpy(buffer + used, data, take);
+            used += take;
+            data += take;
+            size -= take;
+            if (used < sizeof(buffer)) return;
+            compress(buffer);
+            used = 0;
+        }
+        for (; size >= sizeof(buffer); data += sizeof(buffer), size -= sizeof(buffer)) {
+            compress(data);
+        }
+        memcpy(buffer, data, size);
+        used = size;
+    }
+
+    std::string hexDigest() {
+        uint64_t bits = length * 8;
+        unsigned char padding[72] = { 0x80 };
+        size_t padLength = (used < 56 ? 56 : 120) - used;
+        update(padding, padLength);
+        for (int i = 0; i < 8; i++) padding[i] = (unsigned char)(bits >> (56 - 8 * i));
+        update(padding, 8);
+
+        std::ostringstream out;
+        for (uint32_t word : state) out << std::hex << std::setw(8) << std::setfill('0') << word;
+        return out.str();
+    }
+
+private:
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char buffer[64];
+    size_t used;
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const unsigned char* block) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+                   (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
         }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+};
+
+} // namespace
+
+// Calcula a soma de um arquivo direto dos seus blocos de dados; buracos
+// entram como zeros. Pode rodar em várias threads ao mesmo tempo (só lê).
+std::string Ext2Shell::checksumFile(const ext2_inode& inode, bool sha256) {
+    static const unsigned char zeros[65536] = {};
+    uint32_t crc = 0xFFFFFFFF;
+    Sha256 sha;
+    auto feed = [&](const unsigned char* data, size_t length) {
+        if (sha256) sha.update(data, length);
+        else crc = crc32cUpdate(crc, data, length);
+    };
+
+    forEachFileExtent(inode, [&](unsigned long long, const char* data, size_t length) {
+        if (data) {
+            feed(reinterpret_cast<const unsigned char*>(data), length);
+            return;
+        }
+        for (size_t chunk; length > 0; length -= chunk) {
+            chunk = std::min(length, sizeof(zeros));
+            feed(zeros, chunk);
+        }
+    });
+
+    if (sha256) return sha.hexDigest();
+    std::ostringstream out;
+    out << std::hex << std::setw(8) << std::setfill('0') << (crc ^ 0xFFFFFFFF);
+    return out.str();
+}
+
+// Calcula as somas de vários arquivos em paralelo. Erros de leitura de um
+// arquivo viram uma mensagem no lugar da soma, sem parar os outros.
+void Ext2Shell::checksumFiles(std::vector<SumJob>& jobs) {
+    parallelFor(jobs.size(), [&](size_t i) {
+        try {
+            jobs[i].digest = checksumFile(jobs[i].inode, jobs[i].sha256);
+        } catch (const std::exception& e) {
+            jobs[i].error = e.what();
+        }
+    });
+}
+
+// sum [-a crc32c|sha256] <arquivo/dir>: soma de um arquivo ou de todos os
+// arquivos regulares de uma subárvore, no formato do sha256sum
+// sum -c <manifesto>: confere as somas de um manifesto do sistema local
+void Ext2Shell::cmd_sum(const std::vector<std::string>& args) {
+    if (args.size() == 2 && args[0] == "-c") {
+        checkManifest(args[1]);
         return;
     }
-    
-    if (path == ".") return;
 
-    unsigned int inodeNum = getInodeByName(path);
+    bool sha256 = false;
+    std::string name;
+    if (args.size() == 3 && args[0] == "-a" && (args[1] == "crc32c" || args[1] == "sha256")) {
+        sha256 = args[1] == "sha256";
+        name = args[2];
+    } else if (args.size() == 1) {
+        name = args[0];
+    } else {
+        std::cerr << "Usage: sum [-a crc32c|sha256] <file/dir> | sum -c <manifest>" << std::endl;
+        return;
+    }
+
+    unsigned int inodeNum = resolvePath(name);
     if (inodeNum == 0) {
-        std::cerr << "Error: Directory '" << path << "' not found." << std::endl;
+        std::cerr << "Error: File or directory '" << name << "' not found." << std::endl;
         return;
     }
 
-    ext2_inode newInode;
-    readInode(inodeNum, &newInode);
-    if (!S_ISDIR(newInode.i_mode)) {
-        std::cerr << "Error: '" << path << "' is not a directory." << std::endl;
+    std::vector<SumJob> jobs;
+    ext2_inode inode;
+    readInode(inodeNum, &inode);
+    if (S_ISDIR(inode.i_mode)) {
+        forEachInodeInTree(inodeNum, name, [&](const std::string& path, unsigned int, const ext2_inode& child) {
+            if (S_ISREG(child.i_mode)) jobs.push_back({path, child, sha256, "", ""});
+        });
+    } else if (S_ISREG(inode.i_mode)) {
+        jobs.push_back({name, inode, sha256, "", ""});
+    } else {
+        std::cerr << "Error: '" << name << "' is not a regular file or directory." << std::endl;
         return;
     }
 
-    updateCurrentDirectory(inodeNum);
-    currentPath.push_back(path);
+    checksumFiles(jobs);
+    for (const SumJob& job : jobs) {
+        if (!job.error.empty()) {
+            std::cerr << job.error << " (" << job.path << ")" << std::endl;
+        } else {
+            std::cout << job.digest << "  " << job.path << std::endl;
+        }
+    }
 }
 
-// Exibe o caminho atual
-void Ext2Shell::cmd_pwd() {
-    // Inicia a string do caminho sempre com a barra da raiz.
-    std::string pathStr = "/";
+// Confere um manifesto (linhas "<soma>  <caminho>", como as do sha256sum ou
+// do próprio sum). O algoritmo sai do tamanho da soma: 8 dígitos hexadecimais
+// para CRC32C, 64 para SHA-256. Caminhos relativos partem do diretório atual.
+void Ext2Shell::checkManifest(const std::string& manifestPath) {
+    std::ifstream manifest(manifestPath);
+    if (!manifest) {
+        std::cerr << "Error: Could not open manifest '" << manifestPath << "'." << std::endl;
+        return;
+    }
 
-    // Percorre o vetor que armazena as partes do caminho (ex: "banana", "subpasta").
-    for (const auto& part : currentPath) {
-        // Adiciona cada parte do caminho seguida por uma barra.
-        pathStr += part + "/";
+    std::vector<SumJob> jobs;
+    std::vector<std::string> expected;
+    unsigned int missing = 0, malformed = 0;
+    std::string line;
+    while (std::getline(manifest, line)) {
+        if (line.empty()) continue;
+        size_t space = line.find(' ');
+        std::string digest = line.substr(0, space);
+        bool hex = std::all_of(digest.begin(), digest.end(), [](char c) { return isxdigit((unsigned char)c); });
+        // Depois da soma vêm dois espaços, ou " *" no modo binário do sha256sum
+        if (space == std::string::npos || space + 2 > line.size() || !hex ||
+            (digest.size() != 8 && digest.size() != 64) || (line[space + 1] != ' ' && line[space + 1] != '*')) {
+            malformed++;
+            continue;
+        }
+        std::string path = line.substr(space + 2);
+
+        unsigned int inodeNum = resolvePath(path);
+        ext2_inode inode;
+        if (inodeNum != 0) readInode(inodeNum, &inode);
+        if (inodeNum == 0 || !S_ISREG(inode.i_mode)) {
+            std::cout << path << ": FAILED open" << std::endl;
+            missing++;
+            continue;
+        }
+        std::transform(digest.begin(), digest.end(), digest.begin(), ::tolower);
+        jobs.push_back({path, inode, digest.size() == 64, "", ""});
+        expected.push_back(digest);
     }
 
-    // Imprime a string do caminho final.
-    std::cout << pathStr << std::endl;
+    checksumFiles(jobs);
+    unsigned int failed = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        bool ok = jobs[i].error.empty() && jobs[i].digest == expected[i];
+        std::cout << jobs[i].path << ": " << (ok ? "OK" : "FAILED") << std::endl;
+        if (!ok) failed++;
+    }
+    std::cout << jobs.size() - failed << " OK, " << failed << " FAILED, " << missing << " missing";
+    if (malformed > 0) std::cout << ", " << malformed << " malformed line(s)";
+    std::cout << "." << std::endl;
 }
 
-// --- Implementações dos Comandos de Manipulação de Arquivos e Diretórios ---
-
-// Exibe os atributos de um arquivo ou diretório
-void Ext2Shell::cmd_attr(const std::string& name) {
-    // Encontra o inode pelo nome no diretório atual
-    unsigned int inodeNum = getInodeByName(name);
-    if (inodeNum == 0) {
-        std::cerr << "Error: File or directory '" << name << "' not found." << std::endl;
-        return;
+// --- Busca de conteúdo (comando grep) ---
+
+namespace {
+
+#if defined(__x86_64__)
+// Busca com AVX2: compara o primeiro e o último byte do padrão em 32
+// posições por vez; só as posições em que os dois batem são conferidas
+// com memcmp. O restante (menos de 32 posições) fica com o memmem.
+__attribute__((target("avx2")))
+const char* findPatternAvx2(const char* data, size_t length, const char* pattern, size_t patternLength) {
+    const __m256i first = _mm256_set1_epi8(pattern[0]);
+    const __m256i last = _mm256_set1_epi8(pattern[patternLength - 1]);
+    size_t i = 0;
+    for (; i + patternLength - 1 + 32 <= length; i += 32) {
+        __m256i blockFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i blockLast = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + patternLength - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst),
+                                                              _mm256_cmpeq_epi8(last, blockLast)));
+        while (mask != 0) {
+            unsigned int bit = __builtin_ctz(mask);
+            if (memcmp(data + i + bit + 1, pattern + 1, patternLength - 2) == 0) return data + i + bit;
+            mask &= mask - 1;
+        }
     }
+    if (i >= length) return nullptr;
+    return static_cast<const char*>(memmem(data + i, length - i, pattern, patternLength));
+}
+#endif
+
+// Primeira ocorrência do padrão em [data, data + length), ou nulo
+const char* findPattern(const char* data, size_t length, const std::string& pattern) {
+    if (pattern.size() > length) return nullptr;
+    if (pattern.size() == 1) return static_cast<const char*>(memchr(data, pattern[0], length));
+#if defined(__x86_64__)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) return findPatternAvx2(data, length, pattern.data(), pattern.size());
+#endif
+    return static_cast<const char*>(memmem(data, length, pattern.data(), pattern.size()));
+}
 
-    // Ler os dados do inode
-    ext2_inode targetInode;
-    readInode(inodeNum, &targetInode);
+} // namespace
+
+// Procura um padrão (texto literal) em um arquivo, lendo os blocos em ordem.
+// Só linhas completas são pesquisadas; a linha incompleta no fim do que já
+// foi lido passa para o próximo bloco, então ocorrências que atravessam a
+// fronteira entre blocos são encontradas. Linhas maiores que GREP_MAX_LINE
+// são pesquisadas aos pedaços, guardando só o fim (tamanho do padrão - 1).
+// Retorna as linhas "caminho:offset:linha" (offset da ocorrência no arquivo).
+std::string Ext2Shell::grepFile(const std::string& path, const ext2_inode& inode, const std::string& pattern,
+                                bool countOnly) {
+    std::ostringstream out;
+    unsigned long long matches = 0;
+    std::string buffer;                 // Linha incompleta + dados recém-lidos
+    unsigned long long bufferStart = 0; // Offset de buffer[0] no arquivo
+    const bool zeroInPattern = pattern.find('\0') != std::string::npos;
+    bool lineMatched = false;           // A linha incompleta em buffer já casou
+
+    // Procura em buffer[begin, end), uma ocorrência por linha
+    auto search = [&](size_t begin, size_t end) {
+        const char* base = buffer.data();
+        if (lineMatched) {
+            // Resto de uma linha longa já contada: pula até o fim dela
+            const char* lineEnd = static_cast<const char*>(memchr(base + begin, '\n', end - begin));
+            if (!lineEnd) return;
+            lineMatched = false;
+            begin = lineEnd - base + 1;
+        }
+        while (begin < end) {
+            const char* found = findPattern(base + begin, end - begin, pattern);
+            if (!found) return;
+            size_t at = found - base;
+            const char* lineEnd = static_cast<const char*>(memchr(found, '\n', end - at));
+            size_t stop = lineEnd ? lineEnd - base : end;
+            matches++;
+            if (!countOnly) {
+                size_t lineStart = at;
+                while (lineStart > 0 && base[lineStart - 1] != '\n') lineStart--;
+                size_t shown = std::min<size_t>(stop - lineStart, GREP_MAX_LINE);
+                out << path << ":" << bufferStart + at << ":" << std::string(base + lineStart, shown) << "\n";
+            }
+            if (!lineEnd) lineMatched = true; // A linha continua depois de 'end'
+            begin = stop + 1;
+        }
+    };
+
+    // Pesquisa a linha incompleta longa demais e guarda só o fim dela
+    auto trimLongLine = [&]() {
+        search(0, buffer.size());
+        size_t keep = std::min(buffer.size(), pattern.size() - 1);
+        bufferStart += buffer.size() - keep;
+        buffer.erase(0, buffer.size() - keep);
+    };
+
+    forEachFileExtent(inode, [&](unsigned long long, const char* data, size_t length) {
+        if (!data && !zeroInPattern) {
+            // Buraco: só zeros, que não casam com o padrão e não têm '\n'
+            trimLongLine();
+            bufferStart += length + buffer.size();
+            buffer.clear();
+            return;
+        }
+        if (data) {
+            buffer.append(data, length);
+        } else {
+            buffer.append(length, '\0');
+        }
 
-    // Formatar as informações extraidas
-    std::string perms_str = formatPermissions(targetInode.i_mode);
-    std::string size_str = formatSize(targetInode.i_size);
-    std::string mtime_str = formatTime(targetInode.i_mtime);
+        const char* lastNewline = static_cast<const char*>(memrchr(buffer.data(), '\n', buffer.size()));
+        if (lastNewline) {
+            size_t complete = lastNewline - buffer.data() + 1;
+            search(0, complete);
+            buffer.erase(0, complete);
+            bufferStart += complete;
+        }
+        if (buffer.size() > GREP_MAX_LINE) {
+            trimLongLine();
+        }
+    });
+    search(0, buffer.size()); // Última linha, sem '\n' no fim
 
-    // Printar o header e as informações extraidas
-    std::cout << " permissões  uid  gid      tamanho      modificado em" << std::endl;
-    std::cout << std::left 
-              << std::setw(12) << perms_str
-              << std::setw(5) << targetInode.i_uid
-              << std::setw(5) << targetInode.i_gid
-              << std::setw(15) << size_str
-              << mtime_str << std::endl;
+    if (countOnly) {
+        out << path << ":" << matches << "\n";
+    }
+    return out.str();
 }
 
-// Exibe o conteúdo de um arquivo
-void Ext2Shell::cmd_cat(const std::string& name) {
-    // Verifica se o arquivo existe
-    unsigned int inodeNum = getInodeByName(name);
-    if (inodeNum == 0) {
-        std::cerr << "Error: File '" << name << "' not found." << std::endl;
+// grep [-c] <padrão> <arquivo/dir>: procura o texto nos arquivos regulares
+// (um arquivo ou toda a subárvore, vários arquivos em paralelo)
+void Ext2Shell::cmd_grep(const std::vector<std::string>& args) {
+    bool countOnly = args.size() == 3 && args[0] == "-c";
+    if ((args.size() != 2 && !countOnly) || args[args.size() - 2].empty()) {
+        std::cerr << "Usage: grep [-c] <pattern> <file/dir>" << std::endl;
         return;
     }
+    const std::string& pattern = args[args.size() - 2];
+    const std::string& name = args.back();
 
-    ext2_inode fileInode;
-    readInode(inodeNum, &fileInode);
-
-    // Verifica se é um arquivo regular
-    if (!S_ISREG(fileInode.i_mode)) {
-        std::cerr << "Error: '" << name << "' is not a regular file." << std::endl;
+    unsigned int inodeNum = resolvePath(name);
+    if (inodeNum == 0) {
+        std::cerr << "Error: File or directory '" << name << "' not found." << std::endl;
         return;
     }
 
-    // Lê os blocos do arquivo e imprime o conteúdo
-    std::vector<char> buffer(blockSize);
-    unsigned int bytesRead = 0;
-    const unsigned int fileSize = fileInode.i_size; // Tamanho do arquivo
-
-    // Lê os 12 blocos diretos do inode do arquivo
-    for (int i = 0; i < 12 && bytesRead < fileSize; i++) {
-        // Se o ponteiro do bloco for 0, não há mais blocos para ler
-        if (fileInode.i_block[i] == 0) break;
-
-        // Lê o bloco do arquivo de origem pro buffer
-        readBlock(fileInode.i_block[i], buffer.data());
+    std::vector<std::pair<std::string, ext2_inode>> files;
+    ext2_inode inode;
+    readInode(inodeNum, &inode);
+    if (S_ISDIR(inode.i_mode)) {
+        forEachInodeInTree(inodeNum, name, [&](const std::string& path, unsigned int, const ext2_inode& child) {
+            if (S_ISREG(child.i_mode)) files.emplace_back(path, child);
+        });
+    } else if (S_ISREG(inode.i_mode)) {
+        files.emplace_back(name, inode);
+    } else {
+        std::cerr << "Error: '" << name << "' is not a regular file or directory." << std::endl;
+        return;
+    }
 
-        unsigned int bytesToWrite = std::min((unsigned int)blockSize,fileSize - bytesRead); // Calcula quantos bytes escrever neste bloco
+    std::vector<std::string> results(files.size());
+    std::vector<std::string> errors(files.size());
+    parallelFor(files.size(), [&](size_t i) {
+        try {
+            results[i] = grepFile(files[i].first, files[i].second, pattern, countOnly);
+        } catch (const std::exception& e) {
+            errors[i] = e.what();
+        }
+    });
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!errors[i].empty()) {
+            std::cerr << errors[i] << " (" << files[i].first << ")" << std::endl;
+        }
+        std::cout << results[i];
+    }
+    std::cout.flush();
+}
 
-        // Imprime o conteúdo do bloco lido
-        std::cout.write(buffer.data(), bytesToWrite);
-        bytesRead += bytesToWrite;
+// --- Duplicatas (comando dedupscan) ---
+
+namespace {
+
+// xxHash64 (seed 0): rápido e com 64 bits, suficiente para indexar blocos
+uint64_t xxh64(const unsigned char* data, size_t length) {
+    const uint64_t p1 = 11400714785074694791ULL, p2 = 14029467366897019727ULL, p3 = 1609587929392839161ULL;
+    const uint64_t p4 = 9650029242287828579ULL, p5 = 2870177450012600261ULL;
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto read64 = [](const unsigned char* p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; };
+    auto round = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * p2, 31) * p1; };
+    auto merge = [&](uint64_t acc, uint64_t value) { return (acc ^ round(0, value)) * p1 + p4; };
+
+    const unsigned char* p = data;
+    const unsigned char* end = data + length;
+    uint64_t h;
+    if (length >= 32) {
+        uint64_t v1 = p1 + p2, v2 = p2, v3 = 0, v4 = 0 - p1;
+        do {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+    } else {
+        h = p5;
+    }
+    h += length;
+    for (; p + 8 <= end; p += 8) {
+        h = rotl(h ^ round(0, read64(p)), 27) * p1 + p4;
     }
+    if (p + 4 <= end) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        h = rotl(h ^ (v * p1), 23) * p2 + p3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h = rotl(h ^ (*p * p5), 11) * p1;
+    }
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p3;
+    h ^= h >> 32;
+    return h;
+}
 
-    // Bloco indireto simples (12º bloco)
-    if (bytesRead < fileSize && fileInode.i_block[12] != 0) {
-        std::vector<unsigned int> indirectBlockPointers(blockSize / sizeof(unsigned int));
-        readBlock(fileInode.i_block[12], indirectBlockPointers.data());
+} // namespace
+
+// dedupscan [--link]: procura blocos e arquivos com conteúdo repetido.
+//
+// Os blocos ocupados vêm dos bitmaps de cada grupo (os metadados fixos do
+// grupo ficam de fora); cada grupo é lido e indexado em paralelo, gerando
+// pares (hash, bloco). Um arquivo vira uma assinatura: tamanho mais os
+// hashes dos seus blocos em ordem lógica. Com --link, cada conjunto de
+// arquivos iguais (confirmados por SHA-256) vira hard links para o primeiro.
+void Ext2Shell::cmd_dedupscan(const std::vector<std::string>& args) {
+    bool link = args.size() == 1 && args[0] == "--link";
+    if (!args.empty() && !link) {
+        std::cerr << "Usage: dedupscan [--link]" << std::endl;
+        return;
+    }
 
-        // Percorre os ponteiros do bloco indireto
-        for (unsigned int dataBlockNum : indirectBlockPointers) {
-            if (dataBlockNum == 0) break; // Se o ponteiro for 0, não há mais blocos
+    // 1. Hash de cada bloco ocupado, um grupo por tarefa
+    struct BlockHash { uint64_t hash; unsigned int block; };
+    unsigned int numGroups = groupCount();
+    std::vector<std::vector<BlockHash>> perGroup(numGroups);
+    parallelFor(numGroups, [&](size_t group) {
+        ext2_group_desc groupDesc;
+        readGroupDesc(group, &groupDesc);
+        if (uninitGroupsEnabled() && (groupDesc.bg_flags & EXT2_BG_BLOCK_UNINIT)) return; // Só metadados
+
+        unsigned int first = group * super.s_blocks_per_group + super.s_first_data_block;
+        unsigned int groupBlocks = blocksInGroup(group);
+        unsigned int tableBlocks = (super.s_inodes_per_group * inodeSize + blockSize - 1) / blockSize;
+        unsigned int headerEnd = first;
+        if (groupHasSuper(group, super.s_feature_ro_compat)) {
+            headerEnd += 1 + (numGroups * sizeof(ext2_group_desc) + blockSize - 1) / blockSize + super.s_reserved_gdt_blocks;
+        }
+        auto isMetadata = [&](unsigned int block) {
+            return block < headerEnd || block == groupDesc.bg_block_bitmap || block == groupDesc.bg_inode_bitmap ||
+                   (block >= groupDesc.bg_inode_table && block < groupDesc.bg_inode_table + tableBlocks);
+        };
+
+        BlockBuffer bitmapBuffer = blockPool.acquire();
+        unsigned char* bitmap = bitmapBuffer.as<unsigned char>();
+        readBlockBitmap(group, groupDesc, bitmap);
+
+        std::vector<unsigned int> pending;
+        BlockBuffer batchBuffer = blockPool.acquireBatch();
+        char* batch = batchBuffer.data();
+        auto flush = [&]() {
+            readBlocks(pending, batch);
+            for (size_t i = 0; i < pending.size(); i++) {
+                const unsigned char* data = reinterpret_cast<const unsigned char*>(batch + i * blockSize);
+                perGroup[group].push_back({xxh64(data, blockSize), pending[i]});
+            }
+            pending.clear();
+        };
+        for (unsigned int i = 0; i < groupBlocks; i++) {
+            if (!isBitSet(bitmap, i) || isMetadata(first + i)) continue;
+            pending.push_back(first + i);
+            if (pending.size() == IO_BATCH_BLOCKS) flush();
+        }
+        if (!pending.empty()) flush();
+    });
 
-            readBlock(dataBlockNum, buffer.data());
-            unsigned int bytesToWrite = std::min((unsigned int)blockSize, fileSize - bytesRead);
-            std::cout.write(buffer.data(), bytesToWrite);
-            bytesRead += bytesToWrite;
+    // 2. Índice hash -> blocos: blocos com o mesmo hash são duplicatas
+    std::vector<BlockHash> index;
+    for (std::vector<BlockHash>& hashes : perGroup) {
+        index.insert(index.end(), hashes.begin(), hashes.end());
+        std::vector<BlockHash>().swap(hashes);
+    }
+    std::sort(index.begin(), index.end(), [](const BlockHash& a, const BlockHash& b) {
+        return a.hash != b.hash ? a.hash < b.hash : a.block < b.block;
+    });
+    unsigned long long duplicateBlocks = 0, sharedContents = 0;
+    for (size_t i = 0, j; i < index.size(); i = j) {
+        for (j = i + 1; j < index.size() && index[j].hash == index[i].hash; j++) {}
+        if (j - i > 1) {
+            duplicateBlocks += j - i - 1;
+            sharedContents++;
         }
     }
 
-    // Bloco indireto duplo (13º bloco)
-    if (bytesRead < fileSize && fileInode.i_block[13] !=0) {
-        std::vector<unsigned int> doubleIndirectBlockPointers(blockSize / sizeof(unsigned int));
-        readBlock(fileInode.i_block[13], doubleIndirectBlockPointers.data());
+    // 3. Assinatura de cada arquivo, a partir dos hashes dos seus blocos
+    std::sort(index.begin(), index.end(), [](const BlockHash& a, const BlockHash& b) { return a.block < b.block; });
+    auto blockHash = [&](unsigned int block) {
+        auto found = std::lower_bound(index.begin(), index.end(), block,
+                                      [](const BlockHash& entry, unsigned int value) { return entry.block < value; });
+        return (found != index.end() && found->block == block) ? found->hash : 0;
+    };
+
+    struct FileSignature {
+        unsigned long long size;
+        uint64_t signature;
+        std::string path;
+        unsigned int inodeNum;
+        ext2_inode inode;
+    };
+    std::vector<FileSignature> files;
+    std::unordered_set<unsigned int> seenInodes; // Hard links já existentes contam uma vez
+    forEachInodeInTree(EXT2_ROOT_INO, "/", [&](const std::string& path, unsigned int inodeNum, const ext2_inode& inode) {
+        if (!S_ISREG(inode.i_mode) || inodeFileSize(inode) == 0 || !seenInodes.insert(inodeNum).second) return;
+        std::vector<uint64_t> parts;
+        forEachBlockNumber(inode, [&](unsigned int logical, unsigned int phys) {
+            parts.push_back(logical);
+            parts.push_back(blockHash(phys));
+            return true;
+        });
+        uint64_t signature = xxh64(reinterpret_cast<const unsigned char*>(parts.data()), parts.size() * sizeof(uint64_t));
+        files.push_back({inodeFileSize(inode), signature, path, inodeNum, inode});
+    });
+    std::stable_sort(files.begin(), files.end(), [](const FileSignature& a, const FileSignature& b) {
+        return a.size != b.size ? a.size < b.size : a.signature < b.signature;
+    });
 
-        // Percorre os ponteiros do bloco indireto duplo
-        for (unsigned int indirectBlockNum : doubleIndirectBlockPointers) {
-            if (indirectBlockNum == 0) break; // Se o ponteiro for 0, não há mais blocos
+    unsigned long long duplicateFiles = 0, fileSets = 0, fileBytes = 0;
+    std::vector<std::pair<size_t, size_t>> sets; // [início, fim) em files
+    for (size_t i = 0, j; i < files.size(); i = j) {
+        for (j = i + 1; j < files.size() && files[j].size == files[i].size &&
+                        files[j].signature == files[i].signature; j++) {
+            fileBytes += (unsigned long long)files[j].inode.i_blocks * 512;
+        }
+        if (j - i > 1) {
+            duplicateFiles += j - i - 1;
+            fileSets++;
+            sets.emplace_back(i, j);
+        }
+    }
 
-            std::vector<unsigned int> indirectDataBlockPointers(blockSize / sizeof(unsigned int));
-            readBlock(indirectBlockNum, indirectDataBlockPointers.data());
+    std::cout << "Scanned " << index.size() << " allocated data blocks in " << numGroups << " groups." << std::endl;
+    std::cout << "Duplicate blocks: " << duplicateBlocks << " (copies of " << sharedContents << " distinct blocks), "
+              << duplicateBlocks * blockSize / 1024 << " KiB reclaimable." << std::endl;
+    std::cout << "Duplicate files: " << duplicateFiles << " in " << fileSets << " sets, "
+              << fileBytes / 1024 << " KiB reclaimable with hard links." << std::endl;
+    if (!link) return;
+
+    // 4. --link: troca cada cópia por um hard link para o primeiro arquivo
+    // do conjunto. Só junta arquivos com o mesmo dono, grupo e permissões,
+    // e confere o conteúdo inteiro antes de mexer.
+    unsigned long long linked = 0, freedBytes = 0;
+    for (const auto& set : sets) {
+        FileSignature& keep = files[set.first];
+        std::string keepDigest = checksumFile(keep.inode, true);
+        for (size_t k = set.first + 1; k < set.second; k++) {
+            FileSignature& copy = files[k];
+            if (copy.inode.i_mode != keep.inode.i_mode || copy.inode.i_uid != keep.inode.i_uid ||
+                copy.inode.i_gid != keep.inode.i_gid || checksumFile(copy.inode, true) != keepDigest) {
+                continue;
+            }
 
-            // Lê cada bloco apontado pelo bloco indireto duplo
-            for (unsigned int dataBlockNum : indirectDataBlockPointers) {
-                if (dataBlockNum == 0) break; // Se o ponteiro for 0, não há mais blocos
+            size_t slash = copy.path.rfind('/');
+            std::string name = copy.path.substr(slash + 1);
+            unsigned int parentInodeNum = resolvePath(slash == 0 ? "/" : copy.path.substr(0, slash));
+            if (parentInodeNum == 0 || !removeDirectoryEntry(parentInodeNum, name)) continue;
+            if (addDirectoryEntry(parentInodeNum, keep.inodeNum, name, EXT2_FT_REG_FILE) < 0) {
+                std::cerr << "Error: Could not link '" << copy.path << "'; the copy was kept." << std::endl;
+                addDirectoryEntry(parentInodeNum, copy.inodeNum, name, EXT2_FT_REG_FILE);
+                continue;
+            }
 
-                readBlock(dataBlockNum, buffer.data());
-                unsigned int bytesToWrite = std::min((unsigned int)blockSize, fileSize - bytesRead);
-                std::cout.write(buffer.data(), bytesToWrite);
-                bytesRead += bytesToWrite;
+            readInode(keep.inodeNum, &keep.inode);
+            keep.inode.i_links_count++;
+            writeInode(keep.inodeNum, &keep.inode);
+            readInode(copy.inodeNum, &copy.inode);
+            copy.inode.i_links_count--;
+            writeInode(copy.inodeNum, &copy.inode);
+            if (copy.inode.i_links_count == 0) {
+                orphanAdd(copy.inodeNum, copy.inode);
+                freedBytes += (unsigned long long)copy.inode.i_blocks * 512;
             }
+            linked++;
+            std::cout << "Linked '" << copy.path << "' to '" << keep.path << "'." << std::endl;
         }
     }
+    reaperCv.notify_one();
+    std::cout << "Linked " << linked << " files, freeing " << freedBytes / 1024 << " KiB." << std::endl;
+}
 
-    // Verifica se leu todo o arquivo
-    if (bytesRead < fileSize) {
-        std::cerr << "Error: Failed to read entire file '" << name << "'." << std::endl;
+// --- Exportação em tar (comando export-tar) ---
+
+namespace {
+
+// Escreve um arquivo tar POSIX (ustar, com cabeçalhos pax quando um campo não
+// cabe) em um descritor ou em um stream. A saída é acumulada em um buffer de
+// TAR_WRITE_BUFFER bytes e escrita em poucas chamadas grandes.
+class TarWriter {
+public:
+    struct Entry {
+        std::string name;     // Caminho dentro do arquivo tar
+        char type;            // '0' arquivo, '1' hard link, '2' symlink, '3'/'4' dispositivo, '5' dir, '6' FIFO
+        unsigned int mode;    // Só as permissões (07777)
+        unsigned int uid, gid;
+        unsigned long long size;
+        unsigned long long mtime;
+        std::string linkName; // Destino de hard links e symlinks
+        unsigned int devMajor, devMinor;
+    };
+
+    TarWriter(int fd, std::ostream* stream) : fd(fd), stream(stream) {
+        buffer.reserve(TAR_WRITE_BUFFER);
     }
 
-    // Adiciona uma linha vazia ao final da saída
-    std::cout << std::endl;
-}
+    // Cabeçalho de um item; depois dele vêm 'size' bytes de dados (data/zeros)
+    void header(const Entry& entry) {
+        std::string pax;
+        std::string name = entry.name, prefix;
+        if (name.size() > 100 && !splitName(entry.name, prefix, name)) {
+            pax += paxRecord("path", entry.name);
+            name = entry.name.substr(0, 100);
+            prefix.clear();
+        }
+        if (entry.linkName.size() > 100) pax += paxRecord("linkpath", entry.linkName);
+        if (entry.size > 077777777777ULL) pax += paxRecord("size", std::to_string(entry.size));
+        if (entry.uid > 07777777) pax += paxRecord("uid", std::to_string(entry.uid));
+        if (entry.gid > 07777777) pax += paxRecord("gid", std::to_string(entry.gid));
+
+        if (!pax.empty()) {
+            char block[512] = {};
+            fillHeader(block, "PaxHeaders/" + name.substr(0, 88), "", 'x', 0644, 0, 0, pax.size(), entry.mtime, "", 0, 0);
+            append(block, sizeof(block));
+            data(pax.data(), pax.size());
+            pad(pax.size());
+        }
 
-// Cria um novo arquivo vazio
-void Ext2Shell::cmd_touch(const std::string& name) {
-    // Validar comprimento do nome
-    if (name.length() >= EXT2_NAME_LEN) {
-        std::cerr << "Error: Name too long (max " << EXT2_NAME_LEN - 1 << " characters)." << std::endl;        return;
+        char block[512] = {};
+        fillHeader(block, name, prefix, entry.type, entry.mode, entry.uid, entry.gid, entry.size, entry.mtime,
+                   entry.linkName.substr(0, 100), entry.devMajor, entry.devMinor);
+        append(block, sizeof(block));
     }
 
-    // Verifica se o arquivo já existe no diretório atual
-    if (getInodeByName(name) != 0) {
-        std::cerr << "Error: File '" << name << "' already exists." << std::endl;
-        return;
+    void data(const char* bytes, size_t length) {
+        append(bytes, length);
     }
 
-    // Tenta alocar um novo inode
-    int newInodeNum = allocateInode();
-    if (newInodeNum < 0) {
-        std::cerr << "Error: No free inodes available." << std::endl;
-        return;
+    void zeros(unsigned long long length) {
+        static const char zero[4096] = {};
+        while (length > 0) {
+            size_t chunk = std::min<unsigned long long>(length, sizeof(zero));
+            append(zero, chunk);
+            length -= chunk;
+        }
     }
 
-    // Inicializa o novo inode com valores padrão para arquivo regular
-    ext2_inode newInode = {};
-    newInode.i_mode = EXT2_S_IFREG | 0644;
-    newInode.i_uid = 0;
-    newInode.i_gid = 0;
-    newInode.i_size = 0;
-    newInode.i_links_count = 1;
-    newInode.i_blocks = 0;
-    newInode.i_atime = newInode.i_ctime = newInode.i_mtime = (uint32_t)time(nullptr);
-    memset(newInode.i_block, 0, sizeof(newInode.i_block));
-
-    // Escreve o novo inode no disco
-    writeInode(newInodeNum, &newInode);
-
-    // Adiciona a entrada do arquivo no diretório atual
-    if (addDirectoryEntry(currentInodeNum, newInodeNum, name, EXT2_FT_REG_FILE) < 0) {
-        std::cerr << "Error: Failed to add directory entry." << std::endl;
-        freeInode(newInodeNum);
-        return;
+    // Completa os dados do item até o próximo múltiplo de 512 bytes
+    void pad(unsigned long long size) {
+        zeros((512 - size % 512) % 512);
     }
 
-    std::cout << "File '" << name << "' created successfully." << std::endl;
-}
-
-// Cria um novo diretório
-void Ext2Shell::cmd_mkdir(const std::string& name) {
-    // Verifica se já existe arquivo ou diretório com o mesmo nome
-    if (getInodeByName(name) != 0) {
-        std::cerr << "Error: File or directory '" << name << "' already exists." << std::endl;
-        return;
+    // Dois blocos zerados marcam o fim do arquivo
+    bool finish() {
+        zeros(1024);
+        flush();
+        return !failed;
     }
 
-    // Aloca um inode para o novo diretório
-    int inodeNum = allocateInode();
-    if (inodeNum < 0) {
-        std::cerr << "Error: No free inodes available." << std::endl;
-        return;
+    bool ok() const { return !failed; }
+    unsigned long long bytesWritten() const { return written; }
+
+private:
+    int fd;
+    std::ostream* stream;
+    std::vector<char> buffer;
+    unsigned long long written = 0;
+    bool failed = false;
+
+    void append(const char* bytes, size_t length) {
+        while (length > 0) {
+            size_t chunk = std::min(length, (size_t)TAR_WRITE_BUFFER - buffer.size());
+            buffer.insert(buffer.end(), bytes, bytes + chunk);
+            bytes += chunk;
+            length -= chunk;
+            if (buffer.size() == TAR_WRITE_BUFFER) flush();
+        }
     }
 
-    // Aloca um bloco para armazenar as entradas '.' e '..'
-    int blockNum = allocateBlock();
-    if (blockNum < 0) {
-        std::cerr << "Error: No free blocks available." << std::endl;
-        freeInode(inodeNum); // Libera o inode já alocado
-        return;
+    void flush() {
+        if (!failed && !buffer.empty()) {
+            if (stream) {
+                failed = !stream->write(buffer.data(), buffer.size());
+            } else {
+                for (size_t done = 0; done < buffer.size();) {
+                    ssize_t n = write(fd, buffer.data() + done, buffer.size() - done);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n <= 0) {
+                        failed = true;
+                        break;
+                    }
+                    done += n;
+                }
+            }
+            written += buffer.size();
+        }
+        buffer.clear();
     }
 
-    // Prepara o inode com as propriedades do diretório
-    ext2_inode dirInode = {};
-    dirInode.i_mode = EXT2_S_IFDIR | 0755;  // Diretório com permissão rwxr-xr-x
-    dirInode.i_uid = 0;
-    dirInode.i_gid = 0;
-    dirInode.i_size = blockSize;             // Tamanho do diretório: 1 bloco
-    dirInode.i_links_count = 2;              // '.' e referência do pai
-    dirInode.i_blocks = blockSize / 512;     // número de setores de 512 bytes
-    dirInode.i_atime = dirInode.i_ctime = dirInode.i_mtime = (uint32_t)time(nullptr);
-    memset(dirInode.i_block, 0, sizeof(dirInode.i_block));
-    dirInode.i_block[0] = blockNum;          // Aponta para o bloco alocado
-
-    // Grava o inode no disco
-    writeInode(inodeNum, &dirInode);
-
-    // Cria as entradas especiais '.' e '..' no bloco do diretório
-    std::vector<char> blockData(blockSize, 0);
-    ext2_dir_entry_2* dotEntry = reinterpret_cast<ext2_dir_entry_2*>(blockData.data());
-
-    // Entrada '.'
-    dotEntry->inode = inodeNum;
-    dotEntry->rec_len = 12;
-    dotEntry->name_len = 1;
-    dotEntry->file_type = EXT2_FT_DIR;
-    dotEntry->name[0] = '.';
+    // Divide um caminho longo em prefixo (até 155) + nome (até 100) em uma '/'
+    static bool splitName(const std::string& path, std::string& prefix, std::string& name) {
+        for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            if (slash > 155) break;
+            if (path.size() - slash - 1 <= 100 && slash + 1 < path.size()) {
+                prefix = path.substr(0, slash);
+                name = path.substr(slash + 1);
+                return true;
+            }
+        }
+        return false;
+    }
 
-    // Entrada '..' logo após '.'
-    ext2_dir_entry_2* dotDotEntry = reinterpret_cast<ext2_dir_entry_2*>(blockData.data() + 12);
-    dotDotEntry->inode = currentInodeNum;
-    dotDotEntry->rec_len = blockSize - 12;
-    dotDotEntry->name_len = 2;
-    dotDotEntry->file_type = EXT2_FT_DIR;
-    dotDotEntry->name[0] = '.';
-    dotDotEntry->name[1] = '.';
+    // Registro pax "<tamanho> <chave>=<valor>\n", onde o tamanho conta a si mesmo
+    static std::string paxRecord(const std::string& key, const std::string& value) {
+        size_t body = key.size() + value.size() + 3; // ' ', '=' e '\n'
+        size_t length = body + 1;
+        while (std::to_string(length).size() + body != length) length++;
+        return std::to_string(length) + " " + key + "=" + value + "\n";
+    }
 
-    // Escreve o bloco do diretório no disco
-    writeBlock(blockNum, blockData.data());
+    // Campo octal com zeros à esquerda e NUL no fim; quem chama limita o
+    // valor para caber em width - 1 dígitos
+    static void octal(char* field, size_t width, unsigned long long value) {
+        field[width - 1] = '\0';
+        for (size_t i = width - 1; i > 0; i--) {
+            field[i - 1] = (char)('0' + (value & 7));
+            value >>= 3;
+        }
+    }
 
-    // Adiciona a entrada do novo diretório no diretório atual
-    if (addDirectoryEntry(currentInodeNum, inodeNum, name, EXT2_FT_DIR) < 0) {
-        std::cerr << "Error: Failed to add directory entry." << std::endl;
-        freeBlock(blockNum);   // Libera bloco e inode em caso de falha
-        freeInode(inodeNum);
-        return;
+    static void fillHeader(char* block, const std::string& name, const std::string& prefix, char type,
+                           unsigned int mode, unsigned int uid, unsigned int gid, unsigned long long size,
+                           unsigned long long mtime, const std::string& linkName,
+                           unsigned int devMajor, unsigned int devMinor) {
+        memcpy(block, name.data(), std::min<size_t>(name.size(), 100));
+        octal(block + 100, 8, mode);
+        octal(block + 108, 8, std::min(uid, 07777777u));
+        octal(block + 116, 8, std::min(gid, 07777777u));
+        octal(block + 124, 12, std::min(size, 077777777777ULL));
+        octal(block + 136, 12, std::min(mtime, 077777777777ULL));
+        block[156] = type;
+        memcpy(block + 157, linkName.data(), std::min<size_t>(linkName.size(), 100));
+        memcpy(block + 257, "ustar", 6);
+        memcpy(block + 263, "00", 2);
+        if (type == '3' || type == '4') {
+            octal(block + 329, 8, devMajor);
+            octal(block + 337, 8, devMinor);
+        }
+        memcpy(block + 345, prefix.data(), std::min<size_t>(prefix.size(), 155));
+
+        // Soma de verificação: bytes do cabeçalho com o próprio campo em branco
+        memset(block + 148, ' ', 8);
+        unsigned int checksum = 0;
+        for (int i = 0; i < 512; i++) checksum += (unsigned char)block[i];
+        octal(block + 148, 7, checksum);
+        block[155] = ' ';
     }
+};
 
-    // Incrementa o contador de links do diretório pai
-    currentGroupDesc.bg_used_dirs_count++;
-    writeGroupDesc(currentGroupNum, &currentGroupDesc);
+} // namespace
 
-    std::cout << "Directory '" << name << "' created successfully." << std::endl;
+// Destino de um link simbólico: nos links rápidos (sem blocos alocados) o
+// texto fica no próprio i_block; nos demais, no primeiro bloco de dados
+std::string Ext2Shell::readSymlinkTarget(const ext2_inode& inode) {
+    if (inode.i_blocks == 0) {
+        return std::string(reinterpret_cast<const char*>(inode.i_block),
+                           std::min<size_t>(inode.i_size, sizeof(inode.i_block)));
+    }
+    std::string target;
+    forEachFileExtent(inode, [&](unsigned long long, const char* data, size_t length) {
+        if (data) target.append(data, length);
+        else target.append(length, '\0');
+    });
+    return target;
 }
 
-// Remove um arquivo
-void Ext2Shell::cmd_rm(const std::string& name) {
-    // Encontra o inode do arquivo pelo nome
-    unsigned int targetInodeNum = getInodeByName(name);
-    if (targetInodeNum == 0) {
-        std::cerr << "Error: File '" << name << "' not found." << std::endl;
+// export-tar <dir> <arquivo|->: grava a subárvore como um tar POSIX (no
+// arquivo local ou na saída padrão), com modo, dono e mtime de cada inode.
+// Os nomes no tar são relativos ao diretório exportado.
+void Ext2Shell::cmd_export_tar(const std::string& dir, const std::string& output) {
+    unsigned int dirInodeNum = resolvePath(dir);
+    if (dirInodeNum == 0) {
+        std::cerr << "Error: Directory '" << dir << "' not found." << std::endl;
+        return;
+    }
+    ext2_inode dirInode;
+    readInode(dirInodeNum, &dirInode);
+    if (!S_ISDIR(dirInode.i_mode)) {
+        std::cerr << "Error: '" << dir << "' is not a directory." << std::endl;
         return;
     }
 
-    // Verifica se é um arquivo regular
-    ext2_inode targetInode;
-    readInode(targetInodeNum, &targetInode);
-    if (S_ISDIR(targetInode.i_mode)) {
-        std::cerr << "Error: '" << name << "' is a directory. Use 'rmdir' instead." << std::endl;
+    // "-" escreve em cout. No modo servidor cout e cerr vão para a mesma
+    // resposta, então avisos se misturariam ao tar: lá "-" não é aceito.
+    const bool toStdout = output == "-";
+    if (toStdout && serving) {
+        std::cerr << "Error: 'export-tar -' is not available in server mode." << std::endl;
         return;
     }
-
-    // Remove a entrada do diretório pai
-    bool entryRemoved = false;
-    for (int i = 0; i < 12 && !entryRemoved; i++) {
-        if (currentInode.i_block[i] == 0) continue;
-
-        // Lê o bloco de dados do diretório atual
-        std::vector<char> blockData(blockSize);
-        readBlock(currentInode.i_block[i], blockData.data());
-        char* blockStart = blockData.data();
-        
-        // Ponteiros para as entradas do diretório
-        ext2_dir_entry_2* entry_to_delete = nullptr;
-        ext2_dir_entry_2* prev_to_delete = nullptr; // O anterior ao que vamos deletar
-        ext2_dir_entry_2* current_entry = (ext2_dir_entry_2*)blockStart;
-        unsigned int offset = 0;
-
-        // Varre o bloco para encontrar a entrada a ser deletada e sua anterior
-        while (offset < blockSize) {
-            if (current_entry->rec_len == 0) break;
-            if (current_entry->inode == targetInodeNum && std::string(current_entry->name, current_entry->name_len) == name) {
-                entry_to_delete = current_entry;
-                break;
-            }
-            if(current_entry->inode != 0) prev_to_delete = current_entry;
-            offset += current_entry->rec_len;
-            current_entry = (ext2_dir_entry_2*)(blockStart + offset);
+    int outFd = -1;
+    if (!toStdout) {
+        outFd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (outFd < 0) {
+            std::cerr << "Error: Could not open destination file '" << output << "' for writing." << std::endl;
+            return;
         }
-
-        // Se encontrou a entrada
-        if (entry_to_delete) {
-            // Verifica se a entrada a deletar é a última na lista
-            unsigned int deleteOffset = (char*)entry_to_delete - blockStart;
-            bool isLastEntry = (deleteOffset + entry_to_delete->rec_len >= blockSize);
-
-            // CASO DE BORDA: Removendo o último item
-            if (isLastEntry) {
-                if (prev_to_delete) {
-                    prev_to_delete->rec_len += entry_to_delete->rec_len;
-                } else { // Só havia um item no diretório
-                    entry_to_delete->inode = 0;
-                }
-            } 
-            // CASO GERAL: Removendo do meio
-            else {
-                char* deletePtr = reinterpret_cast<char*>(entry_to_delete);
-                unsigned short deleteLen = entry_to_delete->rec_len;
-                char* nextPtr = deletePtr + deleteLen;
-                unsigned int moveLen = (blockStart + blockSize) - nextPtr;
-
-                // Move as entradas seguintes para preencher o espaço
-                memmove(deletePtr, nextPtr, moveLen);
-                
-                // Encontra o novo último item e ajusta seu rec_len
-                ext2_dir_entry_2* new_last_entry = nullptr;
-                offset = 0;
-                while (offset < (blockSize - deleteLen)) {
-                    ext2_dir_entry_2* current = (ext2_dir_entry_2*)(blockStart + offset);
-                    if (current->rec_len == 0) break;
-                    new_last_entry = current;
-                    offset += current->rec_len;
-                }
-                if (new_last_entry) {
-                    offset = (char*)new_last_entry - blockStart;
-                    new_last_entry->rec_len = blockSize - offset;
+    }
+    TarWriter tar(outFd, toStdout ? &std::cout : nullptr);
+
+    std::unordered_map<unsigned int, std::string> linkedPaths; // Inode com vários links -> primeiro caminho
+    unsigned long long entries = 0;
+    forEachInodeInTree(dirInodeNum, ".", [&](const std::string& path, unsigned int inodeNum, const ext2_inode& inode) {
+        if (!tar.ok()) return;
+        TarWriter::Entry entry = {};
+        entry.name = path.substr(2); // Sem o "./" inicial
+        entry.mode = inode.i_mode & 07777;
+        entry.uid = inode.i_uid | (unsigned int)(inode.i_osd2[4] | inode.i_osd2[5] << 8) << 16;
+        entry.gid = inode.i_gid | (unsigned int)(inode.i_osd2[6] | inode.i_osd2[7] << 8) << 16;
+        entry.mtime = inode.i_mtime;
+
+        if (S_ISREG(inode.i_mode)) {
+            if (inode.i_links_count > 1) {
+                auto seen = linkedPaths.emplace(inodeNum, entry.name);
+                if (!seen.second) {
+                    entry.type = '1';
+                    entry.linkName = seen.first->second;
+                    tar.header(entry);
+                    entries++;
+                    return;
                 }
             }
-
-            writeBlock(currentInode.i_block[i], blockData.data());
-            entryRemoved = true;
+            entry.type = '0';
+            entry.size = inodeFileSize(inode);
+            tar.header(entry);
+            forEachFileExtent(inode, [&](unsigned long long, const char* data, size_t length) {
+                if (data) tar.data(data, length);
+                else tar.zeros(length); // Buraco
+            });
+            tar.pad(entry.size);
+        } else if (S_ISDIR(inode.i_mode)) {
+            entry.type = '5';
+            entry.name += "/";
+            tar.header(entry);
+        } else if (S_ISLNK(inode.i_mode)) {
+            entry.type = '2';
+            entry.linkName = readSymlinkTarget(inode);
+            tar.header(entry);
+        } else if (S_ISCHR(inode.i_mode) || S_ISBLK(inode.i_mode)) {
+            // Número antigo (16 bits) em i_block[0]; o novo, em i_block[1]
+            entry.type = S_ISCHR(inode.i_mode) ? '3' : '4';
+            unsigned int dev = inode.i_block[0];
+            if (dev != 0) {
+                entry.devMajor = (dev >> 8) & 0xff;
+                entry.devMinor = dev & 0xff;
+            } else {
+                dev = inode.i_block[1];
+                entry.devMajor = (dev >> 8) & 0xfff;
+                entry.devMinor = (dev & 0xff) | ((dev >> 12) & 0xfff00);
+            }
+            tar.header(entry);
+        } else if (S_ISFIFO(inode.i_mode)) {
+            entry.type = '6';
+            tar.header(entry);
+        } else {
+            std::cerr << "Warning: Skipping socket '" << path << "'." << std::endl;
+            return;
         }
+        entries++;
+    });
+
+    bool ok = tar.finish();
+    if (outFd >= 0 && close(outFd) != 0) ok = false;
+    if (toStdout) std::cout.flush();
+    if (!ok) {
+        std::cerr << "Error: Failed to write tar archive '" << output << "'." << std::endl;
+        return;
     }
+    if (!toStdout) {
+        std::cout << "Exported " << entries << " entries (" << tar.bytesWritten() << " bytes) to '"
+                  << output << "'." << std::endl;
+    }
+}
 
-    if (!entryRemoved) { return; }
+// --- Importação de tar (comando import-tar) ---
 
-    // Libera o inode do arquivo
-    targetInode.i_links_count--;
-    writeInode(targetInodeNum, &targetInode);
-    if (targetInode.i_links_count == 0) {
-        // Define o tempo de deleção antes de começar a apagar
-        targetInode.i_dtime = time(nullptr);
-        writeInode(targetInodeNum, &targetInode);
+namespace {
+
+// Lê um arquivo tar de um descritor ou de um stream, TAR_READ_BUFFER bytes por vez
+class TarReader {
+public:
+    TarReader(int fd, std::istream* stream) : fd(fd), stream(stream), buffer(TAR_READ_BUFFER) {}
 
-        // Libera os 12 blocos de dados diretos
-        for (int j = 0; j < 12; j++) {
-            if (targetInode.i_block[j] != 0) {
-                freeBlock(targetInode.i_block[j]);
+    // Copia exatamente 'length' bytes (com dst nulo, só descarta). Retorna
+    // false se a entrada acabar antes.
+    bool read(char* dst, unsigned long long length) {
+        while (length > 0) {
+            if (position == filled && !refill()) return false;
+            size_t chunk = std::min<unsigned long long>(length, filled - position);
+            if (dst) {
+                memcpy(dst, buffer.data() + position, chunk);
+                dst += chunk;
             }
+            position += chunk;
+            length -= chunk;
         }
+        return true;
+    }
 
-        // Libera blocos do ponteiro indireto simples (i_block[12])
-        if (targetInode.i_block[12] != 0) {
-            std::vector<unsigned int> indirectBlock(blockSize / sizeof(unsigned int));
-            readBlock(targetInode.i_block[12], indirectBlock.data());
-
-            // Libera os blocos apontados pelo bloco de ponteiros indiretos simples
-            for (unsigned int dataBlockNum : indirectBlock) {
-                if (dataBlockNum != 0) freeBlock(dataBlockNum);
-            }
+    // Consome o resto da entrada
+    void drain() {
+        while (refill()) position = filled;
+    }
 
-            // Libera o próprio bloco de ponteiros indiretos
-            freeBlock(targetInode.i_block[12]);
+private:
+    int fd;
+    std::istream* stream;
+    std::vector<char> buffer;
+    size_t position = 0, filled = 0;
+
+    bool refill() {
+        position = filled = 0;
+        if (stream) {
+            stream->read(buffer.data(), buffer.size());
+            filled = stream->gcount();
+        } else {
+            ssize_t n;
+            do {
+                n = ::read(fd, buffer.data(), buffer.size());
+            } while (n < 0 && errno == EINTR);
+            filled = n > 0 ? n : 0;
         }
+        return filled > 0;
+    }
+};
+
+// Campo numérico do cabeçalho: octal ou, com o bit alto do primeiro byte,
+// binário big-endian (extensão do GNU tar para valores grandes)
+unsigned long long tarNumber(const char* field, size_t width) {
+    unsigned long long value = 0;
+    if ((unsigned char)field[0] & 0x80) {
+        value = (unsigned char)field[0] & 0x7f;
+        for (size_t i = 1; i < width; i++) value = (value << 8) | (unsigned char)field[i];
+        return value;
+    }
+    size_t i = 0;
+    while (i < width && field[i] == ' ') i++;
+    for (; i < width && field[i] >= '0' && field[i] <= '7'; i++) value = value * 8 + (field[i] - '0');
+    return value;
+}
 
-        // Libera blocos do ponteiro indireto duplo (i_block[13])
-        if (targetInode.i_block[13] != 0) {
-            std::vector<unsigned int> doublyIndirectBlock(blockSize / sizeof(unsigned int));
-            readBlock(targetInode.i_block[13], doublyIndirectBlock.data());
+std::string tarString(const char* field, size_t width) {
+    return std::string(field, strnlen(field, width));
+}
 
-            // Percorre cada bloco de indireção simples apontado pelo bloco de indireção dupla
-            for (unsigned int singlyIndirectBlockNum : doublyIndirectBlock) {
-                if (singlyIndirectBlockNum == 0) continue;
-                
-                std::vector<unsigned int> singlyIndirectBlock(blockSize / sizeof(unsigned int));
-                readBlock(singlyIndirectBlockNum, singlyIndirectBlock.data());
+// Confere a soma do cabeçalho (alguns tar antigos somam bytes com sinal)
+bool tarChecksumOk(const char* block) {
+    unsigned long long stored = tarNumber(block + 148, 8);
+    unsigned long long unsignedSum = 0;
+    long long signedSum = 0;
+    for (int i = 0; i < 512; i++) {
+        char c = (i >= 148 && i < 156) ? ' ' : block[i];
+        unsignedSum += (unsigned char)c;
+        signedSum += (signed char)c;
+    }
+    return stored == unsignedSum || (long long)stored == signedSum;
+}
 
-                // Libera os blocos apontados pelo bloco de indireção simples
-                for (unsigned int dataBlockNum : singlyIndirectBlock) {
-                    if (dataBlockNum != 0) freeBlock(dataBlockNum);
-                }
+// Registros "<tamanho> <chave>=<valor>\n" de um cabeçalho pax
+void parsePaxRecords(const std::string& data, std::map<std::string, std::string>& records) {
+    size_t at = 0;
+    while (at < data.size()) {
+        size_t space = data.find(' ', at);
+        if (space == std::string::npos) return;
+        unsigned long long length = strtoull(data.c_str() + at, nullptr, 10);
+        if (length == 0 || at + length > data.size()) return;
+        size_t equals = data.find('=', space);
+        if (equals != std::string::npos && equals < at + length) {
+            records[data.substr(space + 1, equals - space - 1)] = data.substr(equals + 1, at + length - equals - 2);
+        }
+        at += length;
+    }
+}
+
+// Blocos de ponteiros (indiretos simples, duplos e triplos) necessários para
+// mapear 'dataBlocks' blocos de dados em sequência
+unsigned long long pointerBlocksFor(unsigned long long dataBlocks, unsigned long long perBlock) {
+    if (dataBlocks <= 12) return 0;
+    unsigned long long rest = dataBlocks - 12;
+    unsigned long long count = 1; // Indireto simples
+    if (rest <= perBlock) return count;
+    rest -= perBlock;
+    unsigned long long doubleSpan = std::min(rest, perBlock * perBlock);
+    count += 1 + (doubleSpan + perBlock - 1) / perBlock;
+    if (rest <= perBlock * perBlock) return count;
+    rest -= perBlock * perBlock;
+    return count + 1 + (rest + perBlock * perBlock - 1) / (perBlock * perBlock) + (rest + perBlock - 1) / perBlock;
+}
 
-                // Libera o bloco de indireção simples
-                freeBlock(singlyIndirectBlockNum);
+// Distribui os blocos reservados (trechos em ordem) entre os dados de um
+// arquivo novo, em ordem lógica, e monta a árvore de ponteiros em memória.
+// Cada bloco de ponteiros fica logo antes dos dados que ele mapeia, como no
+// cmd_defrag.
+class BlockTreeBuilder {
+public:
+    BlockTreeBuilder(unsigned int perBlock, uint32_t* iBlock,
+                     const std::vector<std::pair<unsigned int, unsigned int>>& extents)
+        : perBlock(perBlock), iBlock(iBlock), extents(extents) {}
+
+    // Bloco físico do próximo bloco de dados (criando antes os blocos de
+    // ponteiros que ele exigir)
+    unsigned int nextDataBlock() {
+        unsigned int logical = nextLogical++;
+        if (logical < 12) return iBlock[logical] = take();
+
+        unsigned long long rest = logical - 12;
+        unsigned long long span = 1;
+        int depth = 1;
+        while (rest >= span * perBlock) {
+            rest -= span * perBlock;
+            span *= perBlock;
+            depth++;
+        }
+        if (depth != openDepth) {
+            open[depth] = newNode();
+            iBlock[11 + depth] = nodes[open[depth]].first;
+            openDepth = depth;
+        }
+        for (int level = depth; level > 1; level--) {
+            unsigned int index = (rest / span) % perBlock;
+            if (nodes[open[level]].second[index] == 0) {
+                size_t child = newNode();
+                nodes[open[level]].second[index] = nodes[child].first;
+                open[level - 1] = child;
             }
+            rest %= span;
+            span /= perBlock;
+        }
+        unsigned int blockNum = take();
+        nodes[open[1]].second[rest] = blockNum;
+        return blockNum;
+    }
 
-            // Libera o próprio bloco de ponteiros indiretos duplos
-            freeBlock(targetInode.i_block[13]);
+    // Blocos de ponteiros montados: (bloco físico, conteúdo)
+    const std::vector<std::pair<unsigned int, std::vector<unsigned int>>>& pointerBlocks() const { return nodes; }
+
+private:
+    unsigned int perBlock;
+    uint32_t* iBlock;
+    const std::vector<std::pair<unsigned int, unsigned int>>& extents;
+    size_t extent = 0;
+    unsigned int offset = 0;
+    unsigned int nextLogical = 0;
+    std::vector<std::pair<unsigned int, std::vector<unsigned int>>> nodes;
+    size_t open[4] = {};  // Nó em uso em cada nível (1 = aponta para dados)
+    int openDepth = 0;
+
+    unsigned int take() {
+        unsigned int blockNum = extents[extent].first + offset;
+        if (++offset == extents[extent].second) {
+            extent++;
+            offset = 0;
         }
-        freeInode(targetInodeNum);
+        return blockNum;
     }
 
-    std::cout << "File '" << name << "' removed successfully." << std::endl;
+    size_t newNode() {
+        nodes.emplace_back(take(), std::vector<unsigned int>(perBlock, 0));
+        return nodes.size() - 1;
+    }
+};
+
+} // namespace
+
+// Grava o destino de um link simbólico no inode: com menos de 60 bytes vai
+// direto em i_block (link rápido, sem bloco de dados); senão, em um bloco
+// alocado. Retorna -1 se não houver bloco livre. Quem chama grava o inode.
+int Ext2Shell::storeSymlinkTarget(ext2_inode& inode, const std::string& target) {
+    memset(inode.i_block, 0, sizeof(inode.i_block));
+    inode.i_size = target.size();
+    inode.i_blocks = 0;
+    if (target.size() < sizeof(inode.i_block)) {
+        memcpy(inode.i_block, target.data(), target.size());
+        return 0;
+    }
+
+    int blockNum = allocateBlock();
+    if (blockNum < 0) return -1;
+    BlockBuffer blockBuffer = blockPool.acquire(true);
+    memcpy(blockBuffer.data(), target.data(), std::min<size_t>(target.size(), blockSize));
+    writeBlock(blockNum, blockBuffer.data());
+    inode.i_block[0] = blockNum;
+    inode.i_blocks = blockSize / 512;
+    return 0;
 }
 
-// Remove um diretório vazio
-void Ext2Shell::cmd_rmdir(const std::string& name) {
-    // Encontra o inode do diretório pelo nome
-    unsigned int targetInodeNum = getInodeByName(name);
-    if (targetInodeNum == 0) {
-        std::cerr << "Error: Directory '" << name << "' not found." << std::endl;
-        return;
+// Grava os dados de um arquivo novo de 'size' bytes, lidos com 'read'.
+// Reserva de uma vez todos os blocos (dados e ponteiros) a partir de 'goal',
+// que avança para depois deles, monta a árvore de ponteiros em memória e
+// escreve os dados em trechos contíguos. Preenche i_block, i_blocks e o
+// tamanho em 'inode' (i_mode já deve estar definido); quem chama grava o
+// inode. Retorna -1 se faltar espaço (nesse caso nada é lido).
+int Ext2Shell::importFileData(ext2_inode& inode, unsigned long long size,
+                              const std::function<bool(char*, size_t)>& read, unsigned int& goal) {
+    const unsigned long long perBlock = blockSize / sizeof(unsigned int);
+    const unsigned long long dataBlocks = (size + blockSize - 1) / blockSize;
+    const unsigned long long total = dataBlocks + pointerBlocksFor(dataBlocks, perBlock);
+    if (dataBlocks > 12 + perBlock + perBlock * perBlock + perBlock * perBlock * perBlock ||
+        total * (blockSize / 512) > UINT32_MAX) {
+        return -1;
     }
 
-    // Verifica se é um diretório e se está vazio
-    ext2_inode targetInode;
-    readInode(targetInodeNum, &targetInode);
+    std::vector<std::pair<unsigned int, unsigned int>> extents;
+    if (reserveBlocks(total, goal, extents) < 0) return -1;
+    if (!extents.empty()) goal = extents.back().first + extents.back().second;
 
-    if (!S_ISDIR(targetInode.i_mode)) {
-        std::cerr << "Error: '" << name << "' is not a directory." << std::endl;
-        return;
+    memset(inode.i_block, 0, sizeof(inode.i_block));
+    try {
+        BlockTreeBuilder tree(perBlock, inode.i_block, extents);
+        const unsigned int batch = 256;
+        std::vector<char> buffer((size_t)batch * blockSize);
+        unsigned int pendingFirst = 0, pendingCount = 0;
+        auto flush = [&]() {
+            if (pendingCount > 0) writeBlockRun(pendingFirst, pendingCount, buffer.data());
+            pendingCount = 0;
+        };
+
+        unsigned long long remaining = size;
+        for (unsigned long long i = 0; i < dataBlocks; i++) {
+            unsigned int blockNum = tree.nextDataBlock();
+            if (pendingCount == batch || (pendingCount > 0 && blockNum != pendingFirst + pendingCount)) flush();
+            if (pendingCount == 0) pendingFirst = blockNum;
+            char* block = &buffer[(size_t)pendingCount * blockSize];
+            size_t length = std::min<unsigned long long>(remaining, blockSize);
+            if (!read(block, length)) {
+                throw std::runtime_error("Error: Unexpected end of tar input.");
+            }
+            memset(block + length, 0, blockSize - length);
+            remaining -= length;
+            pendingCount++;
+        }
+        flush();
+        for (const auto& node : tree.pointerBlocks()) {
+            writeBlock(node.first, node.second.data());
+        }
+    } catch (...) {
+        // Devolve a reserva: nenhum inode aponta para ela
+        std::vector<unsigned int> reserved;
+        for (const auto& extent : extents) {
+            for (unsigned int i = 0; i < extent.second; i++) reserved.push_back(extent.first + i);
+        }
+        freeBlocks(reserved);
+        throw;
     }
 
-    if (targetInode.i_links_count > 2) {
-        std::cerr << "Error: Directory '" << name << "' is not empty (contains subdirectories)." << std::endl;
+    inode.i_blocks = total * (blockSize / 512);
+    setInodeFileSize(inode, size);
+    return 0;
+}
+
+// import-tar <arquivo|->: extrai um tar POSIX (ustar, com extensões pax e
+// GNU para nomes longos) no diretório atual. A alocação fica adiada durante
+// toda a importação: bitmaps, descritores e superbloco são gravados uma vez,
+// no fim, e cada arquivo reserva todos os seus blocos de uma vez pelo tamanho
+// que vem no cabeçalho. Com "-", o tar é o resto da entrada padrão.
+void Ext2Shell::cmd_import_tar(const std::string& input) {
+    const bool fromStdin = input == "-";
+    if (fromStdin && serving) {
+        std::cerr << "Error: 'import-tar -' is not available in server mode." << std::endl;
         return;
     }
+    int inFd = -1;
+    if (!fromStdin) {
+        inFd = open(input.c_str(), O_RDONLY);
+        if (inFd < 0) {
+            std::cerr << "Error: Could not open tar file '" << input << "' for reading." << std::endl;
+            return;
+        }
+        posix_fadvise(inFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    TarReader tar(inFd, fromStdin ? &std::cin : nullptr);
+    auto read = [&](char* dst, size_t length) { return tar.read(dst, length); };
+
+    const unsigned int baseInodeNum = currentInodeNum;
+    std::unordered_map<std::string, unsigned int> imported; // Caminho no tar -> inode criado ou encontrado
+    std::unordered_set<unsigned int> createdDirs;           // Diretórios novos (não há o que procurar neles)
+    unsigned long long entries = 0, dataBytes = 0;
+    unsigned int goal = 0;
+    bool failed = false;
+
+    // Procura uma entrada; nos diretórios criados aqui, só 'imported' conta
+    auto lookup = [&](unsigned int parent, const std::string& path, const std::string& name) -> unsigned int {
+        auto known = imported.find(path);
+        if (known != imported.end()) return known->second;
+        return createdDirs.count(parent) ? 0 : findDirEntry(parent, name);
+    };
+
+    // Inode do diretório 'path' (relativo ao diretório atual), criando os que faltam
+    std::function<unsigned int(const std::string&)> ensureDir = [&](const std::string& path) -> unsigned int {
+        if (path.empty()) return baseInodeNum;
+        size_t slash = path.rfind('/');
+        unsigned int parent = ensureDir(slash == std::string::npos ? "" : path.substr(0, slash));
+        if (parent == 0) return 0;
+        std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+
+        unsigned int inodeNum = lookup(parent, path, name);
+        if (inodeNum != 0) {
+            ext2_inode inode;
+            readInode(inodeNum, &inode);
+            if (!S_ISDIR(inode.i_mode)) {
+                std::cerr << "Error: '" << path << "' exists and is not a directory." << std::endl;
+                return 0;
+            }
+        } else {
+            int created = createDirectory(parent, name);
+            if (created < 0) return 0;
+            inodeNum = created;
+            createdDirs.insert(inodeNum);
+        }
+        imported[path] = inodeNum;
+        return inodeNum;
+    };
+
+    // Caminho sem '/' no início, sem '.' e sem componentes vazios; recusa '..'
+    auto normalize = [&](const std::string& raw, std::string& path) {
+        path.clear();
+        std::stringstream parts(raw);
+        std::string part;
+        while (std::getline(parts, part, '/')) {
+            if (part.empty() || part == ".") continue;
+            if (part == ".." || part.size() >= EXT2_NAME_LEN) return false;
+            path += (path.empty() ? "" : "/") + part;
+        }
+        return true;
+    };
 
-    // Verifica se está vazio (verificação mais rigorosa)
-    bool isTrulyEmpty = true;
-    if (targetInode.i_block[0] != 0) {
-        std::vector<char> dirBlockData(blockSize);
-        readBlock(targetInode.i_block[0], &dirBlockData[0]);
-        unsigned int temp_offset = 0;
-        while (temp_offset < blockSize) {
-            ext2_dir_entry_2* e = (ext2_dir_entry_2*)&dirBlockData[temp_offset];
-            if (e->rec_len == 0) break;
-            if (e->inode != 0 && std::string(e->name, e->name_len) != "." && std::string(e->name, e->name_len) != "..") {
-                isTrulyEmpty = false;
+    beginDeferredAllocation();
+    try {
+        std::map<std::string, std::string> pax; // Valores pax para o próximo item
+        std::string longName, longLink;         // Nomes longos do GNU tar ('L'/'K')
+        char header[512];
+        while (true) {
+            if (!tar.read(header, sizeof(header))) {
+                std::cerr << "Error: Unexpected end of tar input." << std::endl;
+                failed = true;
+                break;
+            }
+            if (std::all_of(header, header + sizeof(header), [](char c) { return c == 0; })) break; // Fim do arquivo
+            if (!tarChecksumOk(header)) {
+                std::cerr << "Error: Invalid tar header checksum." << std::endl;
+                failed = true;
                 break;
             }
-            temp_offset += e->rec_len;
-        }
-    }
-    if (!isTrulyEmpty) {
-        std::cerr << "Error: Directory '" << name << "' is not empty (contains files)." << std::endl;
-        return;
-    }
 
-    // Remove a entrada do diretório pai
-    bool entryRemoved = false;
-    for (int i = 0; i < 12 && !entryRemoved; i++) {
-        if (currentInode.i_block[i] == 0) continue;
-
-        std::vector<char> parentBlockData(blockSize);
-        readBlock(currentInode.i_block[i], &parentBlockData[0]);
-        char* blockStart = &parentBlockData[0];
-        
-        ext2_dir_entry_2* entry_to_delete = nullptr;
-        ext2_dir_entry_2* last_entry = nullptr;
-        unsigned int offset = 0;
+            const char type = header[156];
+            unsigned long long size = tarNumber(header + 124, 12);
+            if (type == 'x' || type == 'g' || type == 'L' || type == 'K') {
+                std::string data(size, '\0');
+                if (!tar.read(&data[0], size) || !tar.read(nullptr, (512 - size % 512) % 512)) {
+                    std::cerr << "Error: Unexpected end of tar input." << std::endl;
+                    failed = true;
+                    break;
+                }
+                if (type == 'x') parsePaxRecords(data, pax);
+                else if (type == 'L') longName = data.c_str();
+                else if (type == 'K') longLink = data.c_str();
+                continue; // 'g' (valores globais) é ignorado
+            }
 
-        // Varre o bloco para encontrar a entrada a ser deletada e sua anterior
-        while (offset < blockSize) {
-            ext2_dir_entry_2* current_entry = (ext2_dir_entry_2*)(blockStart + offset);
-            if (current_entry->rec_len == 0) break;
-            if (current_entry->inode != 0) {
-                last_entry = current_entry;
-                if (std::string(current_entry->name, current_entry->name_len) == name) {
-                    entry_to_delete = current_entry;
+            // Nome: prefixo + nome no ustar; os nomes longos e o pax têm precedência
+            std::string rawName = tarString(header, 100);
+            if (memcmp(header + 257, "ustar\0", 6) == 0 && header[345] != '\0') {
+                rawName = tarString(header + 345, 155) + "/" + rawName;
+            }
+            std::string linkName = tarString(header + 157, 100);
+            unsigned int mode = tarNumber(header + 100, 8) & 07777;
+            unsigned long long uid = tarNumber(header + 108, 8);
+            unsigned long long gid = tarNumber(header + 116, 8);
+            unsigned long long mtime = tarNumber(header + 136, 12);
+            if (!longName.empty()) rawName = longName;
+            if (!longLink.empty()) linkName = longLink;
+            if (pax.count("path")) rawName = pax["path"];
+            if (pax.count("linkpath")) linkName = pax["linkpath"];
+            if (pax.count("size")) size = strtoull(pax["size"].c_str(), nullptr, 10);
+            if (pax.count("uid")) uid = strtoull(pax["uid"].c_str(), nullptr, 10);
+            if (pax.count("gid")) gid = strtoull(pax["gid"].c_str(), nullptr, 10);
+            if (pax.count("mtime")) mtime = strtoull(pax["mtime"].c_str(), nullptr, 10);
+            pax.clear();
+            longName.clear();
+            longLink.clear();
+
+            const bool regular = type == '0' || type == '\0' || type == '7';
+            const unsigned long long padding = (512 - size % 512) % 512;
+            // Descarta os dados do item (quando ele é pulado)
+            auto skipData = [&]() {
+                if (!tar.read(nullptr, size + padding)) {
+                    std::cerr << "Error: Unexpected end of tar input." << std::endl;
+                    failed = true;
+                }
+            };
+
+            std::string path;
+            if (!normalize(rawName, path)) {
+                std::cerr << "Warning: Skipping '" << rawName << "': unsafe or invalid path." << std::endl;
+                skipData();
+                if (failed) break;
+                continue;
+            }
+
+            // Permissões, dono, grupo e horários do item
+            auto setAttributes = [&](ext2_inode& inode) {
+                inode.i_mode = (inode.i_mode & S_IFMT) | mode;
+                inode.i_uid = uid & 0xffff;
+                inode.i_gid = gid & 0xffff;
+                inode.i_osd2[4] = (uid >> 16) & 0xff;
+                inode.i_osd2[5] = (uid >> 24) & 0xff;
+                inode.i_osd2[6] = (gid >> 16) & 0xff;
+                inode.i_osd2[7] = (gid >> 24) & 0xff;
+                inode.i_atime = inode.i_mtime = mtime;
+                inode.i_ctime = (uint32_t)time(nullptr);
+            };
+
+            if (type == '5') {
+                unsigned int dirInodeNum = path.empty() ? 0 : ensureDir(path);
+                if (dirInodeNum != 0) {
+                    ext2_inode dirInode;
+                    readInode(dirInodeNum, &dirInode);
+                    setAttributes(dirInode);
+                    writeInode(dirInodeNum, &dirInode);
+                    entries++;
                 }
+                skipData();
+                if (failed) break;
+                continue;
+            }
+
+            size_t slash = path.rfind('/');
+            std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+            unsigned int parent = path.empty() ? 0 : ensureDir(slash == std::string::npos ? "" : path.substr(0, slash));
+            if (parent == 0 || lookup(parent, path, name) != 0) {
+                if (parent != 0) std::cerr << "Warning: Skipping '" << path << "': already exists." << std::endl;
+                skipData();
+                if (failed) break;
+                continue;
             }
-            offset += current_entry->rec_len;
-        }
-
-        // Se encontrou a entrada
-        if (entry_to_delete) {
-            // Verifica se a entrada a deletar é a última na lista
-            unsigned int deleteOffset = (char*)entry_to_delete - blockStart;
-            bool isLastEntry = (deleteOffset + entry_to_delete->rec_len >= blockSize);
-
-            // CASO DE BORDA: Removendo o último item
-            if (isLastEntry) {
-                ext2_dir_entry_2* prev_to_last = nullptr;
-                offset = 0;
-                while(offset < blockSize){
-                    ext2_dir_entry_2* current = (ext2_dir_entry_2*)(blockStart + offset);
-                    if(current->rec_len == 0) break;
-                    if(current == last_entry) break;
-                    if(current->inode != 0) prev_to_last = current;
-                    offset += current->rec_len;
+
+            if (type == '1') {
+                // Hard link para um item já extraído (ou já presente na árvore)
+                std::string targetPath;
+                unsigned int targetInodeNum = 0;
+                if (normalize(linkName, targetPath) && !targetPath.empty()) {
+                    auto known = imported.find(targetPath);
+                    targetInodeNum = known != imported.end() ? known->second : resolvePath(targetPath);
                 }
-                if(prev_to_last) {
-                     prev_to_last->rec_len += last_entry->rec_len;
-                } else { // Só havia um item no diretório
-                     last_entry->inode = 0;
+                ext2_inode target;
+                if (targetInodeNum != 0) readInode(targetInodeNum, &target);
+                if (targetInodeNum == 0 || S_ISDIR(target.i_mode)) {
+                    std::cerr << "Warning: Skipping hard link '" << path << "': target '" << linkName
+                              << "' not found." << std::endl;
+                } else {
+                    if (addDirectoryEntry(parent, targetInodeNum, name, direntFileType(target.i_mode)) < 0) {
+                        std::cerr << "Error: Failed to add directory entry for '" << path << "'." << std::endl;
+                        failed = true;
+                        break;
+                    }
+                    target.i_links_count++;
+                    writeInode(targetInodeNum, &target);
+                    imported[path] = targetInodeNum;
+                    entries++;
+                }
+                skipData();
+                if (failed) break;
+                continue;
+            }
+
+            ext2_inode inode = {};
+            unsigned char fileType;
+            if (regular) {
+                inode.i_mode = S_IFREG;
+                fileType = EXT2_FT_REG_FILE;
+            } else if (type == '2') {
+                inode.i_mode = S_IFLNK;
+                fileType = EXT2_FT_SYMLINK;
+                if (linkName.size() >= blockSize) {
+                    std::cerr << "Warning: Skipping symlink '" << path << "': target too long." << std::endl;
+                    skipData();
+                    if (failed) break;
+                    continue;
                 }
-            } 
-            // CASO GERAL: Removendo do meio
-            else {
-                char* deletePtr = reinterpret_cast<char*>(entry_to_delete);
-                unsigned short deleteLen = entry_to_delete->rec_len;
-                char* nextPtr = deletePtr + deleteLen;
-                unsigned int moveLen = (blockStart + blockSize) - nextPtr;
-
-                // Move as entradas seguintes para preencher o espaço
-                memmove(deletePtr, nextPtr, moveLen);
-                
-                // Encontra o novo último item e ajusta seu rec_len
-                ext2_dir_entry_2* new_last_entry = nullptr;
-                offset = 0;
-                while (offset < (blockSize - deleteLen)) {
-                    ext2_dir_entry_2* current = (ext2_dir_entry_2*)(blockStart + offset);
-                    if (current->rec_len == 0) break;
-                    new_last_entry = current;
-                    offset += current->rec_len;
+            } else if (type == '3' || type == '4' || type == '6') {
+                inode.i_mode = type == '3' ? S_IFCHR : type == '4' ? S_IFBLK : S_IFIFO;
+                fileType = type == '3' ? EXT2_FT_CHRDEV : type == '4' ? EXT2_FT_BLKDEV : EXT2_FT_FIFO;
+                unsigned int major = tarNumber(header + 329, 8), minor = tarNumber(header + 337, 8);
+                if (type == '6') {
+                    // FIFO: sem número de dispositivo
+                } else if (major < 256 && minor < 256) {
+                    inode.i_block[0] = (major << 8) | minor;
+                } else {
+                    inode.i_block[1] = (minor & 0xff) | (major << 8) | ((minor & ~0xffu) << 12);
                 }
-                if (new_last_entry) {
-                    offset = (char*)new_last_entry - blockStart;
-                    new_last_entry->rec_len = blockSize - offset;
+            } else {
+                std::cerr << "Warning: Skipping '" << path << "': unsupported tar entry type '" << type << "'."
+                          << std::endl;
+                skipData();
+                if (failed) break;
+                continue;
+            }
+
+            int inodeNum = allocateInode();
+            if (inodeNum < 0) {
+                std::cerr << "Error: No free inodes available." << std::endl;
+                failed = true;
+                break;
+            }
+            setAttributes(inode);
+            inode.i_links_count = 1;
+
+            int stored = 0;
+            bool truncated = false; // Entrada acabou no preenchimento, depois dos dados
+            if (regular) {
+                try {
+                    stored = importFileData(inode, size, read, goal);
+                } catch (const std::exception& e) {
+                    std::cerr << e.what() << std::endl;
+                    freeInode(inodeNum);
+                    failed = true;
+                    break;
                 }
+                truncated = stored == 0 && !tar.read(nullptr, padding);
+                dataBytes += stored == 0 ? size : 0;
+            } else {
+                if (type == '2') stored = storeSymlinkTarget(inode, linkName);
+                skipData();
+            }
+            if (stored < 0) {
+                std::cerr << "Error: No space left for '" << path << "'." << std::endl;
+                freeInode(inodeNum);
+                failed = true;
+                break;
+            }
+
+            writeInode(inodeNum, &inode);
+            if (addDirectoryEntry(parent, inodeNum, name, fileType) < 0) {
+                // Sem entrada de diretório, o inode vai para a liberação adiada
+                std::cerr << "Error: Failed to add directory entry for '" << path << "'." << std::endl;
+                inode.i_links_count = 0;
+                orphanAdd(inodeNum, inode);
+                failed = true;
+                break;
+            }
+            imported[path] = inodeNum;
+            entries++;
+            if (truncated) {
+                std::cerr << "Error: Unexpected end of tar input." << std::endl;
+                failed = true;
+                break;
             }
-            writeBlock(currentInode.i_block[i], parentBlockData.data());
-            entryRemoved = true;
         }
+    } catch (...) {
+        endDeferredAllocation();
+        if (inFd >= 0) close(inFd);
+        throw;
     }
+    endDeferredAllocation();
+    reaperCv.notify_one();
 
-    if (!entryRemoved) {
-        std::cerr << "Error: Could not remove directory entry for '" << name << "'." << std::endl;
-        return;
-    }
+    // O tar ocupa o resto da entrada padrão (inclusive o preenchimento final)
+    if (fromStdin) tar.drain();
+    if (inFd >= 0) close(inFd);
 
-    // Atualiza o inode do diretório atual
-    currentInode.i_links_count--;
-    writeInode(currentInodeNum, &currentInode);
+    std::cout << (failed ? "Import stopped after " : "Imported ") << entries << " entries ("
+              << dataBytes << " bytes of file data)." << std::endl;
+}
 
-    // Atualiza o grupo do diretório atual
-    currentGroupDesc.bg_used_dirs_count--;
-    writeGroupDesc(currentGroupNum, &currentGroupDesc);
+// Abre (ou cria) o arquivo de overlay e remonta o índice de blocos. Um
+// registro incompleto no fim, de uma escrita interrompida, é descartado.
+void Ext2Shell::overlayOpen() {
+    overlayFd = open(overlayPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (overlayFd < 0) {
+        throw std::runtime_error("Error: Could not open overlay file '" + overlayPath + "'.");
+    }
 
-    // Atualiza o inode do diretório a ser deletado
-    targetInode.i_links_count = 0;
-    targetInode.i_dtime = time(nullptr);
-    writeInode(targetInodeNum, &targetInode);
+    struct stat st;
+    if (fstat(overlayFd, &st) != 0) {
+        throw std::runtime_error("Error: Could not stat overlay file '" + overlayPath + "'.");
+    }
 
-    // Libera o bloco de dados do diretório
-    if (targetInode.i_block[0] != 0) {
-        freeBlock(targetInode.i_block[0]);
+    OverlayHeader header;
+    if (st.st_size == 0) {
+        header = { OVERLAY_MAGIC, blockSize, super.s_blocks_count, 0 };
+        if (pwrite(overlayFd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            throw std::runtime_error("Error: Could not write overlay file '" + overlayPath + "'.");
+        }
+        overlayEnd = sizeof(header);
+        return;
     }
 
-    // Libera o inode do diretório
-    freeInode(targetInodeNum);
+    if (pread(overlayFd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || header.magic != OVERLAY_MAGIC) {
+        throw std::runtime_error("Error: '" + overlayPath + "' is not an overlay file.");
+    }
+    if (header.blockSize != blockSize || header.blocksCount != super.s_blocks_count) {
+        throw std::runtime_error("Error: Overlay file '" + overlayPath + "' belongs to a different image.");
+    }
 
-    std::cout << "Directory '" << name << "' removed successfully." << std::endl;
+    const off_t recordSize = sizeof(OverlayRecord) + blockSize;
+    off_t pos = sizeof(header);
+    while (pos + recordSize <= st.st_size) {
+        OverlayRecord record;
+        if (pread(overlayFd, &record, sizeof(record), pos) != (ssize_t)sizeof(record) ||
+            record.magic != OVERLAY_RECORD_MAGIC || record.block >= super.s_blocks_count) {
+            break;
+        }
+        overlayIndex[record.block] = pos + sizeof(record);
+        pos += recordSize;
+    }
+    if (pos < st.st_size && ftruncate(overlayFd, pos) != 0) {
+        throw std::runtime_error("Error: Could not truncate overlay file '" + overlayPath + "'.");
+    }
+    overlayEnd = pos;
+    std::cout << "Overlay: " << overlayIndex.size() << " modified block(s) in '" << overlayPath << "'." << std::endl;
 }
 
-// Copia um arquivo do sistema de arquivos para o sistema local
-void Ext2Shell::cmd_cp(const std::string& source, const std::string& dest) {
-    // Verifica se o arquivo de origem existe
-    unsigned int sourceInodeNum = getInodeByName(source);
-    if (sourceInodeNum == 0) {
-        std::cerr << "Error: Source file '" << source << "' does not exist." << std::endl;
+// Força o commit em grupo das transações pendentes e o checkpoint do diário
+void Ext2Shell::cmd_sync() {
+    if (journalFd < 0) {
+        if (!diskSync()) {
+            std::cerr << "Error: Could not sync the image." << std::endl;
+            return;
+        }
+        std::cout << "Image synced." << std::endl;
         return;
     }
+    journalCommit();
+    journalCheckpoint();
+    std::cout << "Journal committed and checkpointed." << std::endl;
+}
 
-    // Lê o inode do arquivo de origem
-    ext2_inode sourceInode;
-    readInode(sourceInodeNum, &sourceInode);
-
-    // Verifica se é um arquivo regular
-    if (!S_ISREG(sourceInode.i_mode)) {
-        std::cerr << "Error: Source '" << source << "' is not a regular file." << std::endl;
+// Aplica o overlay na imagem base e esvazia a camada. Se for interrompido,
+// o overlay continua intacto e o commit pode ser repetido.
+void Ext2Shell::cmd_commit() {
+    if (overlayFd < 0) {
+        std::cerr << "Error: Not running with an overlay." << std::endl;
         return;
     }
 
-    // Abre o fluxo de saída para o arquivo de destino
-    // Se o arquivo ja existe, vai ser sobrescrito
-    std::ofstream outFile(dest, std::ios::out | std::ios::binary);
-    if (!outFile.is_open()) { // Verifica se o arquivo de destino pode ser aberto (o arquivo foi criado com sucesso)
-        std::cerr << "Error: Could not open destination file '" << dest << "' for writing." << std::endl;
+    // O que ainda está no diário precisa chegar à camada antes
+    journalCommit();
+    journalCheckpoint();
+
+    int baseFd = open(imagePath.c_str(), O_RDWR);
+    if (baseFd < 0) {
+        std::cerr << "Error: Could not open base image '" << imagePath << "' for writing." << std::endl;
         return;
     }
 
-    // Buffer temporario para ler os blocos do arquivo
-    std::vector<char> buffer(blockSize);
-    unsigned int bytesCopied = 0;
-    const unsigned int fileSize = sourceInode.i_size; // Tamanho do arquivo de origem
-
-    // Percorre os 12 blocos diretos do inode do arquivo de origem
-    for (int i = 0; i < 12 && bytesCopied < fileSize; i++) {
-        // Se o ponteiro do bloco for 0, não há mais blocos para ler
-        if (sourceInode.i_block[i] == 0) break;
+    // Em ordem de bloco, para escrever a base sequencialmente
+    std::map<unsigned int, off_t> blocks(overlayIndex.begin(), overlayIndex.end());
+    BlockBuffer data = blockPool.acquire();
+    for (const auto& entry : blocks) {
+        if (pread(overlayFd, data.data(), blockSize, entry.second) != (ssize_t)blockSize ||
+            pwrite(baseFd, data.data(), blockSize, block_offset(entry.first, blockSize)) != (ssize_t)blockSize) {
+            close(baseFd);
+            std::cerr << "Error: Could not merge block " << entry.first << " into the base image." << std::endl;
+            return;
+        }
+    }
+    bool synced = fdatasync(baseFd) == 0;
+    close(baseFd);
+    if (!synced) {
+        std::cerr << "Error: Could not sync the base image." << std::endl;
+        return;
+    }
 
-        // Lê o bloco do arquivo de origem pro buffer
-        readBlock(sourceInode.i_block[i], buffer.data());
+    // Só com a base durável a camada pode ser esvaziada
+    overlayIndex.clear();
+    overlayEnd = sizeof(OverlayHeader);
+    if (ftruncate(overlayFd, overlayEnd) != 0 || fdatasync(overlayFd) != 0) {
+        std::cerr << "Error: Could not truncate overlay file '" << overlayPath << "'." << std::endl;
+        return;
+    }
 
-        unsigned int bytesToWrite = std::min((unsigned int)blockSize,fileSize - bytesCopied); // Calcula quantos bytes escrever neste bloco
+    std::cout << "Overlay committed: " << blocks.size() << " block(s) merged into '" << imagePath << "'." << std::endl;
+}
 
-        outFile.write(buffer.data(), bytesToWrite); // Escreve o bloco no arquivo de destino
+// --- Criação de Imagens (--mkfs) ---
 
-        // Atualiza o contador de bytes copiados
-        bytesCopied += bytesToWrite;
+// Cria uma imagem EXT2 (revisão 1) vazia, só com a raiz e o lost+found. O
+// arquivo é recriado esparso; o que não é escrito aqui já lê como zero.
+void Ext2Shell::format(const std::string& imagePath, unsigned long long size, unsigned int blockSize, bool lazyInodeTables) {
+    if (blockSize != 1024 && blockSize != 2048 && blockSize != 4096) {
+        throw std::runtime_error("Error: Block size must be 1024, 2048 or 4096.");
+    }
+    if (size / blockSize > 0xFFFFFFFFULL) {
+        throw std::runtime_error("Error: Image too large for 32-bit block numbers with this block size.");
     }
 
-    // Processa os blocos indiretos, se necessário (i_block[12] e i_block[13])
-    if (bytesCopied < fileSize && sourceInode.i_block[12] != 0) {
-        // Lê o bloco indireto
-        std::vector<unsigned int> indirectBlockpointers(blockSize / sizeof(unsigned int));
-        readBlock(sourceInode.i_block[12], (char*)indirectBlockpointers.data());
-
-        //  Percorre os ponteiros do bloco indireto
-        for (unsigned int dataBlockNum : indirectBlockpointers) {
-            if (bytesCopied >= fileSize || dataBlockNum == 0) break; // Se já copiou todo o arquivo, sai do loop
+    const unsigned int inodeSize = 256;
+    const unsigned int firstDataBlock = blockSize == 1024 ? 1 : 0;
+    const unsigned int blocksPerGroup = blockSize * 8;
+    const unsigned int inodeRatio = size < (512ULL << 20) ? 4096 : 16384; // Bytes por inode, como no mke2fs
+    unsigned int blocksCount = size / blockSize;
+    if (blocksCount <= firstDataBlock) {
+        throw std::runtime_error("Error: Image too small.");
+    }
 
-            // Lê o bloco de dados apontado pelo ponteiro indireto
-            readBlock(dataBlockNum, buffer.data());
+    // Inodes por grupo: proporcionais ao espaço, preenchendo blocos inteiros da tabela
+    unsigned int groups = (blocksCount - firstDataBlock + blocksPerGroup - 1) / blocksPerGroup;
+    const unsigned int inodesPerBlock = blockSize / inodeSize;
+    unsigned long long wantedInodes = std::max<unsigned long long>(size / inodeRatio, 16);
+    unsigned int inodesPerGroup = (wantedInodes + groups - 1) / groups;
+    inodesPerGroup = (inodesPerGroup + inodesPerBlock - 1) / inodesPerBlock * inodesPerBlock;
+    inodesPerGroup = (inodesPerGroup + 7) / 8 * 8;
+    inodesPerGroup = std::min(inodesPerGroup, blocksPerGroup);
+    const unsigned int tableBlocks = inodesPerGroup / inodesPerBlock;
+
+    // Um último grupo pequeno demais para os próprios metadados é descartado
+    unsigned int gdtBlocks = (groups * sizeof(ext2_group_desc) + blockSize - 1) / blockSize;
+    unsigned int lastBlocks = blocksCount - firstDataBlock - (groups - 1) * blocksPerGroup;
+    if (groups > 1 && lastBlocks < 1 + gdtBlocks + 2 + tableBlocks + 50) {
+        groups--;
+        blocksCount = firstDataBlock + groups * blocksPerGroup;
+        gdtBlocks = (groups * sizeof(ext2_group_desc) + blockSize - 1) / blockSize;
+    }
+    if (blocksCount < firstDataBlock + 1 + gdtBlocks + 2 + tableBlocks + 2) {
+        throw std::runtime_error("Error: Image too small.");
+    }
+    if ((unsigned long long)inodesPerGroup * groups > 0xFFFFFFFFULL) {
+        throw std::runtime_error("Error: Too many inodes.");
+    }
 
-            unsigned int bytesToWrite = std::min((unsigned int)blockSize, fileSize - bytesCopied); // Calcula quantos bytes escrever neste bloco
-            outFile.write(buffer.data(), bytesToWrite); // Escreve o bloco no arquivo de destino
-            bytesCopied += bytesToWrite; // Atualiza o contador de bytes copiados
+    int fd = open(imagePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Error: Could not create image file '" + imagePath + "'.");
+    }
+    auto put = [&](off_t offset, const void* data, size_t length) {
+        if (pwrite(fd, data, length, offset) != (ssize_t)length) {
+            close(fd);
+            throw std::runtime_error("Error: Could not write image file '" + imagePath + "'.");
         }
+    };
+    if (ftruncate(fd, (off_t)blocksCount * blockSize) != 0) {
+        close(fd);
+        throw std::runtime_error("Error: Could not resize image file '" + imagePath + "'.");
     }
 
-    if (bytesCopied < fileSize && sourceInode.i_block[13] != 0) {
-        // Lê o bloco indireto duplo
-        std::vector<unsigned int> doubleIndirectBlockPointers(blockSize / sizeof(unsigned int));
-        readBlock(sourceInode.i_block[13], (char*)doubleIndirectBlockPointers.data());
-
-        // Percorre cada ponteiro para um bloco indireto
-        for (unsigned int singleIndirectBlockNum : doubleIndirectBlockPointers) {
-            if (bytesCopied >= fileSize || singleIndirectBlockNum == 0) break; // Se já copiou todo o arquivo, sai do loop
-
-            // Buffer para ler os blocos indiretos simples
-            std::vector<unsigned int> singleIndirectBlockPointers(blockSize / sizeof(unsigned int));
-            readBlock(singleIndirectBlockNum, (char*)singleIndirectBlockPointers.data());
-
-            // Percorre os ponteiros do bloco de dados indireto simples
-            for (unsigned int dataBlockNum : singleIndirectBlockPointers) {
-                if (bytesCopied >= fileSize || dataBlockNum == 0) break; // Se já copiou todo o arquivo, sai do loop
+    const uint32_t now = time(nullptr);
+    ext2_super_block sb = {};
+    sb.s_inodes_count = inodesPerGroup * groups;
+    sb.s_blocks_count = blocksCount;
+    sb.s_r_blocks_count = blocksCount / 20; // 5% reservados ao root
+    sb.s_first_data_block = firstDataBlock;
+    sb.s_log_block_size = sb.s_log_frag_size = blockSize == 1024 ? 0 : blockSize == 2048 ? 1 : 2;
+    sb.s_blocks_per_group = sb.s_frags_per_group = blocksPerGroup;
+    sb.s_inodes_per_group = inodesPerGroup;
+    sb.s_wtime = sb.s_lastcheck = sb.s_mkfs_time = now;
+    sb.s_max_mnt_count = 0xFFFF;
+    sb.s_magic = EXT2_SUPER_MAGIC;
+    sb.s_state = 1;  // Desmontado corretamente
+    sb.s_errors = 1; // Continuar
+    sb.s_rev_level = 1;
+    sb.s_first_ino = 11;
+    sb.s_inode_size = inodeSize;
+    sb.s_feature_compat = EXT2_FEATURE_COMPAT_DIR_INDEX;
+    sb.s_feature_incompat = EXT2_FEATURE_INCOMPAT_FILETYPE;
+    sb.s_feature_ro_compat = EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+    if (lazyInodeTables) sb.s_feature_ro_compat |= EXT2_FEATURE_RO_COMPAT_GDT_CSUM;
+    sb.s_def_hash_version = EXT2_HASH_HALF_MD4;
+    sb.s_flags = ((char)-1 < 0) ? EXT2_FLAGS_SIGNED_HASH : EXT2_FLAGS_UNSIGNED_HASH;
+    int randomFd = open("/dev/urandom", O_RDONLY);
+    if (randomFd < 0 || read(randomFd, sb.s_uuid, sizeof(sb.s_uuid)) != (ssize_t)sizeof(sb.s_uuid) ||
+        read(randomFd, sb.s_hash_seed, sizeof(sb.s_hash_seed)) != (ssize_t)sizeof(sb.s_hash_seed)) {
+        if (randomFd >= 0) close(randomFd);
+        close(fd);
+        throw std::runtime_error("Error: Could not read /dev/urandom.");
+    }
+    close(randomFd);
+    sb.s_uuid[6] = (sb.s_uuid[6] & 0x0F) | 0x40; // UUID versão 4
+    sb.s_uuid[8] = (sb.s_uuid[8] & 0x3F) | 0x80;
+
+    // Disposição de cada grupo: [superbloco + descritores], bitmap de blocos,
+    // bitmap de inodes, tabela de inodes e, depois, os dados
+    std::vector<ext2_group_desc> descs(groups);
+    std::vector<unsigned int> dataStart(groups);
+    unsigned long long freeBlocks = 0;
+    for (unsigned int g = 0; g < groups; g++) {
+        unsigned int first = g * blocksPerGroup + firstDataBlock;
+        unsigned int groupBlocks = std::min(blocksPerGroup, blocksCount - first);
+        unsigned int next = first + (groupHasSuper(g, sb.s_feature_ro_compat) ? 1 + gdtBlocks : 0);
+
+        ext2_group_desc& desc = descs[g];
+        desc = {};
+        desc.bg_block_bitmap = next;
+        desc.bg_inode_bitmap = next + 1;
+        desc.bg_inode_table = next + 2;
+        dataStart[g] = next + 2 + tableBlocks;
+        desc.bg_free_blocks_count = groupBlocks - (dataStart[g] - first);
+        desc.bg_free_inodes_count = inodesPerGroup;
+        if (lazyInodeTables && g > 0) {
+            // Nada usado ainda: o bitmap de inodes e a tabela ficam para depois.
+            // O último grupo mantém o bitmap de blocos, como exige o kernel.
+            desc.bg_flags = EXT2_BG_INODE_UNINIT | (g + 1 < groups ? EXT2_BG_BLOCK_UNINIT : 0);
+            desc.bg_itable_unused = inodesPerGroup;
+        }
+    }
 
-                // Lê o bloco de dados apontado pelo ponteiro indireto simples
-                readBlock(dataBlockNum, buffer.data());
+    // Raiz (inode 2) e lost+found (inode 11), um bloco cada no grupo 0;
+    // os inodes 1 a 10 são reservados
+    const unsigned int rootBlock = dataStart[0];
+    const unsigned int lostFoundBlock = dataStart[0] + 1;
+    const unsigned int lostFoundIno = 11;
+    descs[0].bg_free_blocks_count -= 2;
+    descs[0].bg_free_inodes_count -= lostFoundIno;
+    descs[0].bg_used_dirs_count = 2;
+    if (lazyInodeTables) descs[0].bg_itable_unused = inodesPerGroup - lostFoundIno;
+    for (const auto& desc : descs) freeBlocks += desc.bg_free_blocks_count;
+    sb.s_free_blocks_count = freeBlocks;
+    sb.s_free_inodes_count = sb.s_inodes_count - lostFoundIno;
+    if (lazyInodeTables) {
+        for (unsigned int g = 0; g < groups; g++) descs[g].bg_checksum = groupDescChecksum(sb.s_uuid, g, descs[g]);
+    }
 
-                unsigned int bytesToWrite = std::min((unsigned int)blockSize, fileSize - bytesCopied); // Calcula quantos bytes escrever neste bloco
-                outFile.write(buffer.data(), bytesToWrite); // Escreve o bloco no arquivo de destino
-                bytesCopied += bytesToWrite; // Atualiza o contador de bytes copiados
+    // Bitmaps: só os dos grupos inicializados são gravados
+    std::vector<unsigned char> bitmap(blockSize);
+    for (unsigned int g = 0; g < groups; g++) {
+        unsigned int first = g * blocksPerGroup + firstDataBlock;
+        unsigned int groupBlocks = std::min(blocksPerGroup, blocksCount - first);
+        if (!(descs[g].bg_flags & EXT2_BG_BLOCK_UNINIT)) {
+            std::fill(bitmap.begin(), bitmap.end(), 0);
+            unsigned int used = dataStart[g] - first + (g == 0 ? 2 : 0);
+            for (unsigned int i = 0; i < blockSize * 8; i++) {
+                if (i < used || i >= groupBlocks) bitmap[i / 8] |= 1 << (i % 8);
+            }
+            put(block_offset(descs[g].bg_block_bitmap, blockSize), bitmap.data(), blockSize);
+        }
+        if (!(descs[g].bg_flags & EXT2_BG_INODE_UNINIT)) {
+            std::fill(bitmap.begin(), bitmap.end(), 0);
+            unsigned int used = g == 0 ? lostFoundIno : 0;
+            for (unsigned int i = 0; i < blockSize * 8; i++) {
+                if (i < used || i >= inodesPerGroup) bitmap[i / 8] |= 1 << (i % 8);
             }
+            put(block_offset(descs[g].bg_inode_bitmap, blockSize), bitmap.data(), blockSize);
         }
     }
 
-    outFile.close(); // Fecha o arquivo de destino
-
-    std::cout << "File '" << source << "' copied to '" << dest << "' successfully." << std::endl;
-}
-
-// Renomeia um arquivo ou diretório
-void Ext2Shell::cmd_rename(const std::string& oldName, const std::string& newName) {
-    // Validações iniciais
-    if (newName.length() >= EXT2_NAME_LEN) {
-        std::cerr << "Error: New name is too long." << std::endl;
-        return;
-    }
-    unsigned int inodeNum = getInodeByName(oldName);
-    if (inodeNum == 0) {
-        std::cerr << "Error: '" << oldName << "' not found." << std::endl;
-        return;
-    }
-    if (getInodeByName(newName) != 0) {
-        std::cerr << "Error: '" << newName << "' already exists." << std::endl;
-        return;
+    // Sem o modo preguiçoso, as tabelas de inodes são zeradas de fato
+    if (!lazyInodeTables) {
+        std::vector<char> zeros(std::min<size_t>((size_t)tableBlocks * blockSize, 1 << 20), 0);
+        for (unsigned int g = 0; g < groups; g++) {
+            off_t offset = block_offset(descs[g].bg_inode_table, blockSize);
+            off_t end = offset + (off_t)tableBlocks * blockSize;
+            for (; offset < end; offset += zeros.size()) {
+                put(offset, zeros.data(), std::min<off_t>(zeros.size(), end - offset));
+            }
+        }
     }
 
-    // Lê o inode do arquivo ou diretório atual
-    bool operationCompleted = false;
-    for (int i = 0; i < 12 && !operationCompleted; i++) {
-        if (currentInode.i_block[i] == 0) continue;
+    // Superbloco e tabela de descritores, no grupo 0 e nas cópias de segurança
+    std::vector<char> gdt((size_t)gdtBlocks * blockSize, 0);
+    memcpy(gdt.data(), descs.data(), groups * sizeof(ext2_group_desc));
+    for (unsigned int g = 0; g < groups; g++) {
+        if (!groupHasSuper(g, sb.s_feature_ro_compat)) continue;
+        unsigned int first = g * blocksPerGroup + firstDataBlock;
+        sb.s_block_group_nr = g;
+        put(g == 0 ? BASE_OFFSET : block_offset(first, blockSize), &sb, sizeof(sb));
+        put(block_offset(first + 1, blockSize), gdt.data(), gdt.size());
+    }
 
-        std::vector<char> blockData(blockSize);
-        readBlock(currentInode.i_block[i], blockData.data());
-        
+    // Inodes e blocos da raiz e do lost+found
+    auto putInode = [&](unsigned int inodeNum, unsigned int block, uint16_t mode, uint16_t links) {
+        ext2_inode inode = {};
+        inode.i_mode = mode;
+        inode.i_size = blockSize;
+        inode.i_atime = inode.i_ctime = inode.i_mtime = now;
+        inode.i_links_count = links;
+        inode.i_blocks = blockSize / 512;
+        inode.i_block[0] = block;
+        put(block_offset(descs[0].bg_inode_table, blockSize) + (off_t)(inodeNum - 1) * inodeSize, &inode, sizeof(inode));
+    };
+    putInode(EXT2_ROOT_INO, rootBlock, EXT2_S_IFDIR | 0755, 3);
+    putInode(lostFoundIno, lostFoundBlock, EXT2_S_IFDIR | 0700, 2);
+
+    auto putDirBlock = [&](unsigned int block, const std::vector<std::pair<unsigned int, std::string>>& entries) {
+        std::vector<char> data(blockSize, 0);
         unsigned int offset = 0;
-        ext2_dir_entry_2* entry_to_rename = nullptr;
-        // Encontra o ponteiro para a entrada que queremos renomear
-        while (offset < blockSize) {
-            ext2_dir_entry_2* entry = (ext2_dir_entry_2*)&blockData[offset];
-            if (entry->rec_len == 0) break;
-            if (entry->inode == inodeNum && std::string(entry->name, entry->name_len) == oldName) {
-                entry_to_rename = entry;
-                break;
-            }
+        for (size_t i = 0; i < entries.size(); i++) {
+            ext2_dir_entry_2* entry = reinterpret_cast<ext2_dir_entry_2*>(&data[offset]);
+            entry->inode = entries[i].first;
+            entry->name_len = entries[i].second.size();
+            entry->file_type = EXT2_FT_DIR;
+            memcpy(entry->name, entries[i].second.data(), entry->name_len);
+            entry->rec_len = (i + 1 < entries.size()) ? (8 + entry->name_len + 3) / 4 * 4 : blockSize - offset;
             offset += entry->rec_len;
         }
+        put(block_offset(block, blockSize), data.data(), blockSize);
+    };
+    putDirBlock(rootBlock, {{EXT2_ROOT_INO, "."}, {EXT2_ROOT_INO, ".."}, {lostFoundIno, "lost+found"}});
+    putDirBlock(lostFoundBlock, {{lostFoundIno, "."}, {EXT2_ROOT_INO, ".."}});
+
+    bool synced = fdatasync(fd) == 0;
+    close(fd);
+    if (!synced) {
+        throw std::runtime_error("Error: Could not sync image file '" + imagePath + "'.");
+    }
 
-        if (entry_to_rename) {
-            // Calcula o espaço mínimo que a nova entrada precisa
-            unsigned int neededLen = (8 + newName.length() + 3) & ~3;
-
-            // Se o novo nome cabe na entrada atual, renomeia diretamente
-            if (neededLen <= entry_to_rename->rec_len) {
-                entry_to_rename->name_len = newName.length();
-                memset(entry_to_rename->name, 0, oldName.length()); // Limpa o nome antigo
-                strncpy(entry_to_rename->name, newName.c_str(), entry_to_rename->name_len);
-                
-                // Salva a alteração e termina
-                writeBlock(currentInode.i_block[i], blockData.data());
+    std::cout << "Created '" << imagePath << "': " << blocksCount << " blocks of " << blockSize << " bytes, "
+              << groups << " groups, " << sb.s_inodes_count << " inodes"
+              << (lazyInodeTables ? " (inode tables not initialized)." : ".") << std::endl;
+}
 
-            } else {
-                // Se o novo nome não cabe, remove a entrada antiga e adiciona uma nova entrada com o novo nome
-                ext2_dir_entry_2* prev = nullptr;
-                unsigned int internal_offset = 0;
-                while (internal_offset < blockSize) {
-                    ext2_dir_entry_2* e = (ext2_dir_entry_2*)&blockData[internal_offset];
-                    if (e->rec_len == 0) break;
-                    if (e == entry_to_rename) {
-                        if (prev) prev->rec_len += e->rec_len;
-                        else e->inode = 0;
-                        break;
-                    }
-                    if (e->inode != 0) prev = e;
-                    internal_offset += e->rec_len;
+// Compara duas imagens (modo --diff). O trabalho é proporcional ao que está
+// ocupado, não ao tamanho das imagens:
+//  1. Grupo a grupo, em paralelo, os bitmaps das duas imagens dizem quais
+//     blocos e inodes estão ocupados em pelo menos uma delas; só esses
+//     blocos são lidos e comparados, e só os blocos da tabela de inodes que
+//     contêm inodes ocupados.
+//  2. Inodes ocupados nas duas com o mesmo conteúdo (fora i_atime) ainda
+//     podem ter dados alterados: os blocos de cada um são cruzados com o
+//     conjunto de blocos que mudaram.
+//  3. As duas árvores de diretórios dão os caminhos; um caminho com outro
+//     inode, ou com um inode que mudou, conta como alterado.
+int Ext2Shell::diffImages(const std::string& oldImagePath, const std::string& newImagePath) {
+    Ext2Shell oldShell(oldImagePath, false, "", true);
+    Ext2Shell newShell(newImagePath, false, "", true);
+    const ext2_super_block& a = oldShell.super;
+    const ext2_super_block& b = newShell.super;
+    if (oldShell.blockSize != newShell.blockSize || a.s_blocks_count != b.s_blocks_count ||
+        a.s_blocks_per_group != b.s_blocks_per_group || a.s_inodes_per_group != b.s_inodes_per_group ||
+        oldShell.inodeSize != newShell.inodeSize) {
+        std::cerr << "Error: The images have different geometry; only snapshots of the same filesystem can be compared."
+                  << std::endl;
+        return 1;
+    }
+    const unsigned int blockSize = newShell.blockSize;
+    const unsigned int numGroups = newShell.groupCount();
+
+    // 1. Blocos e inodes, grupo por grupo
+    struct GroupDiff {
+        std::vector<unsigned int> changedBlocks;
+        std::vector<unsigned int> changedInodes; // Ocupados nas duas, com inode diferente
+        std::vector<unsigned int> sameInodes;    // Ocupados nas duas, com inode igual
+    };
+    std::vector<GroupDiff> groups(numGroups);
+    newShell.parallelFor(numGroups, [&](size_t group) {
+        GroupDiff& result = groups[group];
+        ext2_group_desc oldDesc, newDesc;
+        oldShell.readGroupDesc(group, &oldDesc);
+        newShell.readGroupDesc(group, &newDesc);
+        BlockBuffer oldBitmapBuffer = newShell.blockPool.acquire(), newBitmapBuffer = newShell.blockPool.acquire();
+        unsigned char* oldBitmap = oldBitmapBuffer.as<unsigned char>();
+        unsigned char* newBitmap = newBitmapBuffer.as<unsigned char>();
+
+        // Blocos ocupados em uma só das imagens mudaram; nas duas, compara
+        oldShell.readBlockBitmap(group, oldDesc, oldBitmap);
+        newShell.readBlockBitmap(group, newDesc, newBitmap);
+        unsigned int first = group * b.s_blocks_per_group + b.s_first_data_block;
+        std::vector<unsigned int> pending;
+        BlockBuffer oldBatchBuffer = oldShell.blockPool.acquireBatch();
+        BlockBuffer newBatchBuffer = newShell.blockPool.acquireBatch();
+        char* oldBatch = oldBatchBuffer.data();
+        char* newBatch = newBatchBuffer.data();
+        auto flush = [&]() {
+            oldShell.readBlocks(pending, oldBatch);
+            newShell.readBlocks(pending, newBatch);
+            for (size_t i = 0; i < pending.size(); i++) {
+                if (memcmp(oldBatch + i * blockSize, newBatch + i * blockSize, blockSize) != 0) {
+                    result.changedBlocks.push_back(pending[i]);
                 }
-                
-                // Escreve o bloco com a entrada já removida no disco
-                writeBlock(currentInode.i_block[i], blockData.data());
-
-                // Adiciona uma nova entrada com o novo nome
-                ext2_inode targetInode;
-                readInode(inodeNum, &targetInode);
-                unsigned char fileType = S_ISDIR(targetInode.i_mode) ? EXT2_FT_DIR : EXT2_FT_REG_FILE;
-                if (addDirectoryEntry(currentInodeNum, inodeNum, newName, fileType) < 0) {
-                    std::cerr << "Error: Could not add new entry for '" << newName << "'. Filesystem may be inconsistent." << std::endl;
+            }
+            pending.clear();
+        };
+        unsigned int groupBlocks = newShell.blocksInGroup(group);
+        for (unsigned int i = 0; i < groupBlocks; i++) {
+            bool inOld = newShell.isBitSet(oldBitmap, i), inNew = newShell.isBitSet(newBitmap, i);
+            if (inOld != inNew) {
+                result.changedBlocks.push_back(first + i);
+            } else if (inOld) {
+                pending.push_back(first + i);
+                if (pending.size() == IO_BATCH_BLOCKS) flush();
+            }
+        }
+        if (!pending.empty()) flush();
+
+        // Inodes ocupados nas duas: compara o conteúdo de cada um
+        oldShell.readInodeBitmap(oldDesc, oldBitmap);
+        newShell.readInodeBitmap(newDesc, newBitmap);
+        for (unsigned int i = 0; i < b.s_inodes_per_group; i++) {
+            if (!newShell.isBitSet(oldBitmap, i) || !newShell.isBitSet(newBitmap, i)) continue;
+            unsigned int inodeNum = group * b.s_inodes_per_group + i + 1;
+            ext2_inode oldInode, newInode;
+            oldShell.readInode(inodeNum, &oldInode);
+            newShell.readInode(inodeNum, &newInode);
+            oldInode.i_atime = newInode.i_atime;
+            if (memcmp(&oldInode, &newInode, sizeof(ext2_inode)) != 0) {
+                result.changedInodes.push_back(inodeNum);
+            } else {
+                result.sameInodes.push_back(inodeNum);
+            }
+        }
+    });
+
+    std::unordered_set<unsigned int> changedBlocks;
+    std::unordered_set<unsigned int> changedInodes;
+    std::vector<unsigned int> sameInodes;
+    for (const GroupDiff& group : groups) {
+        changedBlocks.insert(group.changedBlocks.begin(), group.changedBlocks.end());
+        changedInodes.insert(group.changedInodes.begin(), group.changedInodes.end());
+        sameInodes.insert(sameInodes.end(), group.sameInodes.begin(), group.sameInodes.end());
+    }
+
+    // 2. Inode igual, mas algum bloco (de dados ou de ponteiros) mudou
+    if (!changedBlocks.empty()) {
+        std::vector<char> dataChanged(sameInodes.size(), 0);
+        newShell.parallelFor(sameInodes.size(), [&](size_t i) {
+            ext2_inode inode;
+            newShell.readInode(sameInodes[i], &inode);
+            std::vector<unsigned int> blocks;
+            newShell.collectInodeBlocks(inode, blocks);
+            for (unsigned int block : blocks) {
+                if (changedBlocks.count(block)) {
+                    dataChanged[i] = 1;
                     return;
                 }
             }
-            operationCompleted = true;
+        });
+        for (size_t i = 0; i < sameInodes.size(); i++) {
+            if (dataChanged[i]) changedInodes.insert(sameInodes[i]);
         }
     }
 
-    if (operationCompleted) {
-        std::cout << "Renamed '" << oldName << "' to '" << newName << "' successfully." << std::endl;
-    } else {
-        std::cerr << "Error: Could not find entry to rename." << std::endl;
+    // 3. Caminhos nas duas árvores
+    auto collectPaths = [](Ext2Shell& shell) {
+        std::map<std::string, unsigned int> paths;
+        shell.forEachInodeInTree(EXT2_ROOT_INO, "/", [&](const std::string& path, unsigned int inodeNum, const ext2_inode&) {
+            paths[path] = inodeNum;
+        });
+        return paths;
+    };
+    std::map<std::string, unsigned int> oldPaths = collectPaths(oldShell);
+    std::map<std::string, unsigned int> newPaths = collectPaths(newShell);
+
+    unsigned int added = 0, deleted = 0, modified = 0;
+    auto oldIt = oldPaths.begin();
+    auto newIt = newPaths.begin();
+    while (oldIt != oldPaths.end() || newIt != newPaths.end()) {
+        if (newIt == newPaths.end() || (oldIt != oldPaths.end() && oldIt->first < newIt->first)) {
+            std::cout << "D\t" << oldIt->first << "\n";
+            deleted++;
+            ++oldIt;
+        } else if (oldIt == oldPaths.end() || newIt->first < oldIt->first) {
+            std::cout << "A\t" << newIt->first << "\n";
+            added++;
+            ++newIt;
+        } else {
+            if (oldIt->second != newIt->second || changedInodes.count(newIt->second)) {
+                std::cout << "M\t" << newIt->first << "\n";
+                modified++;
+            }
+            ++oldIt;
+            ++newIt;
+        }
     }
+    std::cout << added << " added, " << deleted << " deleted, " << modified << " modified ("
+              << changedBlocks.size() << " blocks differ)." << std::endl;
+    return 0;
 }
\ No newline at end of file
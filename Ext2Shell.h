@@ -10,28 +10,150 @@
 #endif
 
 #include <string>
+#include <sys/types.h>
 #include <vector>
 #include <functional>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include "nEXT2shell.h" // Seu arquivo original com as structs do EXT2
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 
 // Constantes e macros movidas para dentro da classe ou usadas diretamente.
 #define BASE_OFFSET 1024
 #define EXT2_SUPER_MAGIC 0xEF53
 
+// Diário de metadados (arquivo "<imagem>.journal")
+#define JOURNAL_MAGIC 0x4C4E4A6E        // "nJNL"
+#define JOURNAL_GROUP_TXNS 32           // Transações por commit em grupo
+#define JOURNAL_GROUP_BYTES (1 << 20)   // ...ou bytes acumulados por commit
+#define JOURNAL_COMMIT_MS 1000          // Prazo máximo até o commit em grupo
+#define JOURNAL_MAX_BYTES (16 << 20)    // Tamanho que dispara o checkpoint
+
+// Leituras em lote
+#define IO_QUEUE_DEPTH 64               // Pedidos em voo no io_uring
+#define IO_BATCH_BLOCKS 64              // Blocos de dados lidos por lote
+#define READAHEAD_MIN_BLOCKS 64         // Janela inicial de leitura antecipada
+#define READAHEAD_MAX_BLOCKS 4096       // Limite da janela (dobra a cada avanço)
+
+// Comandos que leem arquivos em paralelo (sum, grep)
+#define MAX_WORKER_THREADS 8            // Threads por comando
+#define GREP_MAX_LINE 4096              // Linha mais longa guardada inteira pelo grep
+
+// Exportação e importação em tar (export-tar, import-tar)
+#define TAR_WRITE_BUFFER (1 << 20)      // Saída acumulada antes de cada write
+#define TAR_READ_BUFFER (1 << 20)       // Entrada lida de cada vez
+
+// Camada de cópia (--overlay): arquivo com as versões alteradas dos blocos
+#define OVERLAY_MAGIC 0x4C564F6E        // "nOVL", cabeçalho do arquivo
+#define OVERLAY_RECORD_MAGIC 0x4B4C426E // "nBLK", cabeçalho de cada bloco
+
+// Alocação de blocos
+#define RESERVE_MIN_RUN 64              // Menor trecho aceito antes de juntar fragmentos
+
+// Links simbólicos
+#define SYMLINK_CACHE_MAX 1024          // Destinos guardados no cache LRU
+#define SYMLINK_MAX_FOLLOW 40           // Links seguidos por caminho (como o ELOOP do Linux)
+
+// Buffers de bloco
+#define BLOCK_POOL_MAX_FREE 64          // Buffers guardados para reuso
+#define BLOCK_POOL_MAX_FREE_BATCHES (2 * MAX_WORKER_THREADS) // Lotes guardados para reuso
+
+class BlockPool;
+
+// Empréstimo de um buffer do pool (um bloco ou um lote de IO_BATCH_BLOCKS
+// blocos): devolve o buffer ao sair de escopo. Pode ser movido, não copiado.
+class BlockBuffer {
+public:
+    BlockBuffer() : pool(nullptr), memory(nullptr), batch(false) {}
+    BlockBuffer(BlockPool* pool, char* memory, bool batch = false) : pool(pool), memory(memory), batch(batch) {}
+    BlockBuffer(BlockBuffer&& other) noexcept;
+    BlockBuffer& operator=(BlockBuffer&& other) noexcept;
+    BlockBuffer(const BlockBuffer&) = delete;
+    BlockBuffer& operator=(const BlockBuffer&) = delete;
+    ~BlockBuffer();
+
+    char* data() const { return memory; }
+    template <typename T> T* as() const { return reinterpret_cast<T*>(memory); }
+
+private:
+    BlockPool* pool;
+    char* memory;
+    bool batch; // Veio de acquireBatch
+};
+
+// Pool de buffers do tamanho de um bloco, alinhados à página (servem também
+// para O_DIRECT). Buffers devolvidos voltam para uma lista de livres, então
+// os laços de leitura não alocam memória a cada bloco. Os lotes das leituras
+// em lote (IO_BATCH_BLOCKS blocos) têm uma lista de livres própria.
+class BlockPool {
+public:
+    BlockPool() : size(0) {}
+    ~BlockPool();
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+
+    // Define o tamanho dos buffers (descarta os livres de outro tamanho)
+    void setBufferSize(size_t bufferSize);
+    // Empresta um buffer, zerado se 'zeroed'
+    BlockBuffer acquire(bool zeroed = false);
+    // Empresta um buffer de IO_BATCH_BLOCKS blocos, para readBlocks
+    BlockBuffer acquireBatch();
+    void release(char* memory, bool batch = false);
+
+private:
+    size_t size;
+    std::vector<char*> freeList;
+    std::vector<char*> batchFreeList;
+    std::mutex mutex; // A thread de liberação adiada também lê blocos
+};
+
 class Ext2Shell {
 public:
     // O construtor inicializa o sistema de arquivos a partir de uma imagem.
-    Ext2Shell(const std::string& imagePath);
+    // Com 'journal', as alterações de metadados passam pelo diário. Com
+    // 'overlayPath', a imagem é aberta só para leitura e toda escrita vai
+    // para o arquivo de camada de cópia. Com 'readOnly', a imagem não é
+    // alterada de forma alguma (nem diário, nem liberação de órfãos).
+    Ext2Shell(const std::string& imagePath, bool journal = false, const std::string& overlayPath = "",
+              bool readOnly = false);
     // O destrutor fecha o arquivo da imagem.
     ~Ext2Shell();
 
     // Inicia o loop principal do shell.
     void run();
 
+    // Modo servidor: atende comandos de vários clientes por um socket Unix,
+    // mantendo a imagem aberta e os caches quentes entre chamadas.
+    void serve(const std::string& socketPath);
+    // Cliente do modo servidor: envia os comandos (ou a entrada padrão) e
+    // imprime as respostas. Retorna o código de saída do processo.
+    static int runClient(const std::string& socketPath, const std::vector<std::string>& commands);
+
+    // Cria uma imagem EXT2 nova e vazia (modo --mkfs). Com 'lazyInodeTables',
+    // as tabelas de inodes não são zeradas e os grupos ficam marcados como
+    // não inicializados (uninit_bg).
+    static void format(const std::string& imagePath, unsigned long long size, unsigned int blockSize, bool lazyInodeTables);
+
+    // Compara duas imagens da mesma geometria (modo --diff) e lista os
+    // arquivos adicionados, removidos e alterados. Retorna o código de saída.
+    static int diffImages(const std::string& oldImagePath, const std::string& newImagePath);
+
+    // Lê um tamanho ou offset em bytes, com sufixo opcional K, M, G ou T
+    // (base 1024), como em "512M". Retorna false se o texto for inválido.
+    static bool parseSize(const std::string& text, unsigned long long& value);
+
 private:
     // --- Membros do Estado ---
     int fd; // Descritor do arquivo da imagem
     std::string imagePath;
+    bool readOnly;
     ext2_super_block super;
     ext2_group_desc currentGroupDesc;
     ext2_inode currentInode;
@@ -39,17 +161,116 @@ private:
     unsigned int currentInodeNum;
     std::vector<std::string> currentPath;
     unsigned int blockSize;
+    BlockPool blockPool;                // Buffers de blockSize bytes
+    unsigned int inodeSize; // Tamanho de cada inode na tabela (s_inode_size)
+
+    // Trava do sistema de arquivos: cada comando e cada lote da thread de
+    // liberação adiada executam com ela adquirida.
+    std::mutex fsMutex;
+    std::thread reaperThread;           // Thread que libera inodes órfãos
+    std::condition_variable reaperCv;   // Acorda a thread quando há órfãos
+    bool reaperStop;
+
+    // Diário de metadados. Cada comando acumula as imagens dos blocos que
+    // alterou (txnBlocks) e vira uma transação; várias transações são
+    // gravadas no diário com um único fdatasync (commit em grupo) e só então
+    // copiadas para o lugar definitivo na imagem.
+    bool journalEnabled;
+    int journalFd;
+    std::string journalPath;
+    std::map<unsigned int, std::vector<char>> txnBlocks;       // Transação aberta
+    std::map<unsigned int, std::vector<char>> committedBlocks; // Fechadas, aguardando o commit em grupo
+    std::vector<char> journalBuffer;    // Registros ainda não gravados no diário
+    unsigned int journalPending;        // Transações em journalBuffer
+    unsigned int journalSequence;       // Número da última transação
+    off_t journalBytes;                 // Tamanho atual do arquivo de diário
+    std::unordered_set<unsigned int> journaledBlocks; // Blocos presentes no diário desde o último checkpoint
+
+    // Camada de cópia: cada bloco alterado é gravado uma vez no fim do
+    // arquivo de overlay e regravado no mesmo lugar nas alterações seguintes.
+    // O índice (bloco -> posição dos dados) é remontado ao abrir o arquivo.
+    int overlayFd;
+    std::string overlayPath;
+    std::unordered_map<unsigned int, off_t> overlayIndex;
+    off_t overlayEnd;                   // Onde o próximo bloco novo é acrescentado
+
+    // Alocação adiada (import-tar): enquanto ativa, descritores de grupo,
+    // bitmaps e superbloco mudam só em memória e são gravados uma única vez
+    // em endDeferredAllocation()
+    bool deferAllocation;
+    bool deferredSuperDirty;
+    std::vector<ext2_group_desc> deferredGroups;
+    std::vector<bool> deferredGroupsDirty;
+    std::unordered_map<unsigned int, std::vector<unsigned char>> deferredBitmaps; // Bloco do bitmap -> conteúdo
+
+#ifdef HAVE_LIBURING
+    // Fila do io_uring usada pelas leituras em lote (ringReady = false se o
+    // kernel recusar ou se a fila for abandonada depois de uma falha; nesse
+    // caso vale o caminho com pread). ringReady é protegido por ringMutex.
+    struct io_uring ring;
+    bool ringReady;
+    std::mutex ringMutex;               // Uma thread por vez na fila (o sum lê em paralelo)
+#endif
+
+    // Mapa de espaço livre por diretório: para cada bloco, a maior folga onde
+    // cabe uma nova entrada. Montado na primeira inserção e mantido em dia,
+    // evita reler o diretório inteiro a cada inserção.
+    struct DirBlockSlack {
+        unsigned int logical;   // Índice lógico do bloco no diretório
+        unsigned int block;     // Número físico do bloco
+        unsigned int maxFree;   // Maior espaço contíguo livre (bytes)
+        unsigned int totalFree; // Total de bytes sem entradas no bloco
+    };
+    std::unordered_map<unsigned int, std::vector<DirBlockSlack>> dirFreeMap;
+
+    // Cache LRU dos destinos de links simbólicos (inode -> destino), usado
+    // por resolvePath; limitado a SYMLINK_CACHE_MAX entradas
+    std::list<std::pair<unsigned int, std::string>> symlinkLru;
+    std::unordered_map<unsigned int, std::list<std::pair<unsigned int, std::string>>::iterator> symlinkCache;
+
+    unsigned int compactThreshold; // % de espaço livre que dispara 'compact' após remoções (0 = desligado)
+
+    // Um nível do índice de um diretório htree já lido do disco
+    struct DxFrame {
+        unsigned int logical;           // Bloco lógico dentro do diretório
+        unsigned int block;             // Bloco físico
+        unsigned int entriesOffset;     // Onde começa o vetor de ext2_dx_entry
+        unsigned int at;                // Entrada seguida na descida
+        std::vector<char> data;         // Conteúdo do bloco
+
+        ext2_dx_entry* entries() { return reinterpret_cast<ext2_dx_entry*>(&data[entriesOffset]); }
+        ext2_dx_countlimit* countLimit() { return reinterpret_cast<ext2_dx_countlimit*>(&data[entriesOffset]); }
+    };
 
     // --- Métodos Privados de Baixo Nível ---
+    bool diskRead(off_t offset, void* buffer, size_t length);
+    bool diskWrite(off_t offset, const void* buffer, size_t length);
+    bool diskSync();
+    void overlayOpen();
+    bool readImage(off_t offset, void* buffer, size_t length);
+    bool writeImage(off_t offset, const void* buffer, size_t length);
     void readBlock(unsigned int block, void* buffer);
+    void readBlocks(const std::vector<unsigned int>& blocks, char* buffer);
+    void prefetchBlocks(unsigned int first, unsigned int count);
     void writeBlock(unsigned int block, const void* buffer);
+    void writeBlockRun(unsigned int first, unsigned int count, const void* buffer);
+    off_t groupDescOffset(unsigned int groupNum);
+    off_t inodeOffset(unsigned int inodeNum);
     void readGroupDesc(unsigned int groupNum, ext2_group_desc* group);
     void writeGroupDesc(unsigned int groupNum, const ext2_group_desc* group);
     void readInode(unsigned int inodeNum, ext2_inode* inode);
     void writeInode(unsigned int inodeNum, const ext2_inode* inode);
+    unsigned long long inodeFileSize(const ext2_inode& inode);
+    void setInodeFileSize(ext2_inode& inode, unsigned long long size);
+    unsigned int groupCount();
     
     // Métodos para manipulação de Bitmaps
     bool isBitSet(unsigned char* bitmap, int bit);
+    bool uninitGroupsEnabled() const;
+    void readBlockBitmap(unsigned int group, const ext2_group_desc& groupDesc, unsigned char* bitmap);
+    void writeBlockBitmap(ext2_group_desc& groupDesc, const unsigned char* bitmap);
+    void readInodeBitmap(const ext2_group_desc& groupDesc, unsigned char* bitmap);
+    void writeInodeBitmap(ext2_group_desc& groupDesc, const unsigned char* bitmap);
     void setBitmapBit(unsigned int bitmapBlockNum, int bit);
     void clearBitmapBit(unsigned int bitmapBlockNum, int bit);
     int findFreeInode();
@@ -60,19 +281,121 @@ private:
     int allocateBlock();
     void freeInode(unsigned int inodeNum);
     void freeBlock(unsigned int blockNum);
+    void freeBlocks(std::vector<unsigned int>& blocks);
+    void allocateRun(unsigned int first, unsigned int count);
+    int reserveBlocks(unsigned int count, unsigned int goal, std::vector<std::pair<unsigned int, unsigned int>>& extents);
+    void beginDeferredAllocation();
+    void endDeferredAllocation();
+    unsigned int blocksInGroup(unsigned int group);
+    void writeSuperBlock();
+
+    // Liberação adiada: lista de órfãos (s_last_orphan) + thread de fundo
+    void collectTreeBlocks(unsigned int blockNum, int depth, std::vector<unsigned int>& blocks);
+    void collectInodeBlocks(const ext2_inode& inode, std::vector<unsigned int>& blocks);
+    unsigned int truncateBlocks(ext2_inode& inode, unsigned int firstLogical);
+    void orphanAdd(unsigned int inodeNum, ext2_inode& inode);
+    void reapOrphans(unsigned int maxInodes);
+    void reaperLoop();
+
+    // Diário de metadados
+    std::vector<char>& journalTxnBlock(unsigned int block);
+    void journalReplay();
+    void journalCommit();
+    void journalAbort();
+    void journalFlush();
+    void journalCheckpoint();
+
+    // Diretório corrente de cada cliente do modo servidor
+    bool serving; // Em execução como servidor: a entrada padrão não é do comando
+    struct Session {
+        unsigned int inodeNum;
+        std::vector<std::string> path;
+    };
 
     // --- Métodos Auxiliares ---
     void initialize();
     void processCommand(const std::string& line);
+    void dispatchCommand(const std::string& line);
+    std::string executeInSession(Session& session, const std::string& line);
     std::string getPrompt() const;
     unsigned int getInodeByName(const std::string& name);
+    unsigned int findDirEntry(unsigned int dirInodeNum, const std::string& name);
+    unsigned int resolvePath(const std::string& path, bool followLast = true);
+    unsigned int resolveParent(const std::string& path, std::string& name);
+    std::string symlinkTarget(unsigned int inodeNum, const ext2_inode& inode);
+    void forgetSymlink(unsigned int inodeNum);
+    unsigned int parentDirectory(unsigned int dirInodeNum);
     void updateCurrentDirectory(unsigned int inodeNum);
-    void forEachDataBlock(unsigned int inodeNum, std::function<void(const std::vector<char>&)> callback);
-    void forEachDirEntry(unsigned int dirInodeNum, std::function<bool(ext2_dir_entry_2*)> callback);
+    // Iteração sem std::function: o callback é parâmetro de template, então
+    // cada chamada é resolvida (e pode ser inlined) em tempo de compilação.
+    // Definidas em Ext2Shell.cpp, único lugar onde são usadas.
+    template <typename Callback>
+    void forEachBlockNumber(const ext2_inode& inode, Callback&& callback);           // bool(logical, phys)
+    template <typename Callback>
+    void forEachDataBlock(unsigned int inodeNum, Callback&& callback);               // bool(const char* block)
+    template <typename Callback>
+    void forEachDirEntry(unsigned int dirInodeNum, Callback&& callback);             // bool(const ext2_dir_entry_2*)
+    template <typename Callback>
+    bool walkPointerTable(const unsigned int* pointers, int depth, unsigned int logical,
+                          unsigned int span, Callback& callback);
+    void forEachFileExtent(const ext2_inode& inode, std::function<void(unsigned long long, const char*, size_t)> callback);
+    void forEachInodeInTree(unsigned int dirInodeNum, const std::string& path,
+                            std::function<void(const std::string&, unsigned int, const ext2_inode&)> callback);
+    unsigned int countExtents(const ext2_inode& inode, unsigned int* dataBlocks);
+    unsigned int getBlockNumber(const ext2_inode& inode, unsigned int logical);
+    int setBlockNumber(ext2_inode& inode, unsigned int logical, unsigned int phys,
+                       std::vector<unsigned int>* spare = nullptr);
+    unsigned long long countMissingPointerBlocks(const ext2_inode& inode, const std::vector<unsigned int>& logicals,
+                                                 std::vector<unsigned int>& before);
+
+    // Métodos para manipulação de diretórios
+    void measureDirBlock(DirBlockSlack& slot, const char* blockData);
+    std::vector<DirBlockSlack>& getDirFreeMap(unsigned int dirInodeNum);
+    void noteDirBlockChanged(unsigned int dirInodeNum, unsigned int blockNum, const char* blockData);
+    bool insertDirEntryInBlock(char* blockData, unsigned int childInodeNum, const std::string& name, unsigned char fileType);
+    int appendDirBlock(ext2_inode& dirInode, unsigned int& logical);
     int addDirectoryEntry(unsigned int parentInodeNum, unsigned int childInodeNum, const std::string& name, unsigned char fileType);
-    void removeDirectoryEntry(unsigned int parentInodeNum, const std::string& name);
+    bool removeDirectoryEntry(unsigned int parentInodeNum, const std::string& name);
+    int compactDirectory(unsigned int dirInodeNum);
+    int createDirectory(unsigned int parentInodeNum, const std::string& name);
+    void maybeAutoCompact(unsigned int dirInodeNum);
     std::vector<std::string> tokenize(const std::string& input);
 
+    // Diretórios indexados (htree / dir_index)
+    bool dirIndexEnabled() const;
+    uint32_t dxHash(const std::string& name, unsigned char hashVersion);
+    bool dxProbe(const ext2_inode& dirInode, const std::string& name, uint32_t& hash, std::vector<DxFrame>& frames);
+    unsigned int dxLookup(const ext2_inode& dirInode, const std::string& name, bool& indexOk);
+    void dxInsertIndex(DxFrame& frame, uint32_t hash, unsigned int logical);
+    int dxMakeRoom(ext2_inode& dirInode, std::vector<DxFrame>& frames);
+    int dxAddEntry(unsigned int dirInodeNum, ext2_inode& dirInode, unsigned int childInodeNum, const std::string& name, unsigned char fileType);
+    int dxMakeIndexed(unsigned int dirInodeNum, ext2_inode& dirInode);
+
+    // Somas de verificação (sum): um arquivo por tarefa do pool de threads
+    struct SumJob {
+        std::string path;
+        ext2_inode inode;
+        bool sha256;        // false = CRC32C
+        std::string digest; // Soma em hexadecimal
+        std::string error;  // Preenchido se a leitura falhar
+    };
+    void parallelFor(size_t count, const std::function<void(size_t)>& task);
+    std::string checksumFile(const ext2_inode& inode, bool sha256);
+    void checksumFiles(std::vector<SumJob>& jobs);
+    void checkManifest(const std::string& manifestPath);
+    std::string grepFile(const std::string& path, const ext2_inode& inode, const std::string& pattern, bool countOnly);
+    std::string readSymlinkTarget(const ext2_inode& inode);
+    int storeSymlinkTarget(ext2_inode& inode, const std::string& target);
+    int importFileData(ext2_inode& inode, unsigned long long size, const std::function<bool(char*, size_t)>& read,
+                       unsigned int& goal);
+    unsigned int resolveRegularFile(const std::string& path, ext2_inode& inode);
+    int writeFileData(unsigned int inodeNum, ext2_inode& inode, unsigned long long offset,
+                      const std::function<size_t(char*, size_t)>& read, unsigned long long& written);
+    int truncateFile(ext2_inode& inode, unsigned long long size);
+    int preallocateFile(unsigned int inodeNum, ext2_inode& inode, unsigned long long size,
+                        unsigned long long& allocated);
+    void writeFromSource(const std::string& path, unsigned long long offset, bool append, const std::string& source);
+
     // --- Implementação dos Comandos ---
     void cmd_info();
     void cmd_ls();
@@ -86,6 +409,22 @@ private:
     void cmd_rmdir(const std::string& name);
     void cmd_cp(const std::string& source, const std::string& destination);
     void cmd_rename(const std::string& oldName, const std::string& newName);
+    void cmd_mv(const std::string& source, const std::string& destination);
+    void cmd_ln(const std::vector<std::string>& args);
+    void cmd_write(const std::vector<std::string>& args);
+    void cmd_append(const std::string& name, const std::string& source);
+    void cmd_truncate(const std::string& name, const std::string& sizeText);
+    void cmd_fallocate(const std::string& name, const std::string& sizeText);
+    void cmd_compact(const std::vector<std::string>& args);
+    void cmd_frag(const std::string& name);
+    void cmd_defrag(const std::string& name);
+    void cmd_sum(const std::vector<std::string>& args);
+    void cmd_grep(const std::vector<std::string>& args);
+    void cmd_dedupscan(const std::vector<std::string>& args);
+    void cmd_export_tar(const std::string& dir, const std::string& output);
+    void cmd_import_tar(const std::string& input);
+    void cmd_sync();
+    void cmd_commit();
 };
 
 #endif // EXT2_SHELL_H
\ No newline at end of file
@@ -1,15 +1,68 @@
 #include "Ext2Shell.h"
 #include <iostream>
+#include <string>
+#include <vector>
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <image_file.img>" << std::endl;
+    // Cliente do modo servidor: não abre a imagem; o resto da linha são comandos
+    if (argc >= 3 && std::string(argv[1]) == "--client") {
+        return Ext2Shell::runClient(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+    }
+
+    // Comparação de duas imagens: não abre o shell interativo
+    if (argc == 4 && std::string(argv[1]) == "--diff") {
+        try {
+            return Ext2Shell::diffImages(argv[2], argv[3]);
+        } catch (const std::exception& e) {
+            std::cerr << "Fatal Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    bool journal = false;
+    bool lazy = false;
+    unsigned long long mkfsSize = 0;
+    unsigned int blockSize = 4096;
+    std::string image;
+    std::string overlay;
+    std::string socketPath;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--journal") journal = true;
+        else if (arg == "--overlay" && i + 1 < argc) overlay = argv[++i];
+        else if ((arg == "--mkfs" || arg == "--block-size") && i + 1 < argc) {
+            unsigned long long value;
+            if (!Ext2Shell::parseSize(argv[++i], value) || value == 0 || (arg == "--block-size" && value > 65536)) {
+                std::cerr << "Error: Invalid size '" << argv[i] << "' for " << arg << "." << std::endl;
+                return 1;
+            }
+            if (arg == "--mkfs") mkfsSize = value;
+            else blockSize = value;
+        }
+        else if (arg == "--lazy-itable") lazy = true;
+        else if (arg == "--serve" && i + 1 < argc) socketPath = argv[++i];
+        else if (image.empty()) image = arg;
+        else { image.clear(); break; } // Argumento a mais: mostra o uso
+    }
+    if (image.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--journal] [--overlay <overlay_file>] [--serve <socket>] <image_file.img>" << std::endl;
+        std::cerr << "       " << argv[0] << " --client <socket> [command ...]" << std::endl;
+        std::cerr << "       " << argv[0] << " --diff <old_image.img> <new_image.img>" << std::endl;
+        std::cerr << "       " << argv[0] << " --mkfs <size[K|M|G|T]> [--block-size <1024|2048|4096>] [--lazy-itable] <image_file.img>" << std::endl;
         return 1;
     }
 
     try {
-        Ext2Shell shell(argv[1]);
-        shell.run();
+        if (mkfsSize > 0) {
+            Ext2Shell::format(image, mkfsSize, blockSize, lazy);
+            return 0;
+        }
+        Ext2Shell shell(image, journal, overlay);
+        if (socketPath.empty()) {
+            shell.run();
+        } else {
+            shell.serve(socketPath);
+        }
     } catch (const std::exception& e) {
         std::cerr << "Fatal Error: " << e.what() << std::endl;
         return 1;
@@ -19,6 +19,22 @@ typedef uint32_t __u32;
 #define EXT2_NAME_LEN               255     // Comprimento máximo de um nome de arquivo
 #define EXT2_ROOT_INO               2       // O inode do diretório raiz é sempre o 2
 
+// --- Recursos (features) do Superbloco ---
+#define EXT2_FEATURE_COMPAT_DIR_INDEX   0x0020  // Diretórios indexados por hash (htree)
+#define EXT2_FEATURE_INCOMPAT_FILETYPE  0x0002  // Entradas de diretório guardam o tipo do arquivo
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001 // Cópias do superbloco só nos grupos 0, 1 e potências de 3, 5 e 7
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE 0x0002 // Arquivos >= 2 GiB (i_size_high em i_dir_acl)
+#define EXT2_FEATURE_RO_COMPAT_GDT_CSUM 0x0010  // Grupos não inicializados + checksum dos descritores (uninit_bg)
+
+// --- Flags do campo bg_flags do Descritor de Grupo (uninit_bg) ---
+#define EXT2_BG_INODE_UNINIT        0x0001  // Bitmap de inodes ainda não inicializado (todos livres)
+#define EXT2_BG_BLOCK_UNINIT        0x0002  // Bitmap de blocos ainda não inicializado (só metadados ocupados)
+#define EXT2_BG_INODE_ZEROED        0x0004  // Tabela de inodes já zerada no disco
+
+// --- Flags do campo s_flags do Superbloco ---
+#define EXT2_FLAGS_SIGNED_HASH      0x0001  // Hash de diretório usa char com sinal
+#define EXT2_FLAGS_UNSIGNED_HASH    0x0002  // Hash de diretório usa char sem sinal
+
 // --- Estrutura do Superbloco ---
 // Contém metadados globais sobre todo o sistema de arquivos.
 struct ext2_super_block {
@@ -67,12 +83,18 @@ struct ext2_super_block {
     __u32   s_hash_seed[4];         /* Sementes do hash (para diretórios indexados) */
     __u8    s_def_hash_version;     /* Versão do algoritmo de hash padrão */
     __u8    s_reserved_char_pad;
-    __u16   s_reserved_word_pad;
+    __u16   s_reserved_gdt_blocks;  /* Blocos reservados para crescer a tabela de descritores */
     __u32   s_default_mount_opts;
     __u32   s_first_meta_bg;        /* Primeiro grupo de blocos de metadados */
     __u32   s_mkfs_time;            /* Horário de criação do FS */
     __u32   s_jnl_blocks[17];       /* Backup do inode do journal */
-    __u32   s_reserved[172];        /* Preenchimento para 1024 bytes */
+    __u32   s_blocks_count_hi;      /* (ext4) Parte alta da contagem de blocos */
+    __u32   s_r_blocks_count_hi;    /* (ext4) Parte alta dos blocos reservados */
+    __u32   s_free_blocks_hi;       /* (ext4) Parte alta dos blocos livres */
+    __u16   s_min_extra_isize;      /* (ext4) Tamanho extra mínimo dos inodes */
+    __u16   s_want_extra_isize;     /* (ext4) Tamanho extra desejado dos inodes */
+    __u32   s_flags;                /* Flags diversas (ex: hash com/sem sinal) */
+    __u32   s_reserved[167];        /* Preenchimento para 1024 bytes */
 };
 
 // --- Estrutura do Descritor de Grupo de Blocos ---
@@ -84,8 +106,12 @@ struct ext2_group_desc {
     __u16   bg_free_blocks_count;   /* Contagem de blocos livres no grupo */
     __u16   bg_free_inodes_count;   /* Contagem de inodes livres no grupo */
     __u16   bg_used_dirs_count;     /* Contagem de diretórios no grupo */
-    __u16   bg_pad;
-    __u32   bg_reserved[3];
+    __u16   bg_flags;               /* EXT2_BG_* (uninit_bg) */
+    __u32   bg_exclude_bitmap;
+    __u16   bg_block_bitmap_csum;
+    __u16   bg_inode_bitmap_csum;
+    __u16   bg_itable_unused;       /* Inodes nunca usados no fim da tabela (uninit_bg) */
+    __u16   bg_checksum;            /* CRC16 do descritor (uninit_bg) */
 };
 
 // --- Estrutura do Inode ---
@@ -111,6 +137,9 @@ struct ext2_inode {
     __u8    i_osd2[12];             /* Específico do SO 2 */
 };
 
+// --- Flags do campo i_flags do Inode ---
+#define EXT2_INDEX_FL               0x00001000 // Diretório indexado por hash (htree)
+
 // --- Constantes para o campo i_mode do Inode ---
 
 // Macros para verificar o tipo de arquivo
@@ -148,4 +177,36 @@ struct ext2_dir_entry_2 {
 #define EXT2_FT_SOCK        6
 #define EXT2_FT_SYMLINK     7
 
+// --- Estruturas de Diretórios Indexados (htree / dir_index) ---
+// O primeiro bloco de um diretório indexado (dx_root) começa com as entradas
+// '.' e '..' (esta ocupando o resto do bloco), seguidas de ext2_dx_root_info e
+// do vetor de ext2_dx_entry. Nós internos são um bloco com uma entrada vazia
+// (inode 0, rec_len = bloco inteiro) seguida do vetor. Nos dois casos a
+// primeira ext2_dx_entry guarda, no lugar do hash, o ext2_dx_countlimit.
+
+#define EXT2_HASH_LEGACY            0
+#define EXT2_HASH_HALF_MD4          1
+#define EXT2_HASH_TEA               2
+#define EXT2_HASH_LEGACY_UNSIGNED   3   // Variantes "sem sinal": só em memória,
+#define EXT2_HASH_HALF_MD4_UNSIGNED 4   // escolhidas por s_flags
+#define EXT2_HASH_TEA_UNSIGNED      5
+
+struct ext2_dx_root_info {
+    __u32   reserved_zero;          /* Sempre zero */
+    __u8    hash_version;           /* Algoritmo de hash (EXT2_HASH_*) */
+    __u8    info_length;            /* Tamanho desta estrutura (8) */
+    __u8    indirect_levels;        /* Níveis de nós internos abaixo da raiz */
+    __u8    unused_flags;
+};
+
+struct ext2_dx_entry {
+    __u32   hash;                   /* Menor hash coberto por este ramo (bit 0 = continuação de colisão) */
+    __u32   block;                  /* Bloco lógico do diretório para onde aponta */
+};
+
+struct ext2_dx_countlimit {
+    __u16   limit;                  /* Máximo de entradas que cabem no bloco */
+    __u16   count;                  /* Entradas em uso (incluindo esta) */
+};
+
 #endif // NEXT2SHELL_H
\ No newline at end of file